@@ -0,0 +1,86 @@
+/**
+ * Connection churn benchmark
+ *
+ * Client threads connect to a TcpServer over loopback and reset the
+ * connection right away, so the server does nothing but the
+ * accept/establish/close/destroy cycle. Reports connections per second, and
+ * per core as every server I/O thread is one core.
+ *
+ * Usage: connection_churn [io_threads] [client_threads] [seconds] [port]
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "event_loop.h"
+#include "inet_addr.h"
+#include "tcp_server.h"
+#include "timestamp.h"
+
+std::atomic<bool> g_running{true};
+std::atomic<int64_t> g_connections{0};
+
+void churn(uint16_t port) {
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  /* RST on close, so the client side leaves no TIME_WAIT behind */
+  struct linger lg = {1, 0};
+
+  while (g_running) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) ==
+        0) {
+      ++g_connections;
+    }
+    ::close(fd);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int io_threads = argc > 1 ? atoi(argv[1]) : 1;
+  int client_threads = argc > 2 ? atoi(argv[2]) : 4;
+  double seconds = argc > 3 ? atof(argv[3]) : 10.0;
+  uint16_t port = static_cast<uint16_t>(argc > 4 ? atoi(argv[4]) : 2008);
+
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(port));
+  server.setConnectionCallback([](const TcpConnectionPtr&) {});
+  server.setMessageCallback(
+      [](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+        buf->retrieveAll();
+      });
+  server.setThreadNum(io_threads);
+  server.start();
+
+  std::vector<std::thread> clients;
+  for (int i = 0; i < client_threads; ++i) {
+    clients.emplace_back(churn, port);
+  }
+
+  Timestamp start(Timestamp::now());
+  loop.runAfter(seconds, [&] {
+    g_running = false;
+    double elapsed = timeDifference(Timestamp::now(), start);
+    double rate = static_cast<double>(g_connections) / elapsed;
+    int cores = io_threads > 0 ? io_threads : 1;
+    printf("connections %lld in %.2fs: %.0f conn/s, %.0f conn/s/core\n",
+           static_cast<long long>(g_connections.load()), elapsed, rate,
+           rate / cores);
+    loop.quit();
+  });
+  loop.loop();
+
+  for (auto& t : clients) {
+    t.join();
+  }
+}
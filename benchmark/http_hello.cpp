@@ -0,0 +1,115 @@
+/**
+ * HttpServer benchmark target, for wrk or any HTTP/1.1 load generator
+ *
+ * - /        "hello, world\n", the per-request overhead of the server
+ * - /64k     a 64 KiB body shared by every response as one Slice
+ * - /echo    the request body, e.g. for POST and chunked uploads
+ * - /cached  "hello, world\n" from HttpResponseCache, with ETag
+ * - /stream  1 GiB streamed chunked, repeating the 64 KiB Slice, memory per
+ *            connection stays bounded
+ * - /ws      WebSocket echo
+ *
+ * Usage: http_hello [io_threads] [port] [admin_port]
+ *
+ * With an admin port, GET /metrics there serves the metrics of the server,
+ * e.g. curl http://127.0.0.1:9100/metrics, and /trace?start, /trace?stop
+ * and /trace record a Chrome trace, see AdminServer
+ *
+ * @code
+ * wrk -t4 -c256 -d30s --latency http://127.0.0.1:8000/
+ * wrk -t4 -c256 -d30s --latency -s pipeline.lua http://127.0.0.1:8000/
+ * @endcode
+ * where pipeline.lua sends 16 pipelined requests per round trip:
+ * @code
+ * init = function(args)
+ *   local r = {}
+ *   for i = 1, 16 do r[i] = wrk.format(nil, "/") end
+ *   req = table.concat(r)
+ * end
+ * request = function() return req end
+ * @endcode
+ */
+#include <stdlib.h>
+
+#include <memory>
+
+#include "admin_server.h"
+#include "event_loop.h"
+#include "http_response_cache.h"
+#include "http_server.h"
+#include "inet_addr.h"
+#include "slice.h"
+#include "stream_producer.h"
+
+/* Yields @block @count times */
+class RepeatProducer : public StreamProducer {
+ public:
+  RepeatProducer(const Slice& block, size_t count)
+      : block_(block), count_(count) {}
+
+  State produce(size_t, Slice* chunk) override {
+    if (count_ == 0) {
+      return State::Done;
+    }
+    --count_;
+    *chunk = block_;
+    return State::Data;
+  }
+
+ private:
+  Slice block_;
+  size_t count_;
+};
+
+int main(int argc, char* argv[]) {
+  int io_threads = argc > 1 ? atoi(argv[1]) : 4;
+  uint16_t port = static_cast<uint16_t>(argc > 2 ? atoi(argv[2]) : 8000);
+  uint16_t admin_port = static_cast<uint16_t>(argc > 3 ? atoi(argv[3]) : 0);
+
+  const Slice large(std::string(64 * 1024, 'x'));
+
+  HttpResponseCache cache(64 * 1024 * 1024);
+  cache.put("/cached", HttpResponseCache::makeEntry(
+                           "text/plain", std::string("hello, world\n"),
+                           std::string(), "max-age=60"));
+
+  EventLoop loop;
+  HttpServer server(&loop, InetAddress(port));
+  server.setThreadNum(io_threads);
+  server.setResponseCache(&cache);
+  server.setHttpCallback([&large](const HttpRequest& request,
+                                  HttpResponse* response) {
+    std::string_view path = request.path();
+    if (path == "/") {
+      response->setContentType("text/plain");
+      response->setBody(std::string_view("hello, world\n"));
+    } else if (path == "/64k") {
+      response->setContentType("application/octet-stream");
+      response->setBody(large);
+    } else if (path == "/stream") {
+      response->setContentType("application/octet-stream");
+      response->setBodyProducer(
+          std::make_shared<RepeatProducer>(large, 16 * 1024));
+    } else if (path == "/ws") {
+      WebSocketCodec::acceptUpgrade(request, response);
+    } else if (path == "/echo") {
+      response->setContentType("application/octet-stream");
+      response->setBody(request.body());
+    } else {
+      response->setStatusCode(HttpResponse::StatusCode::NotFound);
+    }
+  });
+  server.setWebSocketCallback(
+      ConnectionCallback(),
+      [](const TcpConnectionPtr& conn, WebSocketOpcode opcode,
+         std::string_view payload,
+         Timestamp) { WebSocketCodec::send(conn, opcode, payload); });
+  server.start();
+  /* On the base loop, which only accepts */
+  std::unique_ptr<AdminServer> admin;
+  if (admin_port != 0) {
+    admin.reset(new AdminServer(&loop, InetAddress(admin_port)));
+    admin->start();
+  }
+  loop.loop();
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Latency histogram with bounded relative error, in the spirit of
+ * HdrHistogram
+ *
+ * Values below SubBucketCount are counted exactly. Above that every power of
+ * two range is split into SubBucketCount linear sub-buckets, so a recorded
+ * value is reported within 1 / SubBucketCount (< 1%) of itself, whatever its
+ * magnitude. Recording is a shift and an increment, no allocation.
+ *
+ * Not thread safe: keep one per thread and merge() them at the end.
+ */
+class LatencyHistogram {
+ public:
+  static const int SubBucketBits = 7;
+  static const int SubBucketCount = 1 << SubBucketBits;
+  static const int BucketCount = 64 - SubBucketBits + 1;
+
+  LatencyHistogram()
+      : counts_(BucketCount * SubBucketCount, 0),
+        total_(0),
+        min_(UINT64_MAX),
+        max_(0),
+        sum_(0) {}
+
+  // default copy/assignment are Okay
+
+  void record(uint64_t value) {
+    ++counts_[indexOf(value)];
+    ++total_;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += value;
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+  }
+
+  /* Smallest recorded value v such that @percentile % of values are <= v */
+  uint64_t percentile(double percentile) const {
+    if (total_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total_ + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(highestEquivalent(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  uint64_t count() const { return total_; }
+
+  uint64_t min() const { return total_ ? min_ : 0; }
+
+  uint64_t max() const { return max_; }
+
+  double mean() const {
+    return total_ ? static_cast<double>(sum_) / total_ : 0.0;
+  }
+
+ private:
+  /**
+   * @code
+   * value < SubBucketCount:  index = value
+   * otherwise:               shift = log2(value) - SubBucketBits
+   *                          index = (shift + 1) * SubBucketCount
+   *                                  + (value >> shift) - SubBucketCount
+   * @endcode
+   */
+  static size_t indexOf(uint64_t value) {
+    if (value < static_cast<uint64_t>(SubBucketCount)) {
+      return static_cast<size_t>(value);
+    }
+    int shift = 63 - __builtin_clzll(value) - SubBucketBits;
+    return static_cast<size_t>(shift + 1) * SubBucketCount +
+           static_cast<size_t>(value >> shift) - SubBucketCount;
+  }
+
+  /* Largest value counted in bucket @index */
+  static uint64_t highestEquivalent(size_t index) {
+    if (index < static_cast<size_t>(SubBucketCount)) {
+      return index;
+    }
+    int shift = static_cast<int>(index / SubBucketCount) - 1;
+    uint64_t sub = index % SubBucketCount + SubBucketCount;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+  uint64_t min_;
+  uint64_t max_;
+  uint64_t sum_;
+};
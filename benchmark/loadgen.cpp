@@ -0,0 +1,386 @@
+/**
+ * Pingpong and request/response load generator
+ *
+ * Opens connections to an echo server (example/echo listens on 2007) from
+ * several EventLoops and reports throughput and latency percentiles, merged
+ * from one LatencyHistogram per loop.
+ *
+ * - pingpong: closed loop, every connection keeps @depth messages of @size
+ *   bytes in flight and resends each one as soon as it is echoed back.
+ *   Latency is the round trip of each message.
+ * - reqresp: open loop, @rate requests per second in total are scheduled
+ *   evenly over the connections whatever the responses do. Latency is
+ *   measured from the scheduled send time, not the actual one, so a stalled
+ *   server can't hide its queueing delay (coordinated omission). Sends are
+ *   issued by a TickInterval timer, which bounds the added error. Requests
+ *   due on a disconnected connection are not skipped silently, they are
+ *   counted as errors.
+ *
+ * Requests lost with their connection are counted as errors too, in both
+ * modes.
+ *
+ * Usage: loadgen [-a ip] [-p port] [-c connections] [-t threads] [-d seconds]
+ *                [-s size] [-m pingpong|reqresp] [-r rate] [-q depth]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "countdown_latch.h"
+#include "event_loop.h"
+#include "event_loop_thread.h"
+#include "inet_addr.h"
+#include "latency_histogram.h"
+#include "slice.h"
+#include "tcp_client.h"
+
+namespace {
+/* Period of the open loop send timer, in seconds */
+const double TickInterval = 0.0001;
+
+int64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Options {
+  std::string ip = "127.0.0.1";
+  uint16_t port = 2007;
+  int connections = 100;
+  int threads = 4;
+  double seconds = 10.0;
+  size_t size = 64;
+  bool open_loop = false;
+  double rate = 10000.0;
+  int depth = 1;
+};
+
+/**
+ * The connections of one loop, only touched in that loop's thread
+ */
+class Worker {
+ public:
+  Worker(EventLoop* loop, const Options& options, int connections,
+         CountDownLatch* connected)
+      : loop_(loop),
+        options_(options),
+        num_connections_(connections),
+        connected_latch_(connected),
+        payload_(std::string(options.size, 'x')),
+        interval_ns_(0),
+        start_ns_(0),
+        running_(false),
+        num_connected_(0),
+        messages_(0),
+        bytes_(0),
+        errors_(0) {}
+
+  /* Open the connections, connected_latch_ is counted down once all are up */
+  void start() {
+    loop_->assertInLoopThread();
+    InetAddress server_addr(options_.ip, options_.port);
+    for (int i = 0; i < num_connections_; ++i) {
+      std::unique_ptr<Session> session(new Session);
+      Session* s = session.get();
+      session->client.reset(new TcpClient(loop_, server_addr, "loadgen"));
+      session->client->setConnectionCallback(
+          [this, s](const TcpConnectionPtr& conn) { onConnection(s, conn); });
+      session->client->setMessageCallback(
+          [this, s](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+            onMessage(s, buf);
+          });
+      session->client->connect();
+      sessions_.push_back(std::move(session));
+    }
+  }
+
+  /* Start sending, responses to requests sent before @start_ns are ignored */
+  void beginMeasure(int64_t start_ns) {
+    loop_->assertInLoopThread();
+    start_ns_ = start_ns;
+    running_ = true;
+    if (options_.open_loop) {
+      double per_connection = options_.rate / options_.connections;
+      interval_ns_ = static_cast<int64_t>(1e9 / per_connection);
+      /* Spread the connections' phases over one interval */
+      for (size_t i = 0; i < sessions_.size(); ++i) {
+        sessions_[i]->phase_ns = interval_ns_ * i / sessions_.size();
+      }
+      loop_->runEvery(TickInterval, [this] { onTick(); });
+    } else {
+      int64_t now = nowNanos();
+      for (auto& session : sessions_) {
+        for (int i = 0; i < options_.depth; ++i) {
+          sendRequest(session.get(), now);
+        }
+      }
+    }
+  }
+
+  /* Stop sending and close every connection */
+  void stop() {
+    loop_->assertInLoopThread();
+    running_ = false;
+    for (auto& session : sessions_) {
+      /* The connections outlive their sessions until closed */
+      if (session->conn) {
+        session->conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+        session->conn->setMessageCallback(
+            [](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+              buf->retrieveAll();
+            });
+      }
+    }
+    sessions_.clear();
+  }
+
+  const LatencyHistogram& histogram() const { return histogram_; }
+
+  uint64_t messages() const { return messages_; }
+
+  uint64_t bytes() const { return bytes_; }
+
+  /* Requests never sent, or sent and lost with their connection */
+  uint64_t errors() const { return errors_; }
+
+ private:
+  struct Session {
+    std::unique_ptr<TcpClient> client;
+    TcpConnectionPtr conn;
+    /* Send time (closed loop) or scheduled time (open loop) of each request */
+    std::deque<int64_t> in_flight;
+    /* Bytes of the response to in_flight.front() received so far */
+    size_t partial = 0;
+    uint64_t scheduled = 0;
+    int64_t phase_ns = 0;
+  };
+
+  void onConnection(Session* s, const TcpConnectionPtr& conn) {
+    if (conn->connected()) {
+      conn->setTcpNoDelay(true);
+      s->conn = conn;
+      if (++num_connected_ == num_connections_) {
+        connected_latch_->countDown();
+      }
+    } else {
+      s->conn.reset();
+      if (running_) {
+        for (int64_t sent : s->in_flight) {
+          if (sent >= start_ns_) {
+            ++errors_;
+          }
+        }
+      }
+      s->in_flight.clear();
+      s->partial = 0;
+    }
+  }
+
+  void onMessage(Session* s, Buffer* buf) {
+    const int64_t now = nowNanos();
+    const size_t n = buf->readableBytes();
+    buf->retrieveAll();
+    if (running_) {
+      bytes_ += n;
+    }
+    s->partial += n;
+    while (s->partial >= options_.size && !s->in_flight.empty()) {
+      s->partial -= options_.size;
+      int64_t sent = s->in_flight.front();
+      s->in_flight.pop_front();
+      if (running_ && sent >= start_ns_) {
+        histogram_.record(static_cast<uint64_t>(now - sent));
+        ++messages_;
+      }
+      if (running_ && !options_.open_loop) {
+        sendRequest(s, now);
+      }
+    }
+  }
+
+  /* Send every request whose scheduled time has come */
+  void onTick() {
+    if (!running_) {
+      return;
+    }
+    const int64_t now = nowNanos();
+    for (auto& session : sessions_) {
+      Session* s = session.get();
+      int64_t elapsed = now - start_ns_ - s->phase_ns;
+      if (elapsed < 0) {
+        continue;
+      }
+      uint64_t due = static_cast<uint64_t>(elapsed / interval_ns_) + 1;
+      while (s->scheduled < due) {
+        sendRequest(s, start_ns_ + s->phase_ns +
+                           static_cast<int64_t>(s->scheduled) * interval_ns_);
+        ++s->scheduled;
+      }
+    }
+  }
+
+  void sendRequest(Session* s, int64_t stamp) {
+    if (s->conn) {
+      s->in_flight.push_back(stamp);
+      /* Every request shares one payload */
+      s->conn->send(payload_);
+    } else if (running_) {
+      /* Dropping it silently would hide the outage from the results */
+      ++errors_;
+    }
+  }
+
+  EventLoop* loop_;
+  const Options options_;
+  const int num_connections_;
+  CountDownLatch* connected_latch_;
+  const Slice payload_;
+  int64_t interval_ns_;
+  int64_t start_ns_;
+  bool running_;
+  int num_connected_;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  LatencyHistogram histogram_;
+  uint64_t messages_;
+  uint64_t bytes_;
+  uint64_t errors_;
+};
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-a ip] [-p port] [-c connections] [-t threads] "
+          "[-d seconds] [-s size] [-m pingpong|reqresp] [-r rate] "
+          "[-q depth]\n",
+          prog);
+  exit(1);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:p:c:t:d:s:m:r:q:")) != -1) {
+    switch (opt) {
+      case 'a':
+        options.ip = optarg;
+        break;
+      case 'p':
+        options.port = static_cast<uint16_t>(atoi(optarg));
+        break;
+      case 'c':
+        options.connections = atoi(optarg);
+        break;
+      case 't':
+        options.threads = atoi(optarg);
+        break;
+      case 'd':
+        options.seconds = atof(optarg);
+        break;
+      case 's':
+        options.size = static_cast<size_t>(atol(optarg));
+        break;
+      case 'm':
+        if (strcmp(optarg, "pingpong") == 0) {
+          options.open_loop = false;
+        } else if (strcmp(optarg, "reqresp") == 0) {
+          options.open_loop = true;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 'r':
+        options.rate = atof(optarg);
+        break;
+      case 'q':
+        options.depth = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (options.threads < 1 || options.connections < options.threads ||
+      options.size == 0 || options.rate <= 0 || options.depth < 1) {
+    usage(argv[0]);
+  }
+
+  /* Workers outlive the loops, whose timers may still refer to them */
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::unique_ptr<EventLoopThread>> threads;
+  std::vector<EventLoop*> loops;
+  CountDownLatch connected(options.threads);
+  for (int i = 0; i < options.threads; ++i) {
+    threads.emplace_back(new EventLoopThread);
+    EventLoop* loop = threads.back()->startLoop();
+    loops.push_back(loop);
+    int connections = options.connections / options.threads +
+                      (i < options.connections % options.threads ? 1 : 0);
+    workers.emplace_back(new Worker(loop, options, connections, &connected));
+  }
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker] { worker->start(); });
+  }
+  connected.wait();
+
+  const int64_t start = nowNanos();
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker, start] {
+      worker->beginMeasure(start);
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+
+  CountDownLatch stopped(options.threads);
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker, &stopped] {
+      worker->stop();
+      stopped.countDown();
+    });
+  }
+  stopped.wait();
+  const double elapsed = static_cast<double>(nowNanos() - start) / 1e9;
+
+  LatencyHistogram merged;
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+  for (auto& worker : workers) {
+    merged.merge(worker->histogram());
+    messages += worker->messages();
+    bytes += worker->bytes();
+    errors += worker->errors();
+  }
+
+  printf("%s: %d connections on %d threads, %zu bytes, %.2fs\n",
+         options.open_loop ? "reqresp" : "pingpong", options.connections,
+         options.threads, options.size, elapsed);
+  if (options.open_loop) {
+    printf("target %.0f req/s\n", options.rate);
+  }
+  printf("throughput %.0f msg/s, %.2f MiB/s\n", messages / elapsed,
+         bytes / elapsed / (1024 * 1024));
+  printf("errors %lu (not sent while disconnected, or lost with the "
+         "connection)\n",
+         static_cast<unsigned long>(errors));
+  printf("latency us: min %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f "
+         "mean %.1f\n",
+         merged.min() / 1e3, merged.percentile(50) / 1e3,
+         merged.percentile(99) / 1e3, merged.percentile(99.9) / 1e3,
+         merged.max() / 1e3, merged.mean() / 1e3);
+  threads.clear();
+}
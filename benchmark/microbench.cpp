@@ -0,0 +1,332 @@
+/**
+ * Microbenchmarks of the hot paths
+ *
+ * - buffer_*: Buffer append/retrieve, makeSpace() compaction, readFd() over a
+ *   socketpair
+ * - poller_poll: one EventLoop iteration, i.e. poll(2) + fillActiveChannels()
+ *   + dispatch, with 1k to 100k registered fds of which ActiveFds are ready
+ * - timer_queue: insert and expire timers at scale
+ * - run_in_loop: cross-thread runInLoop() round trip
+ * - log_stream: LogStream formatting throughput
+ *
+ * Results are written as JSON, one entry per benchmark and parameter, so runs
+ * of two versions can be diffed by a script.
+ *
+ * Usage: microbench [-f filter] [-o output.json] [-t min_seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "channel.h"
+#include "event_loop.h"
+#include "event_loop_thread.h"
+#include "log_stream.h"
+
+namespace {
+/* Ready fds in poller_poll, the rest are idle */
+const int ActiveFds = 4;
+
+struct Result {
+  std::string name;
+  int64_t param;
+  uint64_t iterations;
+  double ns_per_op;
+};
+
+std::vector<Result> g_results;
+std::string g_filter;
+double g_min_seconds = 0.5;
+
+int64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool selected(const std::string& name) {
+  return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+void report(const std::string& name, int64_t param, uint64_t iterations,
+            int64_t elapsed_ns) {
+  Result result{name, param, iterations,
+                static_cast<double>(elapsed_ns) / iterations};
+  fprintf(stderr, "%-28s %8lld %12llu iterations %12.1f ns/op\n",
+          name.c_str(), static_cast<long long>(param),
+          static_cast<unsigned long long>(iterations), result.ns_per_op);
+  g_results.push_back(result);
+}
+
+/**
+ * Call @body(n) with a growing n until one call lasts g_min_seconds, the last
+ * call is reported. @body runs n operations
+ */
+void run(const std::string& name, int64_t param,
+         const std::function<void(uint64_t)>& body) {
+  if (!selected(name)) {
+    return;
+  }
+  uint64_t n = 1;
+  while (true) {
+    int64_t start = nowNanos();
+    body(n);
+    int64_t elapsed = nowNanos() - start;
+    if (elapsed >= g_min_seconds * 1e9 || n >= (1ULL << 40)) {
+      report(name, param, n, elapsed);
+      return;
+    }
+    /* Aim a bit past the target so the next call is usually the last */
+    double scale = elapsed > 0 ? g_min_seconds * 1.2e9 / elapsed : 100.0;
+    n = static_cast<uint64_t>(n * std::min(std::max(scale, 2.0), 100.0));
+  }
+}
+
+/* Run @body in a fresh thread, so that it may own an EventLoop */
+void runInThread(const std::function<void()>& body) {
+  std::thread thread(body);
+  thread.join();
+}
+
+void benchBuffer() {
+  for (size_t size : {16, 256, 4096}) {
+    std::string data(size, 'x');
+    run("buffer_append_retrieve", size, [&](uint64_t n) {
+      Buffer buf;
+      for (uint64_t i = 0; i < n; ++i) {
+        buf.append(data.data(), data.size());
+        buf.retrieveAll();
+      }
+    });
+  }
+
+  /* Readable bytes creep up until makeSpace() compacts or grows the buffer */
+  for (size_t size : {1024, 16384}) {
+    std::string data(size, 'x');
+    run("buffer_make_space", size, [&](uint64_t n) {
+      Buffer buf;
+      for (uint64_t i = 0; i < n; ++i) {
+        buf.append(data.data(), data.size());
+        buf.retrieve(buf.readableBytes() > size ? size + size / 8 : size / 2);
+      }
+    });
+  }
+
+  for (size_t size : {1024, 16384}) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+      perror("socketpair");
+      return;
+    }
+    std::string data(size, 'x');
+    run("buffer_read_fd", size, [&](uint64_t n) {
+      Buffer buf;
+      int saved_errno = 0;
+      for (uint64_t i = 0; i < n; ++i) {
+        if (::write(fds[1], data.data(), data.size()) !=
+            static_cast<ssize_t>(data.size())) {
+          abort();
+        }
+        while (buf.readableBytes() < size) {
+          buf.readFd(fds[0], &saved_errno);
+        }
+        buf.retrieveAll();
+      }
+    });
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+}
+
+/**
+ * One pending functor re-queues itself, so every iteration of the loop polls
+ * all @num_fds fds, finds ActiveFds of them (plus the wakeup fd) ready and
+ * dispatches them
+ */
+void benchPoller(int num_fds) {
+  if (!selected("poller_poll")) {
+    return;
+  }
+  runInThread([num_fds] {
+    EventLoop loop;
+    std::vector<int> fds;
+    std::vector<std::unique_ptr<Channel>> channels;
+    for (int i = 0; i < num_fds; ++i) {
+      int fd = ::eventfd(i < ActiveFds ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (fd < 0) {
+        perror("eventfd");
+        break;
+      }
+      fds.push_back(fd);
+      channels.emplace_back(new Channel(&loop, fd));
+      /* Level triggered and never read, so it stays ready */
+      channels.back()->setReadCallback([](Timestamp) {});
+      channels.back()->enableReading();
+    }
+
+    if (static_cast<int>(fds.size()) == num_fds) {
+      run("poller_poll", num_fds, [&loop](uint64_t n) {
+        uint64_t iterations = 0;
+        std::function<void()> tick;
+        tick = [&] {
+          if (++iterations >= n) {
+            loop.quit();
+          } else {
+            loop.queueInLoop(tick);
+          }
+        };
+        loop.queueInLoop(tick);
+        loop.loop();
+      });
+    }
+
+    for (auto& channel : channels) {
+      channel->disableAllEvents();
+      loop.removeChannel(channel.get());
+    }
+    for (int fd : fds) {
+      ::close(fd);
+    }
+  });
+}
+
+/* Insert @num_timers timers due within 1ms in random order, run until all fire */
+void benchTimerQueue(int num_timers) {
+  if (!selected("timer_queue")) {
+    return;
+  }
+  runInThread([num_timers] {
+    EventLoop loop;
+    std::mt19937 rng(num_timers);
+    std::uniform_real_distribution<double> delay(0.0, 0.001);
+    int fired = 0;
+    int64_t start = nowNanos();
+    for (int i = 0; i < num_timers; ++i) {
+      loop.runAfter(delay(rng), [&] {
+        if (++fired == num_timers) {
+          loop.quit();
+        }
+      });
+    }
+    int64_t inserted = nowNanos();
+    loop.loop();
+    int64_t expired = nowNanos();
+    report("timer_queue_insert", num_timers, num_timers, inserted - start);
+    report("timer_queue_insert_expire", num_timers, num_timers,
+           expired - start);
+  });
+}
+
+void benchRunInLoop() {
+  if (!selected("run_in_loop")) {
+    return;
+  }
+  EventLoopThread thread;
+  EventLoop* loop = thread.startLoop();
+  run("run_in_loop_round_trip", 0, [loop](uint64_t n) {
+    std::atomic<bool> done;
+    for (uint64_t i = 0; i < n; ++i) {
+      done.store(false, std::memory_order_relaxed);
+      loop->runInLoop([&done] { done.store(true, std::memory_order_release); });
+      while (!done.load(std::memory_order_acquire)) {
+      }
+    }
+  });
+}
+
+void benchLogStream() {
+  int value = 0;
+  run("log_stream_format", 0, [&value](uint64_t n) {
+    LogStream stream;
+    for (uint64_t i = 0; i < n; ++i) {
+      stream << "TcpConnection::handleRead fd = " << ++value
+             << " bytes = " << 4096L << " elapsed " << 0.25 << ' '
+             << static_cast<const void*>(&stream);
+      stream.resetBuffer();
+    }
+  });
+}
+
+/* Room for 100k fds */
+void raiseFdLimit() {
+  struct rlimit limit;
+  if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+void writeJson(FILE* out) {
+  fprintf(out, "{\n  \"context\": {\"cpus\": %u, \"min_seconds\": %g},\n",
+          std::thread::hardware_concurrency(), g_min_seconds);
+  fprintf(out, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < g_results.size(); ++i) {
+    const Result& r = g_results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"param\": %lld, \"iterations\": %llu, "
+            "\"ns_per_op\": %.3f, \"ops_per_sec\": %.1f}%s\n",
+            r.name.c_str(), static_cast<long long>(r.param),
+            static_cast<unsigned long long>(r.iterations), r.ns_per_op,
+            1e9 / r.ns_per_op, i + 1 < g_results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* output = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:o:t:")) != -1) {
+    switch (opt) {
+      case 'f':
+        g_filter = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 't':
+        g_min_seconds = atof(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-f filter] [-o output.json] [-t seconds]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  raiseFdLimit();
+
+  benchBuffer();
+  for (int num_fds : {1000, 10000, 100000}) {
+    benchPoller(num_fds);
+  }
+  for (int num_timers : {1000, 100000}) {
+    benchTimerQueue(num_timers);
+  }
+  benchRunInLoop();
+  benchLogStream();
+
+  FILE* out = output ? fopen(output, "w") : stdout;
+  if (out == nullptr) {
+    perror("fopen");
+    return 1;
+  }
+  writeJson(out);
+  if (out != stdout) {
+    fclose(out);
+  }
+}
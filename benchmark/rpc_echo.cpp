@@ -0,0 +1,310 @@
+/**
+ * RPC echo benchmark
+ *
+ * RpcClients on several EventLoops call the echo method of an RpcServer,
+ * every client keeping @depth calls in flight on its one connection. Reports
+ * calls per second and latency percentiles merged from one LatencyHistogram
+ * per loop. Response callbacks capture two words, so std::function keeps them
+ * inline and a call allocates nothing once the pending table has grown.
+ *
+ * Usage: rpc_echo [-m both|server|client] [-a ip] [-p port] [-c clients]
+ *                 [-t threads] [-d seconds] [-s size] [-q depth]
+ * "both" runs the server in the same process, on its own threads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "countdown_latch.h"
+#include "event_loop.h"
+#include "event_loop_thread.h"
+#include "inet_addr.h"
+#include "latency_histogram.h"
+#include "rpc_client.h"
+#include "rpc_server.h"
+
+namespace {
+const uint16_t EchoMethod = 1;
+
+int64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Options {
+  bool run_server = true;
+  bool run_client = true;
+  std::string ip = "127.0.0.1";
+  uint16_t port = 9000;
+  int clients = 16;
+  int threads = 4;
+  double seconds = 10.0;
+  size_t size = 64;
+  int depth = 16;
+};
+
+/**
+ * The clients of one loop, only touched in that loop's thread
+ */
+class Worker {
+ public:
+  Worker(EventLoop* loop, const Options& options, int clients,
+         CountDownLatch* connected)
+      : loop_(loop),
+        options_(options),
+        num_clients_(clients),
+        connected_latch_(connected),
+        payload_(options.size, 'x'),
+        start_ns_(0),
+        running_(false),
+        num_connected_(0),
+        calls_(0),
+        errors_(0) {}
+
+  void start() {
+    loop_->assertInLoopThread();
+    InetAddress server_addr(options_.ip, options_.port);
+    for (int i = 0; i < num_clients_; ++i) {
+      std::unique_ptr<Session> session(new Session);
+      session->worker = this;
+      session->client =
+          std::make_shared<RpcClient>(loop_, server_addr, "rpc_echo");
+      session->client->setConnectionCallback(
+          [this](const TcpConnectionPtr& conn) {
+            if (conn->connected() && ++num_connected_ == num_clients_) {
+              connected_latch_->countDown();
+            }
+          });
+      session->client->connect();
+      sessions_.push_back(std::move(session));
+    }
+  }
+
+  void beginMeasure(int64_t start_ns) {
+    loop_->assertInLoopThread();
+    start_ns_ = start_ns;
+    running_ = true;
+    const int64_t now = nowNanos();
+    for (auto& session : sessions_) {
+      for (int i = 0; i < options_.depth; ++i) {
+        sendCall(session.get(), now);
+      }
+    }
+  }
+
+  /* Pending calls fail as Unavailable, nothing is resent */
+  void stop() {
+    loop_->assertInLoopThread();
+    running_ = false;
+    for (auto& session : sessions_) {
+      session->client.reset();
+    }
+    sessions_.clear();
+  }
+
+  const LatencyHistogram& histogram() const { return histogram_; }
+
+  uint64_t calls() const { return calls_; }
+
+  uint64_t errors() const { return errors_; }
+
+ private:
+  struct Session {
+    Worker* worker;
+    std::shared_ptr<RpcClient> client;
+  };
+
+  void sendCall(Session* s, int64_t sent) {
+    s->client->call(EchoMethod, payload_,
+                    [s, sent](RpcStatus status, std::string_view) {
+                      s->worker->onResponse(s, sent, status);
+                    });
+  }
+
+  void onResponse(Session* s, int64_t sent, RpcStatus status) {
+    if (!running_) {
+      return;
+    }
+    const int64_t now = nowNanos();
+    if (status != RpcStatus::Ok) {
+      ++errors_;
+    } else if (sent >= start_ns_) {
+      histogram_.record(static_cast<uint64_t>(now - sent));
+      ++calls_;
+    }
+    if (s->client) {
+      sendCall(s, now);
+    }
+  }
+
+  EventLoop* loop_;
+  const Options options_;
+  const int num_clients_;
+  CountDownLatch* connected_latch_;
+  const std::string payload_;
+  int64_t start_ns_;
+  bool running_;
+  int num_connected_;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  LatencyHistogram histogram_;
+  uint64_t calls_;
+  uint64_t errors_;
+};
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-m both|server|client] [-a ip] [-p port] [-c clients] "
+          "[-t threads] [-d seconds] [-s size] [-q depth]\n",
+          prog);
+  exit(1);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:a:p:c:t:d:s:q:")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (strcmp(optarg, "both") == 0) {
+          options.run_server = options.run_client = true;
+        } else if (strcmp(optarg, "server") == 0) {
+          options.run_server = true;
+          options.run_client = false;
+        } else if (strcmp(optarg, "client") == 0) {
+          options.run_server = false;
+          options.run_client = true;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 'a':
+        options.ip = optarg;
+        break;
+      case 'p':
+        options.port = static_cast<uint16_t>(atoi(optarg));
+        break;
+      case 'c':
+        options.clients = atoi(optarg);
+        break;
+      case 't':
+        options.threads = atoi(optarg);
+        break;
+      case 'd':
+        options.seconds = atof(optarg);
+        break;
+      case 's':
+        options.size = static_cast<size_t>(atol(optarg));
+        break;
+      case 'q':
+        options.depth = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (options.threads < 1 || options.clients < options.threads ||
+      options.depth < 1) {
+    usage(argv[0]);
+  }
+
+  EventLoopThread server_thread;
+  std::unique_ptr<RpcServer> server;
+  EventLoop* server_loop = nullptr;
+  if (options.run_server) {
+    server_loop = server_thread.startLoop();
+    CountDownLatch started(1);
+    server_loop->runInLoop([&] {
+      server.reset(new RpcServer(server_loop, InetAddress(options.port)));
+      server->setThreadNum(options.threads);
+      server->registerMethod(EchoMethod,
+                             [](const RpcCall& call, std::string_view request) {
+                               call.reply(request);
+                             });
+      server->start();
+      started.countDown();
+    });
+    started.wait();
+  }
+  if (!options.run_client) {
+    /* Serve until killed */
+    for (;;) {
+      pause();
+    }
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::unique_ptr<EventLoopThread>> threads;
+  std::vector<EventLoop*> loops;
+  CountDownLatch connected(options.threads);
+  for (int i = 0; i < options.threads; ++i) {
+    threads.emplace_back(new EventLoopThread);
+    EventLoop* loop = threads.back()->startLoop();
+    loops.push_back(loop);
+    int clients = options.clients / options.threads +
+                  (i < options.clients % options.threads ? 1 : 0);
+    workers.emplace_back(new Worker(loop, options, clients, &connected));
+  }
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker] { worker->start(); });
+  }
+  connected.wait();
+
+  const int64_t start = nowNanos();
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker, start] { worker->beginMeasure(start); });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+
+  CountDownLatch stopped(options.threads);
+  for (int i = 0; i < options.threads; ++i) {
+    Worker* worker = workers[i].get();
+    loops[i]->runInLoop([worker, &stopped] {
+      worker->stop();
+      stopped.countDown();
+    });
+  }
+  stopped.wait();
+  const double elapsed = static_cast<double>(nowNanos() - start) / 1e9;
+
+  LatencyHistogram merged;
+  uint64_t calls = 0;
+  uint64_t errors = 0;
+  for (auto& worker : workers) {
+    merged.merge(worker->histogram());
+    calls += worker->calls();
+    errors += worker->errors();
+  }
+
+  printf("rpc echo: %d clients on %d threads, depth %d, %zu bytes, %.2fs\n",
+         options.clients, options.threads, options.depth, options.size,
+         elapsed);
+  printf("throughput %.0f calls/s, %llu errors\n", calls / elapsed,
+         static_cast<unsigned long long>(errors));
+  printf("latency us: min %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f "
+         "mean %.1f\n",
+         merged.min() / 1e3, merged.percentile(50) / 1e3,
+         merged.percentile(99) / 1e3, merged.percentile(99.9) / 1e3,
+         merged.max() / 1e3, merged.mean() / 1e3);
+  threads.clear();
+  if (server) {
+    CountDownLatch destroyed(1);
+    server_loop->runInLoop([&server, &destroyed] {
+      server.reset();
+      destroyed.countDown();
+    });
+    destroyed.wait();
+  }
+}
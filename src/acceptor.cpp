@@ -1,20 +1,84 @@
 #include "acceptor.h"
 
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include "event_loop.h"
 #include "inet_addr.h"
 #include "logging.h"
+#include "metrics.h"
 #include "sockets_options.h"
+#include "trace.h"
+
+namespace {
+Counter accept_counter("tcp_accepts_total", "Connections accepted");
+
+/**
+ * Unlink @path if it is a socket nobody listens on, i.e. left by a previous
+ * run. A regular file, or the socket of a live server, is left alone and
+ * bind(2) fails on it
+ */
+void removeStaleSocket(const std::string& path) {
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode)) {
+    return;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path) {
+    return;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe < 0) {
+    return;
+  }
+  int ret = ::connect(probe, reinterpret_cast<struct sockaddr*>(&addr),
+                      static_cast<socklen_t>(sizeof addr));
+  const int saved_errno = errno;
+  ::close(probe);
+  if (ret != 0 && saved_errno == ECONNREFUSED) {
+    ::unlink(path.c_str());
+  } else if (ret == 0) {
+    LOG << "Acceptor " << path << " is in use by another server";
+  }
+}
+}  // namespace
 
 Acceptor::Acceptor(EventLoop* loop, const InetAddress& listen_addr)
     : loop_(loop),
-      socket_(sockets::createNonblockingOrDie()),
+      socket_(sockets::createNonblockingOrDie(listen_addr.family())),
       channel_(loop, socket_.getFd()),
       listenning_(false) {
-  socket_.setReuseAddr(true);
+  if (listen_addr.isUnix()) {
+    /* A socket file left by a previous run would fail bind(2) */
+    const std::string path = listen_addr.toHostPort();
+    if (!path.empty() && path[0] != '@') {
+      removeStaleSocket(path);
+    }
+  } else {
+    socket_.setReuseAddr(true);
+  }
   socket_.bindAddress(listen_addr);
   channel_.setReadCallback(std::bind(&Acceptor::handleRead, this));
 }
 
+/**
+ * The server may go while its loop keeps running, the listen Channel must
+ * leave the Poller before socket_ closes its fd
+ */
+Acceptor::~Acceptor() {
+  if (listenning_) {
+    loop_->assertInLoopThread();
+    channel_.disableAllEvents();
+    loop_->removeChannel(&channel_);
+  }
+}
+
 /**
  * Make socket_ start listen and register fd on poll_fds_
  */
@@ -25,12 +89,28 @@ void Acceptor::listen() {
   channel_.enableReading();
 }
 
+void Acceptor::pause() {
+  loop_->assertInLoopThread();
+  if (channel_.isReading()) {
+    channel_.disableReading();
+  }
+}
+
+void Acceptor::resume() {
+  loop_->assertInLoopThread();
+  if (listenning_ && !channel_.isReading()) {
+    channel_.enableReading();
+  }
+}
+
 void Acceptor::handleRead() {
   loop_->assertInLoopThread();
   InetAddress peer_addr(0);
   // FIXME loop until no more
   int connfd = socket_.accept(&peer_addr);
   if (connfd >= 0) {
+    accept_counter.inc();
+    Tracer::instant("accept", "fd", connfd);
     if (new_conn_cb_) {
       new_conn_cb_(connfd, peer_addr);
     } else {
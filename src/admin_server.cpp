@@ -0,0 +1,48 @@
+#include "admin_server.h"
+
+#include "metrics.h"
+#include "trace.h"
+
+AdminServer::AdminServer(EventLoop* loop, const InetAddress& listen_addr)
+    : server_(loop, listen_addr) {
+  server_.setHttpCallback(std::bind(&AdminServer::onRequest, this,
+                                    std::placeholders::_1,
+                                    std::placeholders::_2));
+  handlers_["/metrics"] = [](const HttpRequest&, HttpResponse* response) {
+    response->setContentType("text/plain; version=0.0.4; charset=utf-8");
+    response->setBody(MetricsRegistry::instance().scrape());
+  };
+  handlers_["/trace"] = [](const HttpRequest& request,
+                           HttpResponse* response) {
+    std::string_view query = request.query();
+    if (query == "start" || query == "stop") {
+      if (query == "start") {
+        Tracer::enable();
+      } else {
+        Tracer::disable();
+      }
+      response->setContentType("text/plain");
+      response->setBody(Tracer::enabled() ? std::string_view("tracing\n")
+                                          : std::string_view("stopped\n"));
+    } else {
+      response->setContentType("application/json");
+      response->setBody(Tracer::dump());
+    }
+  };
+}
+
+void AdminServer::onRequest(const HttpRequest& request,
+                            HttpResponse* response) {
+  if (request.method() != HttpRequest::Method::Get &&
+      request.method() != HttpRequest::Method::Head) {
+    response->setStatusCode(HttpResponse::StatusCode::MethodNotAllowed);
+    response->addHeader("Allow", "GET, HEAD");
+    return;
+  }
+  auto it = handlers_.find(request.path());
+  if (it == handlers_.end()) {
+    response->setStatusCode(HttpResponse::StatusCode::NotFound);
+    return;
+  }
+  it->second(request, response);
+}
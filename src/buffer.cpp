@@ -2,14 +2,69 @@
 
 #include <errno.h>
 #include <memory.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 
 #include "logging.h"
+#include "metrics.h"
 #include "sockets_options.h"
 
+namespace {
+/* A read past writableBytes() costs a copy out of the stack buffer */
+Counter spill_counter("buffer_read_spills_total",
+                      "Reads into Buffer that spilled to the stack buffer");
+Counter spill_bytes_counter("buffer_read_spill_bytes_total",
+                            "Bytes copied from the stack buffer into Buffer");
+
+/**
+ * recvmsg(2) into @vec, file descriptors passed along are appended to @fds
+ */
+ssize_t recvWithFds(int fd, struct iovec* vec, int iovcnt,
+                    std::vector<int>* fds) {
+  /* Aligned for struct cmsghdr */
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * sockets::MaxFdsPerMessage)];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = vec;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  const ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0) {
+    return n;
+  }
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const size_t old_size = fds->size();
+      fds->resize(old_size + count);
+      memcpy(fds->data() + old_size, CMSG_DATA(cmsg), count * sizeof(int));
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    /* The kernel closed the fds that didn't fit */
+    LOG << "Buffer::readFd more than " << sockets::MaxFdsPerMessage
+        << " fds in one message, some dropped";
+  }
+  return n;
+}
+}  // namespace
+
 ssize_t Buffer::readFd(int fd, int* saved_errno) {
+  return readInto(fd, saved_errno, nullptr);
+}
+
+ssize_t Buffer::readFd(int fd, int* saved_errno, std::vector<int>* fds) {
+  return readInto(fd, saved_errno, fds);
+}
+
+ssize_t Buffer::readInto(int fd, int* saved_errno, std::vector<int>* fds) {
   /* Buffer on the stack */
-  char extrabuf[65536];
+  char extrabuf[ExtraBufferSize];
   struct iovec vec[2];
   const size_t writable = writableBytes();
   vec[0].iov_base = begin() + writer_idx_;
@@ -20,7 +75,7 @@ ssize_t Buffer::readFd(int fd, int* saved_errno) {
    * Level trigger, only need to read once
    * Note: If use Edge Trigger, need to read until EAGAIN
    */
-  const ssize_t n = readv(fd, vec, 2);
+  const ssize_t n = fds ? recvWithFds(fd, vec, 2, fds) : readv(fd, vec, 2);
   if (n < 0) {
     *saved_errno = errno;
   } else if (static_cast<size_t>(n) <= writable) {
@@ -30,7 +85,8 @@ ssize_t Buffer::readFd(int fd, int* saved_errno) {
     /* extrbuf needed */
     writer_idx_ = buffer_.size();
     append(extrabuf, n - writable);
+    spill_counter.inc();
+    spill_bytes_counter.inc(n - writable);
   }
   return n;
 }
-
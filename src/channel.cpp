@@ -6,6 +6,7 @@
 #include "logging.h"
 #include "poll.h"
 #include "timestamp.h"
+#include "trace.h"
 
 const int Channel::NoneEvent = 0;
 const int Channel::ReadEvent = POLLIN | POLLPRI;
@@ -17,14 +18,21 @@ Channel::Channel(EventLoop* loop, int fd)
       events_(0),
       revents_(0),
       index_(-1),
-      events_handling_(false) {}
-
-Channel::~Channel() { assert(!events_handling_); }
+      owner_loop_(loop),
+      events_handling_(false),
+      update_pending_(false) {}
+
+Channel::~Channel() {
+  assert(!events_handling_);
+  /* Or EventLoop would apply it to a dangling pointer */
+  assert(!update_pending_);
+}
 
 void Channel::update() { loop_->updateChannel(this); }
 
 // Use nonblocking I/O
 void Channel::handleEvents(Timestamp recv_time) {
+  TraceScope scope("handleEvents", "fd", fd_);
   events_handling_ = true;
   if (revents_ & POLLNVAL) {
     LOG << "Channel::handle_events() POLLNVAL";
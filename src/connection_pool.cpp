@@ -0,0 +1,95 @@
+#include "connection_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "event_loop.h"
+
+namespace {
+size_t roundUp(size_t size) {
+  const size_t align = alignof(std::max_align_t);
+  return (size + align - 1) / align * align;
+}
+}  // namespace
+
+ConnectionPool::ConnectionPool(EventLoop* loop)
+    : loop_(loop), block_size_(0), free_list_(nullptr), remote_frees_(nullptr) {}
+
+/* Blocks still in use keep a reference on the pool, so all are free here */
+ConnectionPool::~ConnectionPool() = default;
+
+void* ConnectionPool::allocate(size_t size) {
+  loop_->assertInLoopThread();
+  size = roundUp(size);
+  if (block_size_ == 0) {
+    block_size_ = std::max(size, sizeof(FreeBlock));
+  }
+  if (size != block_size_) {
+    return ::operator new(size);
+  }
+
+  if (free_list_ == nullptr) {
+    drainRemoteFrees();
+  }
+  if (free_list_ == nullptr) {
+    /* Carve a new chunk into blocks */
+    chunks_.emplace_back(new char[block_size_ * BlocksPerChunk]);
+    char* chunk = chunks_.back().get();
+    for (size_t i = 0; i < BlocksPerChunk; ++i) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * block_size_);
+      block->next = free_list_;
+      free_list_ = block;
+    }
+  }
+
+  FreeBlock* block = free_list_;
+  free_list_ = block->next;
+  return block;
+}
+
+void ConnectionPool::deallocate(void* p, size_t size) {
+  size = roundUp(size);
+  if (size != block_size_) {
+    ::operator delete(p);
+    return;
+  }
+
+  FreeBlock* block = static_cast<FreeBlock*>(p);
+  if (loop_->isInLoopThread()) {
+    block->next = free_list_;
+    free_list_ = block;
+  } else {
+    block->next = remote_frees_.load(std::memory_order_relaxed);
+    while (!remote_frees_.compare_exchange_weak(block->next, block,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+    }
+  }
+}
+
+void ConnectionPool::drainRemoteFrees() {
+  FreeBlock* block = remote_frees_.exchange(nullptr, std::memory_order_acquire);
+  while (block != nullptr) {
+    FreeBlock* next = block->next;
+    block->next = free_list_;
+    free_list_ = block;
+    block = next;
+  }
+}
+
+std::vector<char> ConnectionPool::takeStorage() {
+  loop_->assertInLoopThread();
+  std::vector<char> storage;
+  if (!storages_.empty()) {
+    storage.swap(storages_.back());
+    storages_.pop_back();
+  }
+  return storage;
+}
+
+void ConnectionPool::recycleStorage(std::vector<char>&& storage) {
+  if (loop_->isInLoopThread() && storages_.size() < MaxCachedStorages &&
+      !storage.empty() && storage.size() <= MaxStorageSize) {
+    storages_.push_back(std::move(storage));
+  }
+}
@@ -0,0 +1,96 @@
+#include "connection_registry.h"
+
+#include <utility>
+
+ConnectionRegistry::ConnectionRegistry(size_t initial_capacity)
+    : mask_(0), shift_(64), size_(0) {
+  size_t capacity = 8;
+  while (capacity < initial_capacity) {
+    capacity <<= 1;
+  }
+  rehash(capacity);
+}
+
+void ConnectionRegistry::insert(uint64_t id, const TcpConnectionPtr& conn) {
+  assert(id != 0);
+  assert(indexOf(id) == slots_.size());
+  /* Keep load factor <= 1/2 so probe sequences stay short */
+  if ((size_ + 1) * 2 > slots_.size()) {
+    rehash(slots_.size() * 2);
+  }
+  size_t i = homeOf(id);
+  while (slots_[i].id != 0) {
+    i = (i + 1) & mask_;
+  }
+  slots_[i].id = id;
+  slots_[i].conn = conn;
+  ++size_;
+}
+
+bool ConnectionRegistry::erase(uint64_t id) {
+  size_t hole = indexOf(id);
+  if (hole == slots_.size()) {
+    return false;
+  }
+  slots_[hole].id = 0;
+  slots_[hole].conn.reset();
+  --size_;
+
+  /**
+   * Backward shift: move following entries of the cluster into the hole
+   * unless their home lies cyclically in (hole, i]
+   */
+  size_t i = (hole + 1) & mask_;
+  while (slots_[i].id != 0) {
+    size_t home = homeOf(slots_[i].id);
+    bool movable = (i > hole) ? (home <= hole || home > i)
+                              : (home <= hole && home > i);
+    if (movable) {
+      slots_[hole] = std::move(slots_[i]);
+      slots_[i].id = 0;
+      hole = i;
+    }
+    i = (i + 1) & mask_;
+  }
+  return true;
+}
+
+TcpConnectionPtr ConnectionRegistry::find(uint64_t id) const {
+  size_t i = indexOf(id);
+  return i == slots_.size() ? TcpConnectionPtr() : slots_[i].conn;
+}
+
+size_t ConnectionRegistry::indexOf(uint64_t id) const {
+  if (id == 0) {
+    return slots_.size();
+  }
+  size_t i = homeOf(id);
+  while (slots_[i].id != 0) {
+    if (slots_[i].id == id) {
+      return i;
+    }
+    i = (i + 1) & mask_;
+  }
+  return slots_.size();
+}
+
+void ConnectionRegistry::rehash(size_t capacity) {
+  std::vector<Slot> old;
+  old.swap(slots_);
+  slots_.resize(capacity);
+  mask_ = capacity - 1;
+  shift_ = 64;
+  while (capacity > 1) {
+    capacity >>= 1;
+    --shift_;
+  }
+  for (Slot& slot : old) {
+    if (slot.id != 0) {
+      size_t i = homeOf(slot.id);
+      while (slots_[i].id != 0) {
+        i = (i + 1) & mask_;
+      }
+      slots_[i] = std::move(slot);
+    }
+  }
+}
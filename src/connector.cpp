@@ -0,0 +1,173 @@
+#include "connector.h"
+
+#include <errno.h>
+
+#include <algorithm>
+
+#include "event_loop.h"
+#include "logging.h"
+#include "sockets_options.h"
+
+constexpr double Connector::InitRetryDelay;
+constexpr double Connector::MaxRetryDelay;
+
+Connector::Connector(EventLoop* loop, const InetAddress& server_addr)
+    : loop_(loop),
+      server_addr_(server_addr),
+      connect_(false),
+      state_(States::Disconnected),
+      init_retry_delay_(InitRetryDelay),
+      max_retry_delay_(MaxRetryDelay),
+      retry_delay_(InitRetryDelay) {}
+
+Connector::~Connector() { assert(!channel_); }
+
+void Connector::start() {
+  connect_ = true;
+  loop_->runInLoop(std::bind(&Connector::startInLoop, shared_from_this()));
+}
+
+void Connector::startInLoop() {
+  loop_->assertInLoopThread();
+  if (state_ != States::Disconnected) {
+    return;
+  }
+  if (connect_) {
+    connect();
+  } else {
+    LOG << "Connector::startInLoop do not connect";
+  }
+}
+
+void Connector::restart() {
+  loop_->assertInLoopThread();
+  setState(States::Disconnected);
+  retry_delay_ = init_retry_delay_;
+  connect_ = true;
+  startInLoop();
+}
+
+void Connector::stop() {
+  connect_ = false;
+  loop_->queueInLoop(std::bind(&Connector::stopInLoop, shared_from_this()));
+}
+
+void Connector::stopInLoop() {
+  loop_->assertInLoopThread();
+  if (state_ == States::Connecting) {
+    setState(States::Disconnected);
+    sockets::close(removeAndResetChannel());
+  }
+}
+
+void Connector::connect() {
+  int sockfd = sockets::createNonblockingOrDie(server_addr_.family());
+  int ret = sockets::connect(sockfd, server_addr_.getSockAddr(),
+                             server_addr_.getSockLen());
+  int saved_errno = (ret == 0) ? 0 : errno;
+  switch (saved_errno) {
+    case 0:
+    case EINPROGRESS:
+    case EINTR:
+    case EISCONN:
+      connecting(sockfd);
+      break;
+
+    /* Transient, the server or the local port range may recover */
+    case EAGAIN:
+    case EADDRINUSE:
+    case EADDRNOTAVAIL:
+    case ECONNREFUSED:
+    case ENETUNREACH:
+    case ETIMEDOUT:
+      retry(sockfd);
+      break;
+
+    default:
+      LOG << "Error: Connector::connect to " << server_addr_.toHostPort()
+          << " errno = " << saved_errno;
+      sockets::close(sockfd);
+      break;
+  }
+}
+
+void Connector::connecting(int sockfd) {
+  setState(States::Connecting);
+  assert(!channel_);
+  channel_.reset(new Channel(loop_, sockfd));
+  channel_->setWriteCallback(std::bind(&Connector::handleWrite, this));
+  channel_->setErrorCallback(std::bind(&Connector::handleError, this));
+  channel_->enableWriting();
+}
+
+/**
+ * The channel is only used to wait for connect(2), it can't be destroyed in
+ * its own handleEvents(), so the reset is deferred
+ */
+int Connector::removeAndResetChannel() {
+  channel_->disableAllEvents();
+  loop_->removeChannel(channel_.get());
+  int sockfd = channel_->getFd();
+  loop_->queueInLoop(std::bind(&Connector::resetChannel, shared_from_this()));
+  return sockfd;
+}
+
+void Connector::resetChannel() { channel_.reset(); }
+
+/**
+ * WriteCallback of channel_, connect(2) finished, successfully or not
+ */
+void Connector::handleWrite() {
+  if (state_ != States::Connecting) {
+    return;
+  }
+  int sockfd = removeAndResetChannel();
+  int err = sockets::getSocketError(sockfd);
+  if (err) {
+    LOG << "Connector::handleWrite SO_ERROR = " << err;
+    retry(sockfd);
+  } else if (sockets::isSelfConnect(sockfd)) {
+    LOG << "Connector::handleWrite self connect";
+    retry(sockfd);
+  } else {
+    setState(States::Connected);
+    if (connect_ && new_conn_cb_) {
+      new_conn_cb_(sockfd);
+    } else {
+      sockets::close(sockfd);
+    }
+  }
+}
+
+void Connector::handleError() {
+  LOG << "Connector::handleError";
+  if (state_ == States::Connecting) {
+    int sockfd = removeAndResetChannel();
+    LOG << "Connector::handleError SO_ERROR = "
+        << sockets::getSocketError(sockfd);
+    retry(sockfd);
+  }
+}
+
+/**
+ * The retry timer only holds a weak_ptr and checks connect_, so neither a
+ * stop() nor the destruction of the owner has to cancel it
+ */
+void Connector::retry(int sockfd) {
+  sockets::close(sockfd);
+  setState(States::Disconnected);
+  if (!connect_) {
+    LOG << "Connector::retry do not connect";
+    return;
+  }
+  LOG << "Connector::retry connecting to " << server_addr_.toHostPort()
+      << " in " << retry_delay_ << " seconds";
+  std::weak_ptr<Connector> weak_self(shared_from_this());
+  loop_->runAfter(retry_delay_, [weak_self] {
+    ConnectorPtr self = weak_self.lock();
+    if (self) {
+      self->startInLoop();
+    }
+  });
+  retry_delay_ = std::min(retry_delay_ * 2, max_retry_delay_);
+}
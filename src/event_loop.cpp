@@ -1,16 +1,31 @@
 #include "event_loop.h"
 
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <mutex>
 
 #include "logging.h"
+#include "metrics.h"
 #include "poller.h"
+#include "trace.h"
 
 /* Used to check if current thread only has one EventLoop */
 thread_local EventLoop* event_loop_in_this_thread = nullptr;
 const int kPollTimeMs = 10000;
 
+namespace {
+Gauge pending_functors_gauge("event_loop_pending_functors",
+                             "Functors queued in a loop and not run yet");
+/* 10us to about 0.65s */
+Histogram iteration_histogram(
+    "event_loop_iteration_seconds",
+    "Busy time of a loop iteration, from poll return to its end",
+    Histogram::exponentialBuckets(1e-5, 4, 9));
+}  // namespace
+
 class SignalMask {
  public:
   SignalMask() { signal(SIGPIPE, SIG_IGN); }
@@ -18,8 +33,29 @@ class SignalMask {
 
 SignalMask init_obj;
 
+int createEventfd() {
+  int evtfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (evtfd < 0) {
+    LOG << "Failed in eventfd";
+    abort();
+  }
+  return evtfd;
+}
+
 EventLoop::EventLoop()
-    : looping_(false), quit_(true), thread_id_(CurrentThread::tid()) {
+    : looping_(false),
+      quit_(true),
+      calling_pending_functors_(false),
+      thread_id_(CurrentThread::tid()),
+      wakeup_fd_(createEventfd()),
+      pending_since_us_(0),
+      busy_us_(0),
+      queue_age_us_(0),
+      iteration_start_us_(0),
+      dropped_functors_(0),
+      callback_type_(nullptr),
+      callback_conn_(nullptr),
+      iteration_(0) {
   LOG << "EventLoop created" << this << " in thread" << thread_id_;
 
   if (event_loop_in_this_thread) {
@@ -28,6 +64,19 @@ EventLoop::EventLoop()
   } else {
     event_loop_in_this_thread = this;
   }
+  /* Channels register through updated_channels_, constructed by now */
+  poller_.reset(new Poller(this));
+  timer_queue_.reset(new TimerQueue(this));
+  wakeup_channel_.reset(new Channel(this, wakeup_fd_));
+  wakeup_channel_->setReadCallback(std::bind(&EventLoop::handleRead, this));
+  wakeup_channel_->enableReading();
+}
+
+void EventLoop::abortNotInLoopThread() {
+  LOG << "EventLoop::abortNotInLoopThread - EventLoop " << this
+      << " was created in thread " << thread_id_ << ", current thread is "
+      << CurrentThread::tid();
+  abort();
 }
 
 EventLoop* EventLoop::getEventLoopOfCurrentThread() {
@@ -42,13 +91,38 @@ void EventLoop::loop() {
 
   while (!quit_) {
     active_channels_.clear();
-    poll_return_time_ = poller_->poll(kPollTimeMs, &active_channels_);
+    applyChannelUpdates();
+    Tracer::begin("poll");
+    /* Deferred work is ready now, only check for new events */
+    poll_return_time_ = poller_->poll(
+        deferred_functors_.empty() ? kPollTimeMs : 0, &active_channels_);
+    Tracer::end("poll", "ready", active_channels_.size());
+    ++iteration_;
+    const int64_t start_us = poll_return_time_.microSecondsSinceEpoch();
+    iteration_start_us_.store(start_us, std::memory_order_relaxed);
+    /* What is deferred from now on waits for the next iteration */
+    ready_functors_.swap(deferred_functors_);
+    setCallback("Channel", nullptr);
     for (auto it = active_channels_.begin(); it != active_channels_.end();
          ++it) {
       (*it)->handleEvents(poll_return_time_);
     }
+    setCallback("DeferredFunctor", nullptr);
+    for (size_t i = 0; i < ready_functors_.size(); ++i) {
+      ready_functors_[i]();
+    }
+    ready_functors_.clear();
 
+    setCallback("Functor", nullptr);
     doPendingFunctors();
+    setCallback("AfterIterationFunctor", nullptr);
+    doAfterIterationFunctors();
+    setCallback(nullptr, nullptr);
+    const int64_t end_us = Timestamp::now().microSecondsSinceEpoch();
+    iteration_start_us_.store(0, std::memory_order_relaxed);
+    updateAverage(&busy_us_, end_us - start_us);
+    iteration_histogram.observe(static_cast<double>(end_us - start_us) /
+                                Timestamp::microSecondsPerSecond);
   }
 
   LOG << "EventLoop " << this << " stops looping";
@@ -58,15 +132,36 @@ void EventLoop::loop() {
 void EventLoop::updateChannel(Channel* channel) {
   assert(channel->getOwnerLoop() == this);
   assertInLoopThread();
-  poller_->updateChannel(channel);
+  if (!channel->updatePending()) {
+    channel->setUpdatePending(true);
+    updated_channels_.push_back(channel);
+  }
 }
 
 void EventLoop::removeChannel(Channel* channel) {
   assert(channel->getOwnerLoop() == this);
   assertInLoopThread();
+  if (channel->updatePending()) {
+    /* Few channels change per iteration, the search is short */
+    auto it = std::find(updated_channels_.begin(), updated_channels_.end(),
+                        channel);
+    assert(it != updated_channels_.end());
+    updated_channels_.erase(it);
+    channel->setUpdatePending(false);
+    poller_->updateChannel(channel);
+  }
   poller_->removeChannel(channel);
 }
 
+void EventLoop::applyChannelUpdates() {
+  for (size_t i = 0; i < updated_channels_.size(); ++i) {
+    Channel* channel = updated_channels_[i];
+    channel->setUpdatePending(false);
+    poller_->updateChannel(channel);
+  }
+  updated_channels_.clear();
+}
+
 /* Wake up I/O threads by writing 8 bytes on wakeup_fd_ */
 void EventLoop::wakeup() {
   uint64_t one = 1;
@@ -93,13 +188,26 @@ void EventLoop::runInLoop(const Functor& cb) {
 }
 
 void EventLoop::queueInLoop(const Functor& cb) {
+  if (Tracer::enabled() && !isInLoopThread()) {
+    pushFunctor(tracedFunctor(cb));
+  } else {
+    pushFunctor(cb);
+  }
+}
+
+void EventLoop::pushFunctor(const Functor& cb) {
   std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_functors_.empty()) {
+    pending_since_us_ = Timestamp::now().microSecondsSinceEpoch();
+  }
   pending_functors_.push_back(cb);
+  pending_functors_gauge.inc();
 
   /**
    * Wake up I/O threads in the following scenarios
    * 1. Current thread is not I/O thread
-   * 2. Current thead is I/O thread and is executing doPendingFunctors().
+   * 2. Current thead is I/O thread and is executing doPendingFunctors(), or
+   * doAfterIterationFunctors() which runs after it.
    * Note: if current thread is already invoked doPendingFunctors(), also need
    * to wakeup() cos queueInLoop may be called in functors of pending_functors_.
    * Only when queueInLoop is called in handleEvents() wakeup() need not be
@@ -111,12 +219,49 @@ void EventLoop::queueInLoop(const Functor& cb) {
   }
 }
 
+/**
+ * A flow arrow from the posting thread to where @cb runs, so work handed
+ * across threads can be followed in a trace
+ */
+EventLoop::Functor EventLoop::tracedFunctor(const Functor& cb) {
+  const uint64_t flow_id = Tracer::newFlowId();
+  {
+    TraceScope scope("queueInLoop");
+    Tracer::flowStart("functor", flow_id);
+  }
+  return [cb, flow_id] {
+    TraceScope scope("functor");
+    Tracer::flowEnd("functor", flow_id);
+    cb();
+  };
+}
+
+void EventLoop::queueInLoop(const Functor& cb, Timestamp deadline) {
+  queueInLoop([this, cb, deadline] {
+    if (Timestamp::now() < deadline) {
+      cb();
+    } else {
+      dropped_functors_.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+}
+
 void EventLoop::doPendingFunctors() {
   std::vector<Functor> functors;
+  int64_t since_us = 0;
   calling_pending_functors_ = true;
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  functors.swap(pending_functors_);
+  /* Don't hold the lock while calling, functors may call queueInLoop() */
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    functors.swap(pending_functors_);
+    since_us = pending_since_us_;
+  }
+  if (!functors.empty()) {
+    pending_functors_gauge.add(-static_cast<int64_t>(functors.size()));
+    updateAverage(&queue_age_us_,
+                  Timestamp::now().microSecondsSinceEpoch() - since_us);
+  }
 
   for (size_t i = 0; i < functors.size(); ++i) {
     functors[i]();
@@ -124,6 +269,50 @@ void EventLoop::doPendingFunctors() {
   calling_pending_functors_ = false;
 }
 
+int64_t EventLoop::lagMicros() const {
+  const int64_t start_us = iteration_start_us_.load(std::memory_order_relaxed);
+  if (start_us == 0) {
+    return 0;
+  }
+  const int64_t running_us = Timestamp::now().microSecondsSinceEpoch() -
+                             start_us;
+  return std::max({busy_us_.load(std::memory_order_relaxed),
+                   queue_age_us_.load(std::memory_order_relaxed),
+                   running_us});
+}
+
+void EventLoop::updateAverage(std::atomic<int64_t>* average, int64_t sample) {
+  const int64_t old = average->load(std::memory_order_relaxed);
+  average->store(old + (sample - old) / 8, std::memory_order_relaxed);
+}
+
+void EventLoop::runAfterIteration(const Functor& cb) {
+  assertInLoopThread();
+  after_iteration_functors_.push_back(cb);
+}
+
+void EventLoop::deferToNextIteration(const Functor& cb) {
+  assertInLoopThread();
+  deferred_functors_.push_back(cb);
+}
+
+void EventLoop::doAfterIterationFunctors() {
+  /**
+   * doPendingFunctors() has run, what they queueInLoop(), e.g. a
+   * WriteCompleteCallback after a flush, must wake the next poll
+   */
+  calling_pending_functors_ = true;
+  /* Functors may schedule more functors for this iteration */
+  while (!after_iteration_functors_.empty()) {
+    std::vector<Functor> functors;
+    functors.swap(after_iteration_functors_);
+    for (size_t i = 0; i < functors.size(); ++i) {
+      functors[i]();
+    }
+  }
+  calling_pending_functors_ = false;
+}
+
 void EventLoop::quit() {
   quit_ = true;
   // If current thread is not I/O thread, wake up the I/O thread to handle tasks
@@ -135,5 +324,10 @@ void EventLoop::quit() {
 
 EventLoop::~EventLoop() {
   assert(!looping_);
+  wakeup_channel_->disableAllEvents();
+  removeChannel(wakeup_channel_.get());
+  ::close(wakeup_fd_);
+  /* Its channel unregisters through updated_channels_, still alive here */
+  timer_queue_.reset();
   event_loop_in_this_thread = nullptr;
 }
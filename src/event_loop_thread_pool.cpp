@@ -40,3 +40,12 @@ EventLoop* EventLoopThreadPool::getNextLoop() {
   }
   return loop;
 }
+
+std::vector<EventLoop*> EventLoopThreadPool::getAllLoops() {
+  base_loop_->assertInLoopThread();
+  assert(started_);
+  if (loops_.empty()) {
+    return std::vector<EventLoop*>(1, base_loop_);
+  }
+  return loops_;
+}
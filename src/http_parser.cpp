@@ -0,0 +1,323 @@
+#include "http_parser.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "buffer.h"
+
+namespace {
+const char kCRLF[] = "\r\n";
+const char kHeadEnd[] = "\r\n\r\n";
+
+const char* find(const char* begin, const char* end, const char* pattern,
+                 size_t len) {
+  const char* found = std::search(begin, end, pattern, pattern + len);
+  return found == end ? nullptr : found;
+}
+
+bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+std::string_view trim(const char* begin, const char* end) {
+  while (begin < end && isSpace(*begin)) ++begin;
+  while (end > begin && isSpace(end[-1])) --end;
+  return std::string_view(begin, end - begin);
+}
+
+/* Decimal digits only, false on overflow */
+bool parseLength(std::string_view value, size_t* length) {
+  if (value.empty()) {
+    return false;
+  }
+  size_t n = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9' || n > (SIZE_MAX - 9) / 10) {
+      return false;
+    }
+    n = n * 10 + (c - '0');
+  }
+  *length = n;
+  return true;
+}
+}  // namespace
+
+HttpParser::HttpParser(size_t max_header_size, size_t max_body_size)
+    : max_header_size_(max_header_size),
+      max_body_size_(max_body_size),
+      state_(State::Head),
+      error_status_(HttpResponse::StatusCode::Unknown),
+      scanned_(0),
+      head_len_(0),
+      content_length_(0),
+      chunked_(false),
+      chunk_pos_(0),
+      request_len_(0) {}
+
+HttpParser::Result HttpParser::parse(Buffer* buf, Timestamp receive_time) {
+  if (state_ == State::Head) {
+    /* Empty lines before a request line are ignored, RFC 9112 section 2.2 */
+    while (scanned_ == 0 && buf->readableBytes() >= 2 &&
+           memcmp(buf->peek(), kCRLF, 2) == 0) {
+      buf->retrieve(2);
+    }
+    if (scanned_ == 0 && buf->readableBytes() == 1 && *buf->peek() == '\r') {
+      return Result::Incomplete;
+    }
+    request_.receive_time_ = receive_time;
+  }
+
+  const char* base = buf->peek();
+  const size_t readable = buf->readableBytes();
+  switch (state_) {
+    case State::Head: {
+      Result result = parseHead(base, readable);
+      if (result != Result::Complete) {
+        return result;
+      }
+      if (state_ == State::Complete) {
+        return complete(base);
+      }
+      return parse(buf, receive_time);
+    }
+    case State::Body:
+      if (readable < request_len_) {
+        return Result::Incomplete;
+      }
+      return complete(base);
+    case State::Chunks:
+      return parseChunks(base, readable);
+    case State::Complete:
+      return Result::Complete;
+    case State::Error:
+      return Result::Error;
+  }
+  return Result::Error;
+}
+
+/**
+ * @return Complete once the head is parsed, state_ then tells whether a body
+ * follows
+ */
+HttpParser::Result HttpParser::parseHead(const char* base, size_t readable) {
+  /* The terminator may straddle the previous search boundary */
+  size_t from = scanned_ >= 3 ? scanned_ - 3 : 0;
+  const char* end = find(base + from, base + readable, kHeadEnd, 4);
+  if (end == nullptr) {
+    scanned_ = readable;
+    if (readable > max_header_size_) {
+      return fail(HttpResponse::StatusCode::HeaderFieldsTooLarge);
+    }
+    return Result::Incomplete;
+  }
+  head_len_ = end + 4 - base;
+  if (head_len_ > max_header_size_) {
+    return fail(HttpResponse::StatusCode::HeaderFieldsTooLarge);
+  }
+  Result result = parseHeaderFields(base);
+  if (result != Result::Complete) {
+    return result;
+  }
+
+  if (chunked_) {
+    state_ = State::Chunks;
+    chunk_pos_ = head_len_;
+  } else if (content_length_ > max_body_size_) {
+    return fail(HttpResponse::StatusCode::PayloadTooLarge);
+  } else {
+    request_len_ = head_len_ + content_length_;
+    state_ = content_length_ > 0 ? State::Body : State::Complete;
+  }
+  return Result::Complete;
+}
+
+HttpParser::Result HttpParser::parseHeaderFields(const char* base) {
+  const char* const head_end = base + head_len_;
+
+  /* Request line: method SP request-target SP HTTP-version CRLF */
+  const char* line_end = find(base, head_end, kCRLF, 2);
+  const char* sp1 = std::find(base, line_end, ' ');
+  const char* sp2 = sp1 == line_end ? line_end : std::find(sp1 + 1, line_end, ' ');
+  if (sp1 == base || sp2 == line_end || sp2 == sp1 + 1) {
+    return fail(HttpResponse::StatusCode::BadRequest);
+  }
+  std::string_view method(base, sp1 - base);
+  std::string_view version(sp2 + 1, line_end - sp2 - 1);
+  if (version == "HTTP/1.1") {
+    request_.version_ = HttpRequest::Version::Http11;
+  } else if (version == "HTTP/1.0") {
+    request_.version_ = HttpRequest::Version::Http10;
+  } else if (version.size() == 8 && version.substr(0, 5) == "HTTP/") {
+    return fail(HttpResponse::StatusCode::VersionNotSupported);
+  } else {
+    return fail(HttpResponse::StatusCode::BadRequest);
+  }
+  request_.method_ = HttpRequest::parseMethod(method);
+  if (request_.method_ == HttpRequest::Method::Invalid) {
+    return fail(HttpResponse::StatusCode::NotImplemented);
+  }
+  method_ = Span{0, method.size()};
+  const char* target = sp1 + 1;
+  const char* question = std::find(target, sp2, '?');
+  path_ = Span{static_cast<size_t>(target - base),
+               static_cast<size_t>(question - target)};
+  query_ = question == sp2
+               ? Span()
+               : Span{static_cast<size_t>(question + 1 - base),
+                      static_cast<size_t>(sp2 - question - 1)};
+
+  /* Header fields: field-name ":" OWS field-value OWS CRLF */
+  bool has_length = false;
+  bool close = false;
+  bool keep_alive = false;
+  content_length_ = 0;
+  chunked_ = false;
+  for (const char* line = line_end + 2; line < head_end - 2;
+       line = line_end + 2) {
+    line_end = find(line, head_end, kCRLF, 2);
+    const char* colon = std::find(line, line_end, ':');
+    /* Obsolete line folding and whitespace before the colon are rejected */
+    if (colon == line_end || colon == line || isSpace(*line) ||
+        isSpace(colon[-1])) {
+      return fail(HttpResponse::StatusCode::BadRequest);
+    }
+    std::string_view name(line, colon - line);
+    std::string_view value = trim(colon + 1, line_end);
+    header_spans_.emplace_back(
+        Span{static_cast<size_t>(line - base), name.size()},
+        Span{static_cast<size_t>(value.data() - base), value.size()});
+
+    if (HttpRequest::equalsIgnoreCase(name, "Content-Length")) {
+      size_t length = 0;
+      if (!parseLength(value, &length) ||
+          (has_length && length != content_length_)) {
+        return fail(HttpResponse::StatusCode::BadRequest);
+      }
+      has_length = true;
+      content_length_ = length;
+    } else if (HttpRequest::equalsIgnoreCase(name, "Transfer-Encoding")) {
+      if (!HttpRequest::equalsIgnoreCase(value, "chunked")) {
+        return fail(HttpResponse::StatusCode::NotImplemented);
+      }
+      chunked_ = true;
+    } else if (HttpRequest::equalsIgnoreCase(name, "Connection")) {
+      close = close || HttpRequest::hasToken(value, "close");
+      keep_alive = keep_alive || HttpRequest::hasToken(value, "keep-alive");
+    }
+  }
+
+  /* Both framings at once is how requests are smuggled, RFC 9112 6.1 */
+  if (chunked_ && has_length) {
+    return fail(HttpResponse::StatusCode::BadRequest);
+  }
+  if (request_.version_ == HttpRequest::Version::Http11) {
+    request_.keep_alive_ = !close;
+  } else {
+    request_.keep_alive_ = keep_alive && !close;
+  }
+  return Result::Complete;
+}
+
+/**
+ * chunk = chunk-size [ chunk-ext ] CRLF chunk-data CRLF, the last chunk has
+ * size 0 and is followed by optional trailer fields and CRLF. Trailers are
+ * skipped. Only whole chunks are decoded, chunk_pos_ is where to resume
+ */
+HttpParser::Result HttpParser::parseChunks(const char* base, size_t readable) {
+  const char* const end = base + readable;
+  while (true) {
+    const char* line = base + chunk_pos_;
+    const char* crlf = find(line, end, kCRLF, 2);
+    if (crlf == nullptr) {
+      if (static_cast<size_t>(end - line) > MaxChunkLineSize) {
+        return fail(HttpResponse::StatusCode::BadRequest);
+      }
+      return Result::Incomplete;
+    }
+
+    size_t size = 0;
+    const char* p = line;
+    for (; p < crlf && *p != ';' && !isSpace(*p); ++p) {
+      int digit;
+      if (*p >= '0' && *p <= '9') {
+        digit = *p - '0';
+      } else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') {
+        digit = (*p | 0x20) - 'a' + 10;
+      } else {
+        return fail(HttpResponse::StatusCode::BadRequest);
+      }
+      if (size > (SIZE_MAX >> 4)) {
+        return fail(HttpResponse::StatusCode::PayloadTooLarge);
+      }
+      size = (size << 4) | digit;
+    }
+    if (p == line) {
+      return fail(HttpResponse::StatusCode::BadRequest);
+    }
+
+    const char* data = crlf + 2;
+    if (size == 0) {
+      /* Last chunk, then trailer fields until an empty line */
+      const char* trailer_end = find(crlf, end, kHeadEnd, 4);
+      if (trailer_end == nullptr) {
+        if (static_cast<size_t>(end - data) > max_header_size_) {
+          return fail(HttpResponse::StatusCode::HeaderFieldsTooLarge);
+        }
+        return Result::Incomplete;
+      }
+      request_len_ = trailer_end + 4 - base;
+      return complete(base);
+    }
+
+    if (size > max_body_size_ - chunked_body_.size()) {
+      return fail(HttpResponse::StatusCode::PayloadTooLarge);
+    }
+    if (static_cast<size_t>(end - data) < size + 2) {
+      return Result::Incomplete;
+    }
+    if (memcmp(data + size, kCRLF, 2) != 0) {
+      return fail(HttpResponse::StatusCode::BadRequest);
+    }
+    chunked_body_.append(data, size);
+    chunk_pos_ = data + size + 2 - base;
+  }
+}
+
+HttpParser::Result HttpParser::fail(HttpResponse::StatusCode status) {
+  state_ = State::Error;
+  error_status_ = status;
+  return Result::Error;
+}
+
+HttpParser::Result HttpParser::complete(const char* base) {
+  auto view = [base](Span span) {
+    return std::string_view(base + span.offset, span.len);
+  };
+  request_.method_str_ = view(method_);
+  request_.path_ = view(path_);
+  request_.query_ = view(query_);
+  for (const auto& header : header_spans_) {
+    request_.headers_.emplace_back(view(header.first), view(header.second));
+  }
+  if (chunked_) {
+    request_.body_ = chunked_body_;
+  } else {
+    request_.body_ = std::string_view(base + head_len_, content_length_);
+  }
+  state_ = State::Complete;
+  return Result::Complete;
+}
+
+void HttpParser::next(Buffer* buf) {
+  assert(state_ == State::Complete);
+  buf->retrieve(request_len_);
+  state_ = State::Head;
+  scanned_ = 0;
+  head_len_ = 0;
+  content_length_ = 0;
+  chunked_ = false;
+  chunk_pos_ = 0;
+  request_len_ = 0;
+  header_spans_.clear();
+  chunked_body_.clear();
+  request_.reset();
+}
@@ -0,0 +1,80 @@
+#include "http_request.h"
+
+#include <strings.h>  // strncasecmp
+
+std::string_view HttpRequest::getHeader(std::string_view field) const {
+  for (const Header& header : headers_) {
+    if (equalsIgnoreCase(header.first, field)) {
+      return header.second;
+    }
+  }
+  return std::string_view();
+}
+
+HttpRequest::Method HttpRequest::parseMethod(std::string_view method) {
+  switch (method.size()) {
+    case 3:
+      if (method == "GET") return Method::Get;
+      if (method == "PUT") return Method::Put;
+      break;
+    case 4:
+      if (method == "POST") return Method::Post;
+      if (method == "HEAD") return Method::Head;
+      break;
+    case 5:
+      if (method == "PATCH") return Method::Patch;
+      break;
+    case 6:
+      if (method == "DELETE") return Method::Delete;
+      break;
+    case 7:
+      if (method == "OPTIONS") return Method::Options;
+      break;
+    default:
+      break;
+  }
+  return Method::Invalid;
+}
+
+bool HttpRequest::equalsIgnoreCase(std::string_view l, std::string_view r) {
+  return l.size() == r.size() &&
+         ::strncasecmp(l.data(), r.data(), l.size()) == 0;
+}
+
+namespace {
+std::string_view trimSpaces(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+}  // namespace
+
+bool HttpRequest::anyListItem(std::string_view value,
+                              const ListItemMatch& match) {
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    std::string_view item = value.substr(0, comma);
+    size_t semicolon = item.find(';');
+    std::string_view params = semicolon == std::string_view::npos
+                                  ? std::string_view()
+                                  : item.substr(semicolon + 1);
+    if (match(trimSpaces(item.substr(0, semicolon)), trimSpaces(params))) {
+      return true;
+    }
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+bool HttpRequest::hasToken(std::string_view value, std::string_view token) {
+  return anyListItem(value, [token](std::string_view item, std::string_view) {
+    return equalsIgnoreCase(item, token);
+  });
+}
@@ -0,0 +1,161 @@
+#include "http_response.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "buffer.h"
+
+namespace {
+/**
+ * "Date: ...\r\n", formatted at most once per second per thread, see
+ * RFC 9110 section 6.6.1
+ */
+std::string_view dateHeader() {
+  thread_local time_t cached_second = 0;
+  thread_local char cached[64];
+  thread_local size_t cached_len = 0;
+
+  time_t now = ::time(nullptr);
+  if (now != cached_second) {
+    cached_second = now;
+    struct tm tm;
+    ::gmtime_r(&now, &tm);
+    cached_len =
+        ::strftime(cached, sizeof cached, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n",
+                   &tm);
+  }
+  return std::string_view(cached, cached_len);
+}
+}  // namespace
+
+void HttpResponse::addHeader(std::string_view field, std::string_view value) {
+  headers_.append(field.data(), field.size());
+  headers_.append(": ", 2);
+  headers_.append(value.data(), value.size());
+  headers_.append("\r\n", 2);
+}
+
+bool HttpResponse::bodyAllowed() const {
+  int code = static_cast<int>(status_code_);
+  return code >= 200 && status_code_ != StatusCode::NoContent &&
+         status_code_ != StatusCode::NotModified;
+}
+
+void HttpResponse::appendHead(Buffer* output) const {
+  std::string_view line = statusLine(status_code_);
+  output->append(line.data(), line.size());
+
+  if (bodyAllowed()) {
+    if (!producer_) {
+      char buf[48];
+      int len = snprintf(buf, sizeof buf, "Content-Length: %zu\r\n",
+                         body().size());
+      output->append(buf, len);
+    } else if (content_length_ >= 0) {
+      char buf[48];
+      int len = snprintf(buf, sizeof buf, "Content-Length: %zd\r\n",
+                         content_length_);
+      output->append(buf, len);
+    } else if (chunked()) {
+      output->append("Transfer-Encoding: chunked\r\n", 28);
+    }
+  }
+  if (status_code_ == StatusCode::SwitchingProtocols) {
+    /* "Connection: Upgrade" comes with the other upgrade headers */
+  } else if (close_connection_) {
+    output->append("Connection: close\r\n", 19);
+  } else {
+    output->append("Connection: keep-alive\r\n", 24);
+  }
+  std::string_view date = dateHeader();
+  output->append(date.data(), date.size());
+  output->append(raw_headers_.data(), raw_headers_.size());
+  output->append(headers_);
+  output->append("\r\n", 2);
+}
+
+void HttpResponse::appendToBuffer(Buffer* output) const {
+  appendHead(output);
+  if (bodyAllowed()) {
+    std::string_view b = body();
+    output->append(b.data(), b.size());
+  }
+}
+
+std::string_view HttpResponse::statusLine(StatusCode code) {
+  switch (code) {
+    case StatusCode::SwitchingProtocols:
+      return "HTTP/1.1 101 Switching Protocols\r\n";
+    case StatusCode::Ok:
+      return "HTTP/1.1 200 OK\r\n";
+    case StatusCode::Created:
+      return "HTTP/1.1 201 Created\r\n";
+    case StatusCode::NoContent:
+      return "HTTP/1.1 204 No Content\r\n";
+    case StatusCode::MovedPermanently:
+      return "HTTP/1.1 301 Moved Permanently\r\n";
+    case StatusCode::Found:
+      return "HTTP/1.1 302 Found\r\n";
+    case StatusCode::NotModified:
+      return "HTTP/1.1 304 Not Modified\r\n";
+    case StatusCode::BadRequest:
+      return "HTTP/1.1 400 Bad Request\r\n";
+    case StatusCode::Forbidden:
+      return "HTTP/1.1 403 Forbidden\r\n";
+    case StatusCode::NotFound:
+      return "HTTP/1.1 404 Not Found\r\n";
+    case StatusCode::MethodNotAllowed:
+      return "HTTP/1.1 405 Method Not Allowed\r\n";
+    case StatusCode::LengthRequired:
+      return "HTTP/1.1 411 Length Required\r\n";
+    case StatusCode::PayloadTooLarge:
+      return "HTTP/1.1 413 Content Too Large\r\n";
+    case StatusCode::UriTooLong:
+      return "HTTP/1.1 414 URI Too Long\r\n";
+    case StatusCode::HeaderFieldsTooLarge:
+      return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+    case StatusCode::InternalServerError:
+      return "HTTP/1.1 500 Internal Server Error\r\n";
+    case StatusCode::NotImplemented:
+      return "HTTP/1.1 501 Not Implemented\r\n";
+    case StatusCode::ServiceUnavailable:
+      return "HTTP/1.1 503 Service Unavailable\r\n";
+    case StatusCode::VersionNotSupported:
+      return "HTTP/1.1 505 HTTP Version Not Supported\r\n";
+    case StatusCode::Unknown:
+      break;
+  }
+  return "HTTP/1.1 500 Internal Server Error\r\n";
+}
+
+StreamProducer::State HttpChunkedProducer::produce(size_t max_bytes,
+                                                   Slice* chunk) {
+  if (!data_.empty()) {
+    *chunk = data_;
+    data_ = Slice();
+    return State::Data;
+  }
+  if (finished_) {
+    return State::Done;
+  }
+
+  Slice data;
+  State state = body_->produce(max_bytes, &data);
+  if (state == State::Data && !data.empty()) {
+    char line[32];
+    int len = snprintf(line, sizeof line, "%s%zx\r\n", started_ ? "\r\n" : "",
+                       data.size());
+    started_ = true;
+    data_ = data;
+    *chunk = Slice::copyFrom(line, len);
+    return State::Data;
+  }
+  if (state == State::Done) {
+    /* Last chunk and an empty trailer section */
+    finished_ = true;
+    *chunk = started_ ? Slice::copyFrom("\r\n0\r\n\r\n", 7)
+                      : Slice::copyFrom("0\r\n\r\n", 5);
+    return State::Data;
+  }
+  return state;
+}
@@ -0,0 +1,208 @@
+#include "http_response_cache.h"
+
+#include <stdio.h>
+
+#include <functional>
+
+#include "http_request.h"
+#include "http_response.h"
+
+namespace {
+/* FNV-1a, good enough to tell versions of one resource apart */
+uint64_t hashBytes(std::string_view data) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string makeEtag(std::string_view body, const char* suffix) {
+  char buf[64];
+  int len = snprintf(buf, sizeof buf, "\"%016llx-%zx%s\"",
+                     static_cast<unsigned long long>(hashBytes(body)),
+                     body.size(), suffix);
+  return std::string(buf, len);
+}
+
+bool acceptsGzip(const HttpRequest& request) {
+  return HttpRequest::anyListItem(
+      request.getHeader("Accept-Encoding"),
+      [](std::string_view coding, std::string_view params) {
+        bool rejected = params == "q=0" || params == "q=0.0" ||
+                        params == "q=0.00" || params == "q=0.000";
+        return !rejected && (HttpRequest::equalsIgnoreCase(coding, "gzip") ||
+                             coding == "*");
+      });
+}
+
+/* Weak comparison, as If-None-Match requires (RFC 9110 13.1.2) */
+bool noneMatch(const HttpRequest& request, const std::string& etag) {
+  std::string_view value = request.getHeader("If-None-Match");
+  if (value.empty() || etag.empty()) {
+    return false;
+  }
+  return HttpRequest::anyListItem(
+      value, [&etag](std::string_view tag, std::string_view) {
+        if (tag.substr(0, 2) == "W/") {
+          tag.remove_prefix(2);
+        }
+        return tag == "*" || tag == etag;
+      });
+}
+
+Slice headerLines(std::string_view content_type, std::string_view encoding,
+                  std::string_view cache_control, const std::string& etag,
+                  bool vary) {
+  std::string lines;
+  if (!content_type.empty()) {
+    lines.append("Content-Type: ").append(content_type).append("\r\n");
+  }
+  if (!encoding.empty()) {
+    lines.append("Content-Encoding: ").append(encoding).append("\r\n");
+  }
+  if (!cache_control.empty()) {
+    lines.append("Cache-Control: ").append(cache_control).append("\r\n");
+  }
+  lines.append("ETag: ").append(etag).append("\r\n");
+  if (vary) {
+    lines.append("Vary: Accept-Encoding\r\n");
+  }
+  return Slice(std::move(lines));
+}
+}  // namespace
+
+HttpResponseCache::HttpResponseCache(size_t capacity_bytes, int num_shards)
+    : shard_capacity_(capacity_bytes / num_shards), hits_(0), misses_(0) {
+  assert(num_shards > 0);
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard);
+  }
+}
+
+HttpResponseCache::EntryPtr HttpResponseCache::makeEntry(
+    std::string_view content_type, std::string&& body, std::string&& gzip_body,
+    std::string_view cache_control) {
+  auto entry = std::make_shared<Entry>();
+  const bool vary = !gzip_body.empty();
+  entry->etag = makeEtag(body, "");
+  entry->headers =
+      headerLines(content_type, "", cache_control, entry->etag, vary);
+  entry->not_modified_headers =
+      headerLines("", "", cache_control, entry->etag, vary);
+  if (vary) {
+    /* A different representation needs a different strong validator */
+    entry->gzip_etag = makeEtag(gzip_body, "-gz");
+    entry->gzip_headers = headerLines(content_type, "gzip", cache_control,
+                                      entry->gzip_etag, true);
+    entry->gzip_not_modified_headers =
+        headerLines("", "", cache_control, entry->gzip_etag, true);
+    entry->gzip_body = Slice(std::move(gzip_body));
+  }
+  entry->body = Slice(std::move(body));
+  return entry;
+}
+
+HttpResponseCache::Shard& HttpResponseCache::shardOf(std::string_view key) {
+  size_t hash = std::hash<std::string_view>()(key);
+  return *shards_[hash % shards_.size()];
+}
+
+void HttpResponseCache::put(std::string_view key, EntryPtr entry) {
+  Shard& shard = shardOf(key);
+  const size_t charge = entry->charge() + key.size();
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.bytes -= it->second->entry->charge() + key.size();
+    it->second->entry = std::move(entry);
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  } else {
+    shard.lru.push_front(Shard::Node{std::string(key), std::move(entry)});
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+  }
+  shard.bytes += charge;
+  evict(&shard);
+}
+
+HttpResponseCache::EntryPtr HttpResponseCache::get(std::string_view key) {
+  Shard& shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    ++misses_;
+    return EntryPtr();
+  }
+  ++hits_;
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->entry;
+}
+
+void HttpResponseCache::erase(std::string_view key) {
+  Shard& shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    auto node = it->second;
+    shard.bytes -= node->entry->charge() + node->key.size();
+    shard.index.erase(it);
+    shard.lru.erase(node);
+  }
+}
+
+/* The most recently inserted entry always stays, even if it is too large */
+void HttpResponseCache::evict(Shard* shard) {
+  while (shard->bytes > shard_capacity_ && shard->lru.size() > 1) {
+    Shard::Node& victim = shard->lru.back();
+    shard->bytes -= victim.entry->charge() + victim.key.size();
+    shard->index.erase(victim.key);
+    shard->lru.pop_back();
+  }
+}
+
+size_t HttpResponseCache::bytes() const {
+  size_t total = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->bytes;
+  }
+  return total;
+}
+
+/* Reuses one string per thread, lookups don't allocate */
+std::string_view HttpResponseCache::keyOf(const HttpRequest& request) {
+  if (request.query().empty()) {
+    return request.path();
+  }
+  thread_local std::string key;
+  key.assign(request.path().data(), request.path().size());
+  key.push_back('?');
+  key.append(request.query().data(), request.query().size());
+  return key;
+}
+
+bool HttpResponseCache::serve(const HttpRequest& request,
+                              HttpResponse* response) {
+  HttpRequest::Method method = request.method();
+  if (method != HttpRequest::Method::Get &&
+      method != HttpRequest::Method::Head) {
+    return false;
+  }
+  EntryPtr entry = get(keyOf(request));
+  if (!entry) {
+    return false;
+  }
+
+  const bool gzip = !entry->gzip_body.empty() && acceptsGzip(request);
+  const std::string& etag = gzip ? entry->gzip_etag : entry->etag;
+  if (noneMatch(request, etag)) {
+    response->setStatusCode(HttpResponse::StatusCode::NotModified);
+    response->setRawHeaders(gzip ? entry->gzip_not_modified_headers
+                                 : entry->not_modified_headers);
+  } else {
+    response->setStatusCode(HttpResponse::StatusCode::Ok);
+    response->setRawHeaders(gzip ? entry->gzip_headers : entry->headers);
+    response->setBody(gzip ? entry->gzip_body : entry->body);
+  }
+  return true;
+}
@@ -0,0 +1,200 @@
+#include "http_server.h"
+
+#include <any>
+
+#include "logging.h"
+
+namespace {
+void defaultHttpCallback(const HttpRequest&, HttpResponse* response) {
+  response->setStatusCode(HttpResponse::StatusCode::NotFound);
+  response->setCloseConnection(true);
+}
+}  // namespace
+
+HttpServer::HttpServer(EventLoop* loop, const InetAddress& listen_addr)
+    : server_(loop, listen_addr),
+      http_cb_(defaultHttpCallback),
+      cache_(nullptr),
+      max_header_size_(HttpParser::DefaultMaxHeaderSize),
+      max_body_size_(HttpParser::DefaultMaxBodySize) {
+  server_.setConnectionCallback(
+      std::bind(&HttpServer::onConnection, this, std::placeholders::_1));
+  server_.setMessageCallback(
+      std::bind(&HttpServer::onMessage, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+}
+
+void HttpServer::start() { server_.start(); }
+
+void HttpServer::onConnection(const TcpConnectionPtr& conn) {
+  if (conn->connected()) {
+    conn->setTcpNoDelay(true);
+    conn->setContext(HttpParser(max_header_size_, max_body_size_));
+  } else if (ws_conn_cb_ &&
+             std::any_cast<WebSocketCodec>(conn->getMutableContext())) {
+    ws_conn_cb_(conn);
+  }
+}
+
+/**
+ * Handle every complete request in @buf. The responses are batched in one
+ * Buffer, so a pipelined burst costs one send
+ */
+void HttpServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                           Timestamp recv_time) {
+  HttpParser* parser = std::any_cast<HttpParser>(conn->getMutableContext());
+  if (parser == nullptr) {
+    /* Already answered with close, ignore what is still coming */
+    buf->retrieveAll();
+    return;
+  }
+  if (conn->streaming()) {
+    /* Pipelined requests wait in @buf until the stream completes */
+    return;
+  }
+
+  Buffer output;
+  bool close = false;
+  while (!close) {
+    HttpParser::Result result = parser->parse(buf, recv_time);
+    if (result == HttpParser::Result::Incomplete) {
+      break;
+    }
+    if (result == HttpParser::Result::Error) {
+      LOG << "HttpServer::onMessage " << conn->name() << " bad request "
+          << static_cast<int>(parser->errorStatus());
+      HttpResponse response(true);
+      response.setStatusCode(parser->errorStatus());
+      response.appendToBuffer(&output);
+      close = true;
+      break;
+    }
+
+    const HttpRequest& request = parser->request();
+    HttpResponse response(!request.keepAlive());
+    if (cache_ == nullptr || !cache_->serve(request, &response)) {
+      http_cb_(request, &response);
+    }
+    if (response.statusCode() == HttpResponse::StatusCode::SwitchingProtocols) {
+      if (ws_message_cb_) {
+        response.appendHead(&output);
+        parser->next(buf);
+        conn->send(&output);
+        upgrade(conn, buf, recv_time);
+        return;
+      }
+      LOG << "HttpServer::onMessage " << conn->name()
+          << " upgrade without WebSocket callback";
+      response = HttpResponse(true);
+      response.setStatusCode(HttpResponse::StatusCode::NotImplemented);
+    }
+    if (response.bodyProducer() && response.chunked() &&
+        request.version() != HttpRequest::Version::Http11) {
+      /* No chunked coding before HTTP/1.1, the body ends with the connection */
+      response.setCloseConnection(true);
+    }
+    bool stream = appendResponse(conn, request, response, &output);
+    close = response.closeConnection();
+    parser->next(buf);
+    if (stream) {
+      startStream(conn, response, &output);
+      return;
+    }
+  }
+
+  if (output.readableBytes() > 0) {
+    conn->send(&output);
+  }
+  if (close) {
+    buf->retrieveAll();
+    conn->getMutableContext()->reset();
+    conn->shutdown();
+  }
+}
+
+bool HttpServer::appendResponse(const TcpConnectionPtr& conn,
+                                const HttpRequest& request,
+                                const HttpResponse& response, Buffer* output) {
+  response.appendHead(output);
+  if (request.method() == HttpRequest::Method::Head ||
+      !response.bodyAllowed()) {
+    return false;
+  }
+  if (response.bodyProducer()) {
+    return true;
+  }
+  const Slice& slice = response.bodySlice();
+  if (slice.size() >= CopyThreshold) {
+    /* Keep the order: what is batched so far goes first */
+    conn->send(output);
+    conn->send(slice);
+  } else {
+    std::string_view body = response.body();
+    output->append(body.data(), body.size());
+  }
+  return false;
+}
+
+/**
+ * Stop reading while the body streams, so pipelined requests don't pile up
+ * in the input Buffer. They are handled once the stream completes
+ */
+void HttpServer::startStream(const TcpConnectionPtr& conn,
+                             const HttpResponse& response, Buffer* output) {
+  conn->send(output);
+  std::shared_ptr<StreamProducer> producer = response.bodyProducer();
+  if (response.chunked()) {
+    producer = std::make_shared<HttpChunkedProducer>(producer);
+  }
+  const bool close = response.closeConnection();
+  conn->stopRead();
+  conn->stream(producer, [this, close](const TcpConnectionPtr& c, bool ok) {
+    onStreamComplete(c, ok, close);
+  });
+}
+
+void HttpServer::onStreamComplete(const TcpConnectionPtr& conn, bool ok,
+                                  bool close) {
+  if (!ok || !conn->connected()) {
+    return;
+  }
+  if (close) {
+    conn->inputBuffer()->retrieveAll();
+    conn->getMutableContext()->reset();
+    conn->shutdown();
+    return;
+  }
+  conn->startRead();
+  if (conn->inputBuffer()->readableBytes() > 0) {
+    onMessage(conn, conn->inputBuffer(), Timestamp::now());
+  }
+}
+
+/**
+ * Frames the client sent right behind the upgrade request are already in
+ * @buf, decode them now rather than waiting for the next read
+ */
+void HttpServer::upgrade(const TcpConnectionPtr& conn, Buffer* buf,
+                         Timestamp recv_time) {
+  conn->setContext(WebSocketCodec(ws_message_cb_));
+  conn->setMessageCallback(
+      std::bind(&HttpServer::onWebSocketMessage, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+  if (ws_conn_cb_) {
+    ws_conn_cb_(conn);
+  }
+  if (buf->readableBytes() > 0) {
+    onWebSocketMessage(conn, buf, recv_time);
+  }
+}
+
+void HttpServer::onWebSocketMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                                    Timestamp recv_time) {
+  WebSocketCodec* codec =
+      std::any_cast<WebSocketCodec>(conn->getMutableContext());
+  if (codec == nullptr) {
+    buf->retrieveAll();
+    return;
+  }
+  codec->onMessage(conn, buf, recv_time);
+}
@@ -8,7 +8,8 @@ class EventLoop;
 class InetAddress;
 
 /**
- * Acceptor of incoming TCP connections.
+ * Acceptor of incoming TCP connections, or unix domain stream connections if
+ * the listen address is one.
  */
 class Acceptor {
  public:
@@ -17,6 +18,10 @@ class Acceptor {
 
   Acceptor(EventLoop* loop, const InetAddress& listenAddr);
 
+  DISALLOW_COPY(Acceptor);
+
+  ~Acceptor();
+
   void setNewConnectionCallback(const NewConnectionCallback& cb) {
     new_conn_cb_ = cb;
   }
@@ -25,6 +30,16 @@ class Acceptor {
 
   void listen();
 
+  /**
+   * Stop accepting, new connections wait in the listen backlog, and the
+   * kernel refuses them once it is full. In loop thread
+   */
+  void pause();
+
+  void resume();
+
+  bool paused() const { return listenning_ && !channel_.isReading(); }
+
  private:
   void handleRead();
 
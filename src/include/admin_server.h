@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "http_server.h"
+#include "macro.h"
+
+/**
+ * Admin listener on a port of its own
+ *
+ * - GET /metrics is MetricsRegistry::scrape(), in the Prometheus text format
+ * - GET /trace?start and /trace?stop switch Tracer on and off, GET /trace
+ *   is the Chrome trace-event JSON of the events recorded so far
+ *
+ * Runs on HttpServer, usually on the base loop of the process: a scrape is a
+ * connection of that loop, not of the I/O loops serving traffic, and the
+ * metrics are merged only when one comes in.
+ */
+class AdminServer {
+ public:
+  AdminServer(EventLoop* loop, const InetAddress& listen_addr);
+
+  DISALLOW_COPY(AdminServer);
+
+  /**
+   * Serve GET @path too, e.g. a health check. Not thread safe, call it
+   * before start()
+   */
+  void addHandler(const std::string& path,
+                  const HttpServer::HttpCallback& cb) {
+    handlers_[path] = cb;
+  }
+
+  void start() { server_.start(); }
+
+ private:
+  void onRequest(const HttpRequest& request, HttpResponse* response);
+
+  HttpServer server_;
+  std::map<std::string, HttpServer::HttpCallback, std::less<>> handlers_;
+};
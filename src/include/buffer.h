@@ -1,10 +1,14 @@
 #pragma once
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
 #include <string>
 #include <vector>
+
+#include "sockets_options.h"
 //#include <unistd.h>  // ssize_t
 
 /**
@@ -34,8 +38,32 @@ class Buffer {
     assert(prependableBytes() == CheapPrependSize);
   }
 
+  /**
+   * Adopt @storage, e.g. recycled from a closed connection. It is grown if it
+   * can't hold InitialSize bytes
+   */
+  explicit Buffer(std::vector<char>&& storage)
+      : buffer_(std::move(storage)),
+        reader_idx_(CheapPrependSize),
+        writer_idx_(CheapPrependSize) {
+    if (buffer_.size() < CheapPrependSize + InitialSize) {
+      buffer_.resize(CheapPrependSize + InitialSize);
+    }
+  }
+
   /* default copy-ctor, dtor and assignment are fine */
 
+  /**
+   * Hand the underlying storage over, e.g. to recycle it
+   * Must be the last use of this Buffer
+   */
+  std::vector<char> releaseStorage() {
+    retrieveAll();
+    std::vector<char> storage;
+    storage.swap(buffer_);
+    return storage;
+  }
+
   void swap(Buffer& rhs) {
     buffer_.swap(rhs.buffer_);
     std::swap(reader_idx_, rhs.reader_idx_);
@@ -48,11 +76,17 @@ class Buffer {
 
   size_t prependableBytes() const { return reader_idx_; }
 
+  /* Memory held, readable or not */
+  size_t capacity() const { return buffer_.capacity(); }
+
   /**
    * @return: the first readable char
    */
   const char* peek() const { return begin() + reader_idx_; }
 
+  /* For decoding in place, e.g. unmasking WebSocket payloads */
+  char* mutablePeek() { return begin() + reader_idx_; }
+
   /**
    * Application reads from application buffer
    * After read, move reader_idx_ right by @len
@@ -81,6 +115,8 @@ class Buffer {
     writer_idx_ = CheapPrependSize;
   }
 
+  void retrieveInt32() { retrieve(sizeof(int32_t)); }
+
   std::string retrieveAsString() {
     std::string str(peek(), readableBytes());
     retrieveAll();
@@ -103,6 +139,35 @@ class Buffer {
     append(static_cast<const char*>(data), len);
   }
 
+  /**
+   * Append int32_t using network endian
+   */
+  void appendInt32(int32_t x) {
+    int32_t be32 = sockets::hostToNetwork32(x);
+    append(&be32, sizeof be32);
+  }
+
+  /**
+   * Peek int32_t from network endian
+   * Require: readableBytes() >= sizeof(int32_t)
+   */
+  int32_t peekInt32() const {
+    assert(readableBytes() >= sizeof(int32_t));
+    int32_t be32 = 0;
+    ::memcpy(&be32, peek(), sizeof be32);
+    return sockets::networkToHost32(be32);
+  }
+
+  /**
+   * Read int32_t from network endian
+   * Require: readableBytes() >= sizeof(int32_t)
+   */
+  int32_t readInt32() {
+    int32_t result = peekInt32();
+    retrieveInt32();
+    return result;
+  }
+
   void ensureWritableBytes(size_t len) {
     if (writableBytes() < len) {
       makeSpace(len);
@@ -123,6 +188,16 @@ class Buffer {
     std::copy(d, d + len, begin() + reader_idx_);
   }
 
+  /**
+   * Prepend int32_t using network endian into the prependable area, so a
+   * length header can be put in front of an already built body without
+   * copying it
+   */
+  void prependInt32(int32_t x) {
+    int32_t be32 = sockets::hostToNetwork32(x);
+    prepend(&be32, sizeof be32);
+  }
+
   void shrink(size_t reserve) {
     std::vector<char> buf(CheapPrependSize + readableBytes() + reserve);
     std::copy(peek(), peek() + readableBytes(), buf.begin() + CheapPrependSize);
@@ -137,7 +212,23 @@ class Buffer {
    */
   ssize_t readFd(int fd, int* saved_errno);
 
+  /**
+   * Same as above with recvmsg(2) on a unix domain socket, file descriptors
+   * passed along (SCM_RIGHTS) are appended to @fds, close-on-exec, owned by
+   * the caller
+   */
+  ssize_t readFd(int fd, int* saved_errno, std::vector<int>* fds);
+
+  /**
+   * readFd() reads up to writableBytes() plus this much, a read that fills
+   * both likely left more data in the socket
+   */
+  static const size_t ExtraBufferSize = 65536;
+
  private:
+  /* readv(2), or recvmsg(2) collecting passed fds into @fds if not null */
+  ssize_t readInto(int fd, int* saved_errno, std::vector<int>* fds);
+
   /* The beginning position of the underlying buffer_ */
   char* begin() { return &*buffer_.begin(); }
 
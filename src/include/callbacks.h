@@ -1,4 +1,6 @@
-#include <sys/_types/_ssize_t.h>
+#pragma once
+
+#include <sys/types.h>
 
 #include <functional>
 #include <memory>
@@ -17,7 +19,15 @@ using ConnectionCallback = std::function<void(const TcpConnectionPtr&)>;
 
 using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
 
+/* Invoked with the pending output size when it crosses the high water mark */
+using HighWaterMarkCallback =
+    std::function<void(const TcpConnectionPtr&, size_t)>;
+
 using MessageCallback =
     std::function<void(const TcpConnectionPtr&, Buffer*, Timestamp)>;
 
 using CloseCallback = std::function<void(const TcpConnectionPtr&)>;
+
+/* Invoked when a stream ends, @ok is false if it was aborted */
+using StreamCompleteCallback =
+    std::function<void(const TcpConnectionPtr&, bool ok)>;
@@ -45,6 +45,11 @@ class Channel {
 
   void setOwnerLoop(EventLoop* owner_loop) { owner_loop_ = owner_loop; }
 
+  /* An interest change waits in EventLoop to be applied before next poll */
+  bool updatePending() const { return update_pending_; }
+
+  void setUpdatePending(bool pending) { update_pending_ = pending; }
+
   void setReadCallback(const ReadEventCallback& cb) { read_cb_ = cb; }
 
   void setWriteCallback(const Callback& cb) { write_cb_ = cb; }
@@ -80,7 +85,9 @@ class Channel {
     update();
   }
 
-  bool isWriting() { return events_ & WriteEvent; }
+  bool isWriting() const { return events_ & WriteEvent; }
+
+  bool isReading() const { return events_ & ReadEvent; }
 
  private:
   void update();
@@ -107,4 +114,5 @@ class Channel {
 
   EventLoop* owner_loop_;
   bool events_handling_;
+  bool update_pending_;
 };
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "macro.h"
+
+class EventLoop;
+
+/**
+ * Per-loop recycler of connection memory
+ *
+ * 1. Fixed-size blocks for allocate_shared<TcpConnection>, i.e. the control
+ *    block and the TcpConnection with its inline Socket and Channel
+ * 2. Storage of the input and output Buffers
+ *
+ * So the steady state accept/close cycle reuses memory instead of going
+ * through the heap allocator.
+ *
+ * Allocation must happen in the owner loop. Blocks freed in the owner loop go
+ * straight to the free list, blocks freed in other threads (a user kept the
+ * last TcpConnectionPtr) are pushed onto a lock-free stack which the owner
+ * drains on its next allocation.
+ */
+class ConnectionPool {
+ public:
+  /* Blocks carved from one heap chunk */
+  static const size_t BlocksPerChunk = 64;
+  /* Buffer storages kept for reuse */
+  static const size_t MaxCachedStorages = 1024;
+  /* Larger Buffer storages are freed, not kept */
+  static const size_t MaxStorageSize = 64 * 1024;
+
+  explicit ConnectionPool(EventLoop* loop);
+
+  DISALLOW_COPY(ConnectionPool);
+
+  ~ConnectionPool();
+
+  /**
+   * The block size is fixed by the first call, requests of other sizes go to
+   * the heap. Must be called in the owner loop
+   */
+  void* allocate(size_t size);
+
+  /* Thread safe */
+  void deallocate(void* p, size_t size);
+
+  /**
+   * Recycled Buffer storage, empty if none is cached
+   * Must be called in the owner loop
+   */
+  std::vector<char> takeStorage();
+
+  /* Keep @storage for reuse. Outside the owner loop it is simply freed */
+  void recycleStorage(std::vector<char>&& storage);
+
+  EventLoop* getLoop() const { return loop_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  /* Move blocks freed by other threads onto free_list_ */
+  void drainRemoteFrees();
+
+  EventLoop* loop_;
+  size_t block_size_;
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  /* Only touched in the owner loop */
+  FreeBlock* free_list_;
+  /* Blocks freed in other threads, multi-producer single-consumer */
+  std::atomic<FreeBlock*> remote_frees_;
+  std::vector<std::vector<char>> storages_;
+};
+
+/**
+ * Allocator handing out ConnectionPool blocks, for std::allocate_shared
+ *
+ * It holds a reference on the pool, so the pool outlives every block.
+ */
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  explicit PoolAllocator(std::shared_ptr<ConnectionPool> pool)
+      : pool_(std::move(pool)) {}
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : pool_(other.pool()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) { pool_->deallocate(p, n * sizeof(T)); }
+
+  const std::shared_ptr<ConnectionPool>& pool() const { return pool_; }
+
+ private:
+  std::shared_ptr<ConnectionPool> pool_;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& l, const PoolAllocator<U>& r) {
+  return l.pool() == r.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& l, const PoolAllocator<U>& r) {
+  return !(l == r);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "callbacks.h"
+#include "macro.h"
+
+/**
+ * Connections of one EventLoop, keyed by 64-bit connection id
+ *
+ * Open addressing with linear probing and backward shift deletion, so there
+ * are no tombstones and a lookup touches a few adjacent slots. Id 0 marks an
+ * empty slot.
+ *
+ * Not thread safe: each shard is only touched in its owning loop thread.
+ */
+class ConnectionRegistry {
+ public:
+  explicit ConnectionRegistry(size_t initial_capacity = 64);
+
+  DISALLOW_COPY(ConnectionRegistry);
+
+  /* @id must not be present yet */
+  void insert(uint64_t id, const TcpConnectionPtr& conn);
+
+  /* @return whether @id was present */
+  bool erase(uint64_t id);
+
+  /* @return nullptr if @id is absent */
+  TcpConnectionPtr find(uint64_t id) const;
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  /* Invoke @func on every connection, @func must not modify the registry */
+  template <typename Func>
+  void forEach(Func func) const {
+    for (const Slot& slot : slots_) {
+      if (slot.id != 0) {
+        func(slot.conn);
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    uint64_t id = 0;
+    TcpConnectionPtr conn;
+  };
+
+  /**
+   * Fibonacci hashing: ids are handed out round robin, so the ids of one
+   * shard form an arithmetic sequence that must not map to a subset of slots
+   */
+  size_t homeOf(uint64_t id) const {
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> shift_);
+  }
+
+  /* Slot holding @id, or slots_.size() if absent */
+  size_t indexOf(uint64_t id) const;
+
+  void rehash(size_t capacity);
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  int shift_;
+  size_t size_;
+};
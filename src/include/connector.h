@@ -0,0 +1,98 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "channel.h"
+#include "inet_addr.h"
+#include "macro.h"
+
+class EventLoop;
+
+/**
+ * Active connector of one outgoing TCP connection, used by TcpClient
+ *
+ * connect(2) is issued non-blocking, completion is detected through
+ * writability of the socket and confirmed with SO_ERROR. Failed attempts are
+ * retried with exponential backoff, from InitRetryDelay up to MaxRetryDelay.
+ */
+class Connector : public std::enable_shared_from_this<Connector> {
+ public:
+  /* The connected sockfd is owned by the callee */
+  using NewConnectionCallback = std::function<void(int sockfd)>;
+
+  /* In seconds */
+  static constexpr double InitRetryDelay = 0.5;
+  static constexpr double MaxRetryDelay = 30.0;
+
+  Connector(EventLoop* loop, const InetAddress& server_addr);
+
+  DISALLOW_COPY(Connector);
+
+  ~Connector();
+
+  void setNewConnectionCallback(const NewConnectionCallback& cb) {
+    new_conn_cb_ = cb;
+  }
+
+  /* Bound the backoff, e.g. a short one for upstream pools */
+  void setRetryDelay(double init_delay, double max_delay) {
+    init_retry_delay_ = init_delay;
+    max_retry_delay_ = max_delay;
+    retry_delay_ = init_delay;
+  }
+
+  const InetAddress& serverAddress() const { return server_addr_; }
+
+  /* Thread safe */
+  void start();
+
+  /**
+   * Start over with the initial delay, after an established connection is
+   * lost. Must be called in the loop thread
+   */
+  void restart();
+
+  /* Give up the attempt in progress and any scheduled retry. Thread safe */
+  void stop();
+
+ private:
+  enum class States { Disconnected, Connecting, Connected };
+
+  void setState(States s) { state_ = s; }
+
+  void startInLoop();
+
+  void stopInLoop();
+
+  void connect();
+
+  /* Wait for @sockfd to become writable */
+  void connecting(int sockfd);
+
+  void handleWrite();
+
+  void handleError();
+
+  /* Close @sockfd and schedule the next attempt */
+  void retry(int sockfd);
+
+  /* Unregister channel_ and hand its fd back */
+  int removeAndResetChannel();
+
+  void resetChannel();
+
+  EventLoop* loop_;
+  InetAddress server_addr_;
+  /* Whether the user wants to be connected */
+  bool connect_;
+  States state_;
+  /* Only exists while connect(2) is in progress */
+  std::unique_ptr<Channel> channel_;
+  NewConnectionCallback new_conn_cb_;
+  double init_retry_delay_;
+  double max_retry_delay_;
+  double retry_delay_;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
@@ -10,6 +10,7 @@
 #include "timer_queue.h"
 
 class Poller;
+class TcpConnection;
 
 class EventLoop {
  public:
@@ -37,8 +38,74 @@ class EventLoop {
 
   static EventLoop* getEventLoopOfCurrentThread();
 
+  pid_t threadId() const { return thread_id_; }
+
+  /* Number of the running iteration, counts poll returns */
+  uint64_t iteration() const { return iteration_; }
+
+  /* When the last poll returned, a clock that costs nothing to read */
+  Timestamp pollReturnTime() const { return poll_return_time_; }
+
+  /**
+   * How far behind this loop runs, in microseconds. Thread safe
+   *
+   * The largest of: the smoothed busy time of an iteration (poll return to
+   * the end of the iteration), the smoothed age of pending functors when
+   * they run, and how long the current iteration has been running. 0 while
+   * the loop waits in poll, nothing is waiting on it then. The averages are
+   * those of the last iteration and don't decay while idle, which is why
+   * they are left out. A saturated loop still polls now and then, so base
+   * decisions on several samples
+   */
+  int64_t lagMicros() const;
+
+  /* Poll return time of the running iteration, 0 while polling. Thread safe */
+  int64_t iterationStartMicros() const {
+    return iteration_start_us_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Names what the loop thread runs until the scope exits, for
+   * StallWatchdog: the kind of callback, and the connection it runs for or
+   * nullptr. Loop thread only
+   */
+  class CallbackScope {
+   public:
+    CallbackScope(EventLoop* loop, const char* type,
+                  TcpConnection* conn = nullptr)
+        : loop_(loop),
+          type_(loop->callbackType()),
+          conn_(loop->callbackConnection()) {
+      loop->setCallback(type, conn);
+    }
+
+    DISALLOW_COPY(CallbackScope);
+
+    ~CallbackScope() { loop_->setCallback(type_, conn_); }
+
+   private:
+    EventLoop* loop_;
+    const char* type_;
+    TcpConnection* conn_;
+  };
+
+  /* Set by CallbackScope, nullptr while polling. Loop thread only */
+  const char* callbackType() const {
+    return callback_type_.load(std::memory_order_relaxed);
+  }
+
+  TcpConnection* callbackConnection() const {
+    return callback_conn_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Interest changes are batched: @channel is marked and the Poller sees
+   * its final events once, just before the next poll. An enable and disable
+   * within one iteration never reach the Poller
+   */
   void updateChannel(Channel* channel);
 
+  /* Applies a pending update of @channel first */
   void removeChannel(Channel* channel);
 
   /* Should be able to be called in non-I/O thread */
@@ -58,6 +125,9 @@ class EventLoop {
     return timer_queue_->addTimer(cb, time, interval);
   }
 
+  /* Should be able to be called in non-I/O thread, see TimerQueue::cancel */
+  void cancel(TimerId timer_id) { timer_queue_->cancel(timer_id); }
+
   void wakeup();
 
   /**
@@ -68,6 +138,32 @@ class EventLoop {
 
   void queueInLoop(const Functor& cb);
 
+  /**
+   * Same as above, but @cb is dropped if the loop only gets to it after
+   * @deadline, work nobody waits for anymore is not done under overload
+   */
+  void queueInLoop(const Functor& cb, Timestamp deadline);
+
+  /* Functors dropped past their deadline. Thread safe */
+  uint64_t droppedFunctors() const {
+    return dropped_functors_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Run @cb at the end of the current iteration, after active channels and
+   * pending functors are handled. Used to coalesce work, e.g. one flush per
+   * connection per iteration. Must be called in the loop thread
+   */
+  void runAfterIteration(const Functor& cb);
+
+  /**
+   * Run @cb on the next iteration, after the channels that poll reports
+   * active then. Poll doesn't block while any is waiting. Used to resume
+   * work cut short by a budget without polling for it again, see
+   * TcpConnection::setReadBudget(). Must be called in the loop thread
+   */
+  void deferToNextIteration(const Functor& cb);
+
   void quit();
 
  private:
@@ -78,6 +174,26 @@ class EventLoop {
 
   void doPendingFunctors();
 
+  /* Append @cb to pending_functors_, waking the loop if needed */
+  void pushFunctor(const Functor& cb);
+
+  /* @cb queued from another thread while tracing, see Tracer */
+  static Functor tracedFunctor(const Functor& cb);
+
+  void doAfterIterationFunctors();
+
+  /* Hand the channels marked by updateChannel() to the Poller */
+  void applyChannelUpdates();
+
+  /* Atomic only against a signal handler of the loop thread */
+  void setCallback(const char* type, TcpConnection* conn) {
+    callback_type_.store(type, std::memory_order_relaxed);
+    callback_conn_.store(conn, std::memory_order_relaxed);
+  }
+
+  /* Fold @sample into the moving average @average, weight 1/8 */
+  static void updateAverage(std::atomic<int64_t>* average, int64_t sample);
+
   std::atomic<bool> looping_;
   std::atomic<bool> quit_;
   std::atomic<bool> calling_pending_functors_;
@@ -93,9 +209,29 @@ class EventLoop {
   int wakeup_fd_;
   std::unique_ptr<Channel> wakeup_channel_;
   ChannelList active_channels_;
+  /* Channels with updatePending(), each once */
+  ChannelList updated_channels_;
 
   // Protect pending_functors_
   std::mutex mutex_;
   // Will be called in other threads
   std::vector<Functor> pending_functors_;
+  // When pending_functors_ became non-empty, guarded by mutex_
+  int64_t pending_since_us_;
+
+  /* Written in the loop thread only, read by lagMicros() */
+  std::atomic<int64_t> busy_us_;
+  std::atomic<int64_t> queue_age_us_;
+  /* Poll return time of the running iteration, 0 while polling */
+  std::atomic<int64_t> iteration_start_us_;
+  std::atomic<uint64_t> dropped_functors_;
+  std::atomic<const char*> callback_type_;
+  std::atomic<TcpConnection*> callback_conn_;
+
+  // Only touched in loop thread, no lock
+  std::vector<Functor> after_iteration_functors_;
+  /* Ready list, run next iteration and this iteration, swapped each time */
+  std::vector<Functor> deferred_functors_;
+  std::vector<Functor> ready_functors_;
+  uint64_t iteration_;
 };
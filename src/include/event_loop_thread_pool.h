@@ -22,6 +22,12 @@ class EventLoopThreadPool {
 
   EventLoop* getNextLoop();
 
+  /**
+   * All loops of this pool, or only base_loop_ if there is no thread
+   * Must be called after start()
+   */
+  std::vector<EventLoop*> getAllLoops();
+
  private:
   EventLoop* base_loop_;
   bool started_;
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_request.h"
+#include "http_response.h"
+#include "timestamp.h"
+
+class Buffer;
+
+/**
+ * Incremental HTTP/1.x request parser, one per connection
+ *
+ * parse() is called each time input arrives and never copies the request out
+ * of the Buffer. Until a request is complete only offsets relative to
+ * Buffer::peek() are kept, since the Buffer may move its bytes when it grows.
+ * They are turned into string_views once, when the request completes. The
+ * end-of-head search resumes where the previous call stopped.
+ *
+ * Bodies are framed by Content-Length or chunked Transfer-Encoding. Chunked
+ * data is decoded into a string owned by the parser, its capacity is reused.
+ *
+ * @code
+ * while (parser.parse(buf, now) == HttpParser::Result::Complete) {
+ *   handle(parser.request());
+ *   parser.next(buf);  // pipelined requests stay in buf
+ * }
+ * @endcode
+ */
+class HttpParser {
+ public:
+  enum class Result { Incomplete, Complete, Error };
+
+  static const size_t DefaultMaxHeaderSize = 64 * 1024;
+  static const size_t DefaultMaxBodySize = 64 * 1024 * 1024;
+  /* Longest chunk-size line, extensions included */
+  static const size_t MaxChunkLineSize = 1024;
+
+  explicit HttpParser(size_t max_header_size = DefaultMaxHeaderSize,
+                      size_t max_body_size = DefaultMaxBodySize);
+
+  // default copy/assignment are Okay, a parser holds no view until complete
+
+  /* Parse as much of @buf as possible, input is not consumed */
+  Result parse(Buffer* buf, Timestamp receive_time);
+
+  /* Valid after parse() returned Complete, until next() */
+  const HttpRequest& request() const { return request_; }
+
+  /* Drop the completed request from @buf and get ready for the next one */
+  void next(Buffer* buf);
+
+  /* The status to answer with after parse() returned Error */
+  HttpResponse::StatusCode errorStatus() const { return error_status_; }
+
+ private:
+  enum class State { Head, Body, Chunks, Complete, Error };
+
+  /* [offset, offset + len) relative to Buffer::peek() */
+  struct Span {
+    size_t offset = 0;
+    size_t len = 0;
+  };
+
+  Result parseHead(const char* base, size_t readable);
+
+  /* The request line and header fields, [base, base + head_len_) */
+  Result parseHeaderFields(const char* base);
+
+  Result parseChunks(const char* base, size_t readable);
+
+  Result fail(HttpResponse::StatusCode status);
+
+  /* Resolve the spans into request_ */
+  Result complete(const char* base);
+
+  size_t max_header_size_;
+  size_t max_body_size_;
+  State state_;
+  HttpResponse::StatusCode error_status_;
+  /* Bytes already searched for the end of head */
+  size_t scanned_;
+  size_t head_len_;
+  size_t content_length_;
+  bool chunked_;
+  /* Start of the next chunk-size line */
+  size_t chunk_pos_;
+  /* Head + body + trailers, consumed by next() */
+  size_t request_len_;
+
+  Span method_;
+  Span path_;
+  Span query_;
+  std::vector<std::pair<Span, Span>> header_spans_;
+  std::string chunked_body_;
+  HttpRequest request_;
+};
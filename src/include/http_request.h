@@ -0,0 +1,100 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "timestamp.h"
+
+/**
+ * A parsed HTTP/1.x request
+ *
+ * Filled in by HttpParser. Every string_view points into the connection's
+ * input Buffer (or, for a chunked body, into the parser's decode buffer), so
+ * a request is only valid during the HttpCallback it is passed to. Copy what
+ * must outlive it.
+ */
+class HttpRequest {
+ public:
+  enum class Method { Invalid, Get, Head, Post, Put, Delete, Options, Patch };
+
+  enum class Version { Unknown, Http10, Http11 };
+
+  using Header = std::pair<std::string_view, std::string_view>;
+
+  HttpRequest()
+      : method_(Method::Invalid), version_(Version::Unknown), keep_alive_(false) {}
+
+  Method method() const { return method_; }
+
+  /* As sent, e.g. "GET" */
+  std::string_view methodString() const { return method_str_; }
+
+  Version version() const { return version_; }
+
+  /* Request target without the query, e.g. "/index.html" */
+  std::string_view path() const { return path_; }
+
+  /* After '?', empty if none */
+  std::string_view query() const { return query_; }
+
+  /* In the order received, field names are not case folded */
+  const std::vector<Header>& headers() const { return headers_; }
+
+  /**
+   * Value of the first header named @field, compared case-insensitively
+   * @return empty if absent
+   */
+  std::string_view getHeader(std::string_view field) const;
+
+  std::string_view body() const { return body_; }
+
+  /* Whether the connection persists after the response */
+  bool keepAlive() const { return keep_alive_; }
+
+  Timestamp receiveTime() const { return receive_time_; }
+
+  /* Parse the request method token */
+  static Method parseMethod(std::string_view method);
+
+  static bool equalsIgnoreCase(std::string_view l, std::string_view r);
+
+  /* @item and its parameters after ';', both trimmed */
+  using ListItemMatch =
+      std::function<bool(std::string_view item, std::string_view params)>;
+
+  /**
+   * Whether the comma separated list @value, e.g. of Accept-Encoding, has an
+   * item accepted by @match
+   */
+  static bool anyListItem(std::string_view value, const ListItemMatch& match);
+
+  /**
+   * Whether the comma separated list @value, e.g. of Connection, has
+   * @token, compared case-insensitively
+   */
+  static bool hasToken(std::string_view value, std::string_view token);
+
+ private:
+  friend class HttpParser;
+
+  /* Keeps the capacity of headers_ for the next request */
+  void reset() {
+    method_ = Method::Invalid;
+    version_ = Version::Unknown;
+    keep_alive_ = false;
+    method_str_ = path_ = query_ = body_ = std::string_view();
+    headers_.clear();
+  }
+
+  Method method_;
+  Version version_;
+  bool keep_alive_;
+  std::string_view method_str_;
+  std::string_view path_;
+  std::string_view query_;
+  std::vector<Header> headers_;
+  std::string_view body_;
+  Timestamp receive_time_;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "slice.h"
+#include "stream_producer.h"
+
+class Buffer;
+
+/**
+ * An HTTP/1.1 response filled in by HttpCallback
+ *
+ * Extra headers are serialized as they are added, into one string whose
+ * capacity is reused. Status lines are string literals, see statusLine().
+ * A Slice body is queued on the connection by reference, a string body is
+ * copied next to the head.
+ */
+class HttpResponse {
+ public:
+  enum class StatusCode {
+    Unknown = 0,
+    SwitchingProtocols = 101,
+    Ok = 200,
+    Created = 201,
+    NoContent = 204,
+    MovedPermanently = 301,
+    Found = 302,
+    NotModified = 304,
+    BadRequest = 400,
+    Forbidden = 403,
+    NotFound = 404,
+    MethodNotAllowed = 405,
+    LengthRequired = 411,
+    PayloadTooLarge = 413,
+    UriTooLong = 414,
+    HeaderFieldsTooLarge = 431,
+    InternalServerError = 500,
+    NotImplemented = 501,
+    ServiceUnavailable = 503,
+    VersionNotSupported = 505,
+  };
+
+  explicit HttpResponse(bool close_connection)
+      : status_code_(StatusCode::Ok), close_connection_(close_connection) {}
+
+  void setStatusCode(StatusCode code) { status_code_ = code; }
+
+  StatusCode statusCode() const { return status_code_; }
+
+  void setCloseConnection(bool on) { close_connection_ = on; }
+
+  bool closeConnection() const { return close_connection_; }
+
+  void setContentType(std::string_view content_type) {
+    addHeader("Content-Type", content_type);
+  }
+
+  /* Content-Length, Connection and Date are added by appendHead() */
+  void addHeader(std::string_view field, std::string_view value);
+
+  /* Headers already serialized as "Field: value\r\n" lines */
+  void addRawHeaders(std::string_view lines) { headers_.append(lines); }
+
+  /**
+   * Same as above, but @lines is shared instead of copied into this response,
+   * e.g. the precomputed headers of a cached response
+   */
+  void setRawHeaders(const Slice& lines) { raw_headers_ = lines; }
+
+  void setBody(std::string&& body) {
+    body_ = std::move(body);
+    body_slice_ = Slice();
+  }
+
+  void setBody(std::string_view body) {
+    body_.assign(body.data(), body.size());
+    body_slice_ = Slice();
+  }
+
+  /* Queued by reference, e.g. a cached file */
+  void setBody(const Slice& body) {
+    body_.clear();
+    body_slice_ = body;
+  }
+
+  std::string_view body() const {
+    return body_slice_.empty() ? std::string_view(body_) : body_slice_.view();
+  }
+
+  const Slice& bodySlice() const { return body_slice_; }
+
+  /**
+   * Stream the body from @producer, see TcpConnection::stream()
+   * With @content_length < 0 the body is sent chunked, or delimited by the
+   * end of the connection if the response closes it
+   */
+  void setBodyProducer(const std::shared_ptr<StreamProducer>& producer,
+                       ssize_t content_length = -1) {
+    body_.clear();
+    body_slice_ = Slice();
+    producer_ = producer;
+    content_length_ = content_length;
+  }
+
+  const std::shared_ptr<StreamProducer>& bodyProducer() const {
+    return producer_;
+  }
+
+  /* Whether the streamed body uses chunked transfer coding */
+  bool chunked() const {
+    return producer_ && content_length_ < 0 && !close_connection_;
+  }
+
+  /* 1xx, 204 and 304 responses have neither body nor Content-Length */
+  bool bodyAllowed() const;
+
+  /**
+   * Serialize status line and headers into @output
+   * The body, if any, follows separately
+   */
+  void appendHead(Buffer* output) const;
+
+  /* Status line and headers, then the body copied into @output */
+  void appendToBuffer(Buffer* output) const;
+
+  /* e.g. "HTTP/1.1 200 OK\r\n" */
+  static std::string_view statusLine(StatusCode code);
+
+ private:
+  StatusCode status_code_;
+  bool close_connection_;
+  std::string headers_;
+  Slice raw_headers_;
+  std::string body_;
+  Slice body_slice_;
+  std::shared_ptr<StreamProducer> producer_;
+  ssize_t content_length_ = -1;
+};
+
+/**
+ * Frames the chunks of another producer with HTTP/1.1 chunked coding
+ *
+ * Chunk data is passed through by reference, only the size lines are
+ * formatted. A size line carries the CRLF closing the previous chunk.
+ */
+class HttpChunkedProducer : public StreamProducer {
+ public:
+  explicit HttpChunkedProducer(const std::shared_ptr<StreamProducer>& body)
+      : body_(body), started_(false), finished_(false) {}
+
+  State produce(size_t max_bytes, Slice* chunk) override;
+
+ private:
+  std::shared_ptr<StreamProducer> body_;
+  /* Data of the chunk whose size line was just produced */
+  Slice data_;
+  bool started_;
+  bool finished_;
+};
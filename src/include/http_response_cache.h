@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "macro.h"
+#include "slice.h"
+
+class HttpRequest;
+class HttpResponse;
+
+/**
+ * Size-bounded LRU cache of fully prepared HttpServer responses
+ *
+ * An entry is immutable once built. Its headers, body and optional gzip
+ * variant are refcounted Slices, so serving a hit shares the bytes with the
+ * connection's output queue instead of copying them, and an entry evicted
+ * while being written is freed after the last write.
+ *
+ * Entries are keyed by request path and query. The variant is picked by
+ * Accept-Encoding, hence "Vary: Accept-Encoding" in the headers of entries
+ * that have one. Conditional requests whose If-None-Match matches the ETag
+ * are answered with 304 and no body.
+ *
+ * The cache is split into shards by key hash, each with its own lock and LRU
+ * list, so loops serving different keys rarely contend. Thread safe.
+ */
+class HttpResponseCache {
+ public:
+  struct Entry {
+    /* Quoted strong validators, gzip_etag is empty without a gzip variant */
+    std::string etag;
+    std::string gzip_etag;
+    /* Serialized header lines of each variant, Content-Length excluded */
+    Slice headers;
+    Slice gzip_headers;
+    /* Headers of a 304, without representation metadata */
+    Slice not_modified_headers;
+    Slice gzip_not_modified_headers;
+    Slice body;
+    /* Empty without a gzip variant */
+    Slice gzip_body;
+
+    size_t charge() const {
+      return headers.size() + gzip_headers.size() +
+             not_modified_headers.size() + gzip_not_modified_headers.size() +
+             body.size() + gzip_body.size();
+    }
+  };
+
+  using EntryPtr = std::shared_ptr<const Entry>;
+
+  static const int DefaultShards = 16;
+
+  explicit HttpResponseCache(size_t capacity_bytes,
+                             int num_shards = DefaultShards);
+
+  DISALLOW_COPY(HttpResponseCache);
+
+  /**
+   * Precompute an entry, ETags are derived from the content
+   * @gzip_body is the same representation compressed, empty if none
+   * @cache_control e.g. "max-age=60", empty for none
+   */
+  static EntryPtr makeEntry(std::string_view content_type, std::string&& body,
+                            std::string&& gzip_body = std::string(),
+                            std::string_view cache_control = std::string_view());
+
+  /* Insert or replace, least recently used entries are evicted to fit */
+  void put(std::string_view key, EntryPtr entry);
+
+  /* nullptr on miss, a hit becomes the most recently used */
+  EntryPtr get(std::string_view key);
+
+  void erase(std::string_view key);
+
+  /**
+   * Fill @response for @request (GET or HEAD) from the cache
+   * @return false on miss, @response is untouched
+   */
+  bool serve(const HttpRequest& request, HttpResponse* response);
+
+  /* Build the cache key of @request, path and query */
+  static std::string_view keyOf(const HttpRequest& request);
+
+  size_t bytes() const;
+
+  uint64_t hits() const { return hits_; }
+
+  uint64_t misses() const { return misses_; }
+
+ private:
+  /**
+   * One LRU, the most recently used node first. index keys are views of
+   * Node::key, which doesn't move while the node is in the list
+   */
+  struct Shard {
+    struct Node {
+      std::string key;
+      EntryPtr entry;
+    };
+
+    std::mutex mutex;
+    std::list<Node> lru;
+    std::unordered_map<std::string_view, std::list<Node>::iterator> index;
+    size_t bytes = 0;
+  };
+
+  Shard& shardOf(std::string_view key);
+
+  /* Drop the least recently used until @shard fits. Locked */
+  void evict(Shard* shard);
+
+  const size_t shard_capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "http_parser.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "http_response_cache.h"
+#include "macro.h"
+#include "tcp_server.h"
+#include "websocket_codec.h"
+
+/**
+ * HTTP/1.1 server on top of TcpServer
+ *
+ * Persistent connections are kept unless the request or the handler asks for
+ * close. Pipelined requests are answered in order: every request already in
+ * the input Buffer is handled, and their responses are written together with
+ * one send. Responses with a Slice body at least CopyThreshold bytes long are
+ * queued by reference instead of being copied.
+ *
+ * A response with a body producer is streamed, see TcpConnection::stream().
+ * Requests pipelined behind it are held until the stream completes.
+ *
+ * A 101 response, see WebSocketCodec::acceptUpgrade(), switches the
+ * connection to WebSocket: its input goes to a WebSocketCodec from then on.
+ */
+class HttpServer {
+ public:
+  using HttpCallback = std::function<void(const HttpRequest&, HttpResponse*)>;
+
+  /* Smaller Slice bodies are copied next to the head, saving an iovec */
+  static const size_t CopyThreshold = 4096;
+
+  HttpServer(EventLoop* loop, const InetAddress& listen_addr);
+
+  DISALLOW_COPY(HttpServer);
+
+  /* Not thread safe, call it before start() */
+  void setHttpCallback(const HttpCallback& cb) { http_cb_ = cb; }
+
+  /* Not thread safe, call it before start() */
+  void setLimits(size_t max_header_size, size_t max_body_size) {
+    max_header_size_ = max_header_size;
+    max_body_size_ = max_body_size;
+  }
+
+  /**
+   * GET and HEAD requests are answered from @cache when it has the path,
+   * HttpCallback is not called then. @cache must outlive the server
+   */
+  void setResponseCache(HttpResponseCache* cache) { cache_ = cache; }
+
+  /**
+   * Handle upgraded connections. @conn_cb runs once the 101 response is
+   * sent and again when the connection goes down, @message_cb gets every
+   * message. Not thread safe, call it before start()
+   */
+  void setWebSocketCallback(const ConnectionCallback& conn_cb,
+                            const WebSocketCodec::MessageCallback& message_cb) {
+    ws_conn_cb_ = conn_cb;
+    ws_message_cb_ = message_cb;
+  }
+
+  void setThreadNum(int num_threads) { server_.setThreadNum(num_threads); }
+
+  TcpServer& tcpServer() { return server_; }
+
+  void start();
+
+ private:
+  void onConnection(const TcpConnectionPtr& conn);
+
+  void onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                 Timestamp recv_time);
+
+  /**
+   * Append @response to @output, large Slice bodies are sent by reference
+   * @return true if the body must be streamed by startStream()
+   */
+  bool appendResponse(const TcpConnectionPtr& conn, const HttpRequest& request,
+                      const HttpResponse& response, Buffer* output);
+
+  /* Send @output, then stream the body of @response */
+  void startStream(const TcpConnectionPtr& conn, const HttpResponse& response,
+                   Buffer* output);
+
+  void onStreamComplete(const TcpConnectionPtr& conn, bool ok, bool close);
+
+  /* Replace the HttpParser of @conn with a WebSocketCodec */
+  void upgrade(const TcpConnectionPtr& conn, Buffer* buf, Timestamp recv_time);
+
+  void onWebSocketMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                          Timestamp recv_time);
+
+  TcpServer server_;
+  HttpCallback http_cb_;
+  HttpResponseCache* cache_;
+  size_t max_header_size_;
+  size_t max_body_size_;
+  ConnectionCallback ws_conn_cb_;
+  WebSocketCodec::MessageCallback ws_message_cb_;
+};
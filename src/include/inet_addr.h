@@ -1,23 +1,30 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <string>
 
 /**
- * Wrapper of sockaddr_in
+ * Socket address: IPv4, IPv6, or a unix domain socket
+ *
+ * Held inline in a union of the sockaddr types, so it is copied like a value
+ * and handed to the socket calls as is. Unix domain sockets may live in the
+ * filesystem or, on Linux, in the abstract namespace.
  */
 class InetAddress {
  public:
   /**
-   * Constructs an endpoint with given port number.
+   * Constructs an endpoint with given port number, on any IPv4 address, or
+   * any IPv6 address if @ipv6 (which takes IPv4 too unless IPV6_V6ONLY).
    * Mostly used in TcpServer listening.
    */
-  explicit InetAddress(uint16_t port);
+  explicit InetAddress(uint16_t port, bool ipv6 = false);
 
   /**
    * Constructs an endpoint with given ip and port.
-   * @c ip should be "1.2.3.4"
+   * @c ip should be "1.2.3.4" or "::1"
    */
   InetAddress(const std::string& ip, uint16_t port);
 
@@ -25,16 +32,61 @@ class InetAddress {
    * Constructs an endpoint with given struct @c sockaddr_in
    * Mostly used when accepting new connections
    */
-  InetAddress(const struct sockaddr_in& addr) : addr_(addr) {}
+  InetAddress(const struct sockaddr_in& addr);
 
+  InetAddress(const struct sockaddr_in6& addr);
+
+  /* @len bytes of @addr, as filled in by accept(2) or getsockname(2) */
+  InetAddress(const struct sockaddr* addr, socklen_t len);
+
+  /**
+   * Unix domain socket at @path, or in the abstract namespace if @path
+   * starts with '@', e.g. "@proxy.sock"
+   */
+  static InetAddress fromUnixPath(const std::string& path);
+
+  /**
+   * "1.2.3.4:80", "[::1]:80", the path of a unix domain socket, "@name" for
+   * the abstract namespace, or "unix" for an unnamed one (a connecting peer)
+   */
   std::string toHostPort() const;
 
   // default copy/assignment are Okay
 
-  const struct sockaddr_in& getSockAddrInet() const { return addr_; }
+  sa_family_t family() const { return addr_.sa.sa_family; }
+
+  bool isUnix() const { return family() == AF_UNIX; }
+
+  /* In host order, 0 for unix domain sockets */
+  uint16_t port() const;
 
-  void setSockAddrInet(const struct sockaddr_in& addr) { addr_ = addr; }
+  const struct sockaddr* getSockAddr() const { return &addr_.sa; }
+
+  socklen_t getSockLen() const { return len_; }
+
+  /* IPv4 only */
+  const struct sockaddr_in& getSockAddrInet() const { return addr_.in; }
+
+  void setSockAddrInet(const struct sockaddr_in& addr);
+
+  /**
+   * Let accept(2) fill the address in: pass getMutableSockAddr() and a
+   * length of Capacity, then setSockLen() with what it returned
+   */
+  static const socklen_t Capacity;
+
+  struct sockaddr* getMutableSockAddr() { return &addr_.sa; }
+
+  void setSockLen(socklen_t len) { len_ = len; }
 
  private:
-  struct sockaddr_in addr_;
+  InetAddress() : len_(0) {}
+
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+    struct sockaddr_un un;
+  } addr_;
+  socklen_t len_;
 };
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string_view>
+
+#include "callbacks.h"
+#include "macro.h"
+#include "tcp_connection.h"
+
+/**
+ * Codec of 4-byte big-endian length-prefixed frames
+ *
+ * @code
+ * +----------------+------------------------+
+ * | len (int32_t)  |  body (len bytes)      |
+ * +----------------+------------------------+
+ * @endcode
+ *
+ * Register onMessage() as the MessageCallback of TcpServer, complete frames
+ * are then delivered to FrameCallback as views into the input Buffer.
+ */
+class LengthHeaderCodec {
+ public:
+  /**
+   * @frame points into the input Buffer and is only valid during the call
+   */
+  using FrameCallback = std::function<void(
+      const TcpConnectionPtr&, std::string_view frame, Timestamp recv_time)>;
+
+  static const size_t HeaderLen = sizeof(int32_t);
+  static const size_t DefaultMaxFrameSize = 64 * 1024 * 1024;
+
+  explicit LengthHeaderCodec(const FrameCallback& cb,
+                             size_t max_frame_size = DefaultMaxFrameSize)
+      : frame_cb_(cb), max_frame_size_(max_frame_size) {}
+
+  DISALLOW_COPY(LengthHeaderCodec);
+
+  /**
+   * MessageCallback of TcpConnection
+   *
+   * Delivers every complete frame in @buf before returning. A frame longer
+   * than max_frame_size_ shuts the connection down
+   */
+  void onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                 Timestamp recv_time);
+
+  /**
+   * Prepend the length header to the readable bytes of @body
+   *
+   * The header goes into the prependable area of @body, the body itself is
+   * not copied
+   */
+  static void encode(Buffer* body);
+
+  /**
+   * Encode @body and send it through @conn
+   *
+   * A body longer than max_frame_size_, which the peer would reject, is
+   * logged and dropped, @body is left as it was
+   * @return false if @body was dropped
+   */
+  bool send(const TcpConnectionPtr& conn, Buffer* body) const;
+
+  size_t maxFrameSize() const { return max_frame_size_; }
+
+ private:
+  FrameCallback frame_cb_;
+  const size_t max_frame_size_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <assert.h>
+#include <string.h>
 
 #include <string>
 
@@ -46,6 +47,8 @@ class LogStream {
  public:
   typedef FixedBuffer<kSmallBuffer> Buffer;
 
+  LogStream() = default;
+
   DISALLOW_COPY(LogStream);
 
   LogStream& operator<<(bool v) {
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "callbacks.h"
+#include "macro.h"
+#include "timer_id.h"
+
+class ConnectionRegistry;
+class EventLoop;
+
+/* Bytes of Buffer memory, 0 means unlimited */
+struct MemoryLimits {
+  /* Stop reading from the largest consumers */
+  size_t soft_limit = 0;
+  /* Refuse new connections, close the largest consumers */
+  size_t hard_limit = 0;
+
+  bool limited() const { return soft_limit > 0 || hard_limit > 0; }
+};
+
+/**
+ * Process-wide accountant of connection Buffer memory
+ *
+ * Fed by the MemoryAccount of every I/O loop, so one budget shared by all
+ * servers of the process bounds their sum. Thread safe, a charge is one
+ * relaxed atomic add.
+ */
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(const MemoryLimits& limits) : limits_(limits) {}
+
+  DISALLOW_COPY(MemoryBudget);
+
+  const MemoryLimits& limits() const { return limits_; }
+
+  size_t used() const { return used_.load(std::memory_order_relaxed); }
+
+  void charge(int64_t delta) {
+    used_.fetch_add(static_cast<size_t>(delta), std::memory_order_relaxed);
+  }
+
+  bool overSoftLimit() const {
+    return limits_.soft_limit > 0 && used() >= limits_.soft_limit;
+  }
+
+  bool overHardLimit() const {
+    return limits_.hard_limit > 0 && used() >= limits_.hard_limit;
+  }
+
+  /* Counters of the actions taken, for monitoring */
+  uint64_t readsPaused() const {
+    return reads_paused_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t connectionsRejected() const {
+    return connections_rejected_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t connectionsClosed() const {
+    return connections_closed_.load(std::memory_order_relaxed);
+  }
+
+  void notePausedRead() {
+    reads_paused_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void noteRejected() {
+    connections_rejected_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void noteClosed() {
+    connections_closed_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  const MemoryLimits limits_;
+  std::atomic<size_t> used_{0};
+  std::atomic<uint64_t> reads_paused_{0};
+  std::atomic<uint64_t> connections_rejected_{0};
+  std::atomic<uint64_t> connections_closed_{0};
+};
+
+/**
+ * Buffer memory of the connections of one EventLoop
+ *
+ * Each connection charges the growth and shrink of its footprint, see
+ * TcpConnection::memoryFootprint(), to this account and the process-wide
+ * budget. A charge that crosses a soft or hard limit, of this loop or of
+ * the process, arms a check of the connections of this loop:
+ * 1. Over a soft limit, reading pauses on the largest consumers, enough of
+ *    them to cover the excess, and resumes once usage is back below 7/8 of
+ *    the soft limits.
+ * 2. Over a hard limit, the largest consumers are closed until the excess is
+ *    covered.
+ * The check repeats every CheckInterval while anything is paused or over a
+ * limit, and costs nothing otherwise. Destroyed in the loop thread, which
+ * cancels the check.
+ */
+class MemoryAccount {
+ public:
+  static constexpr double CheckInterval = 0.01;
+
+  /**
+   * @connections are the ones of @loop. The account only keeps a weak_ptr,
+   * connections hold it and may outlive their server, it stops checking
+   * once @connections is gone
+   */
+  MemoryAccount(EventLoop* loop,
+                const std::shared_ptr<const ConnectionRegistry>& connections,
+                const std::shared_ptr<MemoryBudget>& budget,
+                const MemoryLimits& per_loop);
+
+  DISALLOW_COPY(MemoryAccount);
+
+  ~MemoryAccount();
+
+  EventLoop* getLoop() const { return loop_; }
+
+  const std::shared_ptr<MemoryBudget>& budget() const { return budget_; }
+
+  /* Bytes used by connections of this loop. In loop thread */
+  size_t used() const { return used_; }
+
+  /* A footprint changed by @delta bytes. In loop thread */
+  void charge(int64_t delta) {
+    used_ += static_cast<size_t>(delta);
+    budget_->charge(delta);
+    if (delta > 0 && !check_armed_ && (overSoftLimit() || overHardLimit())) {
+      armCheck();
+    }
+  }
+
+  bool overSoftLimit() const {
+    return (limits_.soft_limit > 0 && used_ >= limits_.soft_limit) ||
+           budget_->overSoftLimit();
+  }
+
+  bool overHardLimit() const {
+    return (limits_.hard_limit > 0 && used_ >= limits_.hard_limit) ||
+           budget_->overHardLimit();
+  }
+
+ private:
+  using Consumer = std::pair<size_t, TcpConnectionPtr>;
+
+  void armCheck();
+
+  void onCheck();
+
+  /* Bytes over @limit of this loop or the process, 0 if neither is */
+  size_t excessOver(size_t loop_limit, size_t process_limit) const;
+
+  /* Open ones of @connections, largest footprint first */
+  void collectConsumers(const ConnectionRegistry& connections);
+
+  /* Below 7/8 of the soft limits, paused connections may read again */
+  bool belowResumeMark() const;
+
+  EventLoop* loop_;
+  const std::weak_ptr<const ConnectionRegistry> connections_;
+  std::shared_ptr<MemoryBudget> budget_;
+  const MemoryLimits limits_;
+  size_t used_;
+  bool check_armed_;
+  TimerId check_timer_;
+  /* Connections whose reading this account paused */
+  std::vector<std::weak_ptr<TcpConnection>> paused_;
+  /* Reused by collectConsumers() */
+  std::vector<Consumer> consumers_;
+};
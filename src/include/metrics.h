@@ -0,0 +1,202 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+
+class Metric;
+
+/**
+ * Process-wide registry of metrics, scraped in the Prometheus text format
+ *
+ * A thread that updates a metric gets its own block of cells, written by
+ * that thread only: an update is a thread_local load, a relaxed load and a
+ * relaxed store, with no lock, no atomic read-modify-write and no cache line
+ * shared with other writers. A scrape sums the cells of all threads, plus
+ * those of the threads that exited, so updates cost the same whether or
+ * not anybody scrapes.
+ */
+class MetricsRegistry {
+ public:
+  /* Cells of all metrics together, each thread holds a block this large */
+  static const size_t MaxCells = 1024;
+
+  static MetricsRegistry& instance();
+
+  DISALLOW_COPY(MetricsRegistry);
+
+  /* Every metric in the text exposition format 0.0.4. Thread safe */
+  std::string scrape();
+
+  /* Cells of the calling thread, attached on its first update */
+  static std::atomic<uint64_t>* threadCells() {
+    ThreadCells* cells = thread_cells_;
+    return cells ? cells->cells : instance().attachThread()->cells;
+  }
+
+ private:
+  friend class Metric;
+
+  struct ThreadCells {
+    ThreadCells();
+
+    std::atomic<uint64_t> cells[MaxCells];
+  };
+
+  /* Folds the cells of an exiting thread into retired_ */
+  class ThreadExit;
+
+  MetricsRegistry();
+
+  /**
+   * Reserve @count cells for @metric, the last @double_count of them hold
+   * the bits of a double rather than an integer
+   * @return the first cell
+   */
+  size_t add(Metric* metric, size_t count, size_t double_count);
+
+  /* Cells of @metric are not reused */
+  void remove(Metric* metric);
+
+  ThreadCells* attachThread();
+
+  void detachThread(ThreadCells* cells);
+
+  /* Over all threads, with mutex_ held */
+  uint64_t sum(size_t cell) const;
+
+  double sumDouble(size_t cell) const;
+
+  static inline thread_local ThreadCells* thread_cells_ = nullptr;
+
+  std::mutex mutex_;
+  std::vector<Metric*> metrics_;
+  std::vector<ThreadCells*> threads_;
+  /* Left by exited threads */
+  ThreadCells retired_;
+  std::vector<bool> double_cells_;
+  size_t next_cell_;
+};
+
+/**
+ * A named metric owning a range of cells in every thread
+ *
+ * Usually a static object of the module it instruments. Names follow the
+ * Prometheus conventions, e.g. a counter ends in "_total".
+ */
+class Metric {
+ public:
+  DISALLOW_COPY(Metric);
+
+  virtual ~Metric();
+
+  const std::string& name() const { return name_; }
+
+ protected:
+  Metric(const std::string& name, const std::string& help, const char* type,
+         size_t cell_count, size_t double_count = 0);
+
+  /* Cell @i of this metric, of the calling thread */
+  std::atomic<uint64_t>& cell(size_t i) const {
+    return MetricsRegistry::threadCells()[first_cell_ + i];
+  }
+
+  /* Only the owning thread writes a cell, no read-modify-write needed */
+  static void addTo(std::atomic<uint64_t>& cell, uint64_t n) {
+    cell.store(cell.load(std::memory_order_relaxed) + n,
+               std::memory_order_relaxed);
+  }
+
+  /* Cell @i summed over all threads, in collect() */
+  uint64_t sum(size_t i) const;
+
+  /* Same as above, anywhere else */
+  uint64_t total(size_t i) const;
+
+  double sumDouble(size_t i) const;
+
+  /* Append "name value" lines after the HELP and TYPE lines */
+  virtual void collect(std::string* out) const = 0;
+
+  static void appendSample(std::string* out, const std::string& name,
+                           const char* suffix, const char* labels,
+                           double value);
+
+ private:
+  friend class MetricsRegistry;
+
+  MetricsRegistry* registry_;
+  const std::string name_;
+  const std::string help_;
+  const char* type_;
+  size_t first_cell_;
+};
+
+/* Monotonic count, e.g. of accepted connections */
+class Counter : public Metric {
+ public:
+  Counter(const std::string& name, const std::string& help)
+      : Metric(name, help, "counter", 1) {}
+
+  void inc(uint64_t n = 1) { addTo(cell(0), n); }
+
+  uint64_t value() const { return total(0); }
+
+ protected:
+  void collect(std::string* out) const override;
+};
+
+/**
+ * A level changed by increments and decrements, e.g. open connections
+ *
+ * The merged value is the sum of the changes made by all threads, so one
+ * thread may inc() what another dec()s. There is no set(), a level set by
+ * one thread couldn't be merged with the others.
+ */
+class Gauge : public Metric {
+ public:
+  Gauge(const std::string& name, const std::string& help)
+      : Metric(name, help, "gauge", 1) {}
+
+  void add(int64_t n) { addTo(cell(0), static_cast<uint64_t>(n)); }
+
+  void inc() { add(1); }
+
+  void dec() { add(-1); }
+
+  int64_t value() const { return static_cast<int64_t>(total(0)); }
+
+ protected:
+  void collect(std::string* out) const override;
+};
+
+/**
+ * Distribution over fixed buckets, e.g. of latencies in seconds
+ *
+ * A bucket counts the observations at most its upper bound, one more bucket
+ * takes the rest (+Inf). Observations are counted per bucket and made
+ * cumulative on scrape.
+ */
+class Histogram : public Metric {
+ public:
+  /* @bounds are the upper bounds of the buckets, ascending */
+  Histogram(const std::string& name, const std::string& help,
+            const std::vector<double>& bounds);
+
+  /* @count bounds from @start, each @factor times the previous */
+  static std::vector<double> exponentialBuckets(double start, double factor,
+                                                size_t count);
+
+  void observe(double value);
+
+ protected:
+  void collect(std::string* out) const override;
+
+ private:
+  const std::vector<double> bounds_;
+};
@@ -1,3 +1,7 @@
+#pragma once
+
+#include <poll.h>
+
 #include <map>
 #include <vector>
 
@@ -5,8 +9,6 @@
 #include "macro.h"
 #include "timestamp.h"
 
-struct pollfd;
-
 class Channel;
 
 /**
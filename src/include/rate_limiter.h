@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "callbacks.h"
+#include "macro.h"
+#include "timer_id.h"
+
+class EventLoop;
+
+/* Rates in bytes per second, 0 means unlimited */
+struct RateLimit {
+  double ingress_rate = 0;
+  double ingress_burst = 0;
+  double egress_rate = 0;
+  double egress_burst = 0;
+
+  bool limited() const { return ingress_rate > 0 || egress_rate > 0; }
+};
+
+/**
+ * Token bucket, refilled lazily from the caller's clock
+ *
+ * A refill is a few arithmetic operations and needs no timer. Tokens may go
+ * negative: a read or write is charged after the fact, and the debt is paid
+ * back before the bucket is available again, so the long run rate holds.
+ */
+class TokenBucket {
+ public:
+  TokenBucket() : rate_(0), burst_(0), tokens_(0), last_us_(0) {}
+
+  /* Starts full, @burst defaults to one second worth of @rate */
+  TokenBucket(double rate, double burst)
+      : rate_(rate),
+        burst_(burst > 0 ? burst : rate),
+        tokens_(burst_),
+        last_us_(0) {}
+
+  bool limited() const { return rate_ > 0; }
+
+  void refill(int64_t now_us) {
+    if (limited() && now_us > last_us_) {
+      if (last_us_ != 0) {
+        tokens_ = std::min(burst_, tokens_ + (now_us - last_us_) * rate_ / 1e6);
+      }
+      last_us_ = now_us;
+    }
+  }
+
+  void consume(size_t bytes) {
+    if (limited()) {
+      tokens_ -= static_cast<double>(bytes);
+    }
+  }
+
+  bool available() const { return !limited() || tokens_ > 0; }
+
+  double tokens() const { return tokens_; }
+
+ private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  int64_t last_us_;
+};
+
+/**
+ * Token buckets shared by the connections of one EventLoop, and the refill
+ * tick of the connections that ran out
+ *
+ * Each connection charges its own buckets and the loop-wide ones for every
+ * read and write, see TcpConnection::setRateLimiter(). One that runs dry
+ * pauses reading or writing and is put on the throttled list. A single loop
+ * timer, armed only while the list is non-empty, refills them every
+ * RefillInterval, so there is no per-connection timer and an idle limiter
+ * costs nothing. Destroyed in the loop thread, which cancels the timer.
+ */
+class RateLimiter {
+ public:
+  static constexpr double RefillInterval = 0.005;
+
+  RateLimiter(EventLoop* loop, const RateLimit& per_connection,
+              const RateLimit& per_loop);
+
+  DISALLOW_COPY(RateLimiter);
+
+  ~RateLimiter();
+
+  EventLoop* getLoop() const { return loop_; }
+
+  /* Default buckets of each connection */
+  const RateLimit& perConnection() const { return per_connection_; }
+
+  /* Loop-wide buckets, only touched in the loop thread */
+  TokenBucket& ingress() { return ingress_; }
+
+  TokenBucket& egress() { return egress_; }
+
+  /**
+   * @conn ran out of tokens, refill it on the next tick until it is running
+   * again. In loop thread
+   */
+  void throttle(const TcpConnectionPtr& conn);
+
+  size_t throttledCount() const { return throttled_.size(); }
+
+ private:
+  void onTick();
+
+  EventLoop* loop_;
+  const RateLimit per_connection_;
+  TokenBucket ingress_;
+  TokenBucket egress_;
+  std::vector<std::weak_ptr<TcpConnection>> throttled_;
+  /* Swapped with throttled_ on each tick, keeps its capacity */
+  std::vector<std::weak_ptr<TcpConnection>> refilling_;
+  bool timer_armed_;
+  TimerId timer_;
+};
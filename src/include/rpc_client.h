@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "macro.h"
+#include "rpc_codec.h"
+#include "tcp_client.h"
+#include "timer_id.h"
+
+/**
+ * Client stub of RpcServer, many calls in flight on one connection
+ *
+ * A call takes a slot of the pending table, its request id is the slot index
+ * plus a generation that tells a late response from the slot's next call.
+ * Deadlines sit in a heap served by one timer: it is armed for the earliest
+ * deadline, at most once per DeadlineResolution, instead of once per call.
+ * A completed call leaves its deadline in the heap, the stale entry is
+ * dropped when it comes due. Once the slots, the heap and the connection's
+ * Buffers have grown, a call allocates nothing.
+ *
+ * Everything but connect() and disconnect() is called in the loop thread.
+ */
+class RpcClient {
+ public:
+  /**
+   * Runs exactly once per call, in the loop thread
+   * @response points into the input Buffer, only valid during the call.
+   * Keep captures within two pointers, so std::function stores them inline
+   */
+  using ResponseCallback =
+      std::function<void(RpcStatus status, std::string_view response)>;
+
+  static constexpr double DefaultTimeout = 1.0;
+
+  /* Deadlines are enforced within this many seconds */
+  static constexpr double DeadlineResolution = 0.01;
+
+  RpcClient(EventLoop* loop, const InetAddress& server_addr,
+            const std::string& name);
+
+  DISALLOW_COPY(RpcClient);
+
+  /**
+   * Must be called in the loop thread, pending calls fail as Unavailable and
+   * the deadline timer is canceled
+   */
+  ~RpcClient();
+
+  /* Thread safe */
+  void connect() { client_.connect(); }
+
+  /* Thread safe */
+  void disconnect() { client_.disconnect(); }
+
+  void enableRetry() { client_.enableRetry(); }
+
+  /* Not thread safe, call it before connect() */
+  void setConnectionCallback(const ConnectionCallback& cb) {
+    connection_cb_ = cb;
+  }
+
+  bool connected() const { return static_cast<bool>(conn_); }
+
+  /**
+   * Call @method with @request, @cb gets the response or a Timeout after
+   * @timeout seconds. Without a connection @cb fails as Unavailable before
+   * call() returns
+   */
+  void call(uint16_t method, std::string_view request, ResponseCallback cb,
+            double timeout = DefaultTimeout);
+
+  /* Calls waiting for their response */
+  size_t pendingCalls() const { return pending_; }
+
+  EventLoop* getLoop() const { return loop_; }
+
+ private:
+  struct Slot {
+    ResponseCallback cb;
+    /* Bumped when the call completes, see idOf() */
+    uint32_t generation = 0;
+    bool active = false;
+  };
+
+  struct Deadline {
+    Timestamp when;
+    uint64_t id;
+
+    /* Min-heap order for std::push_heap */
+    bool operator<(const Deadline& rhs) const { return rhs.when < when; }
+  };
+
+  static uint64_t idOf(uint32_t slot, uint32_t generation) {
+    return static_cast<uint64_t>(generation) << 32 | slot;
+  }
+
+  void onConnection(const TcpConnectionPtr& conn);
+
+  void onFrame(const TcpConnectionPtr& conn, const RpcHeader& header,
+               std::string_view payload, Timestamp recv_time);
+
+  /* Run the callback of call @id if it is still pending */
+  void complete(uint64_t id, RpcStatus status, std::string_view response);
+
+  /* Fail every pending call with @status */
+  void failAll(RpcStatus status);
+
+  /* Make sure a timer fires by the earliest deadline */
+  void armTimer();
+
+  void onTimer();
+
+  EventLoop* loop_;
+  TcpClient client_;
+  RpcCodec codec_;
+  ConnectionCallback connection_cb_;
+  TcpConnectionPtr conn_;
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  size_t pending_;
+  /* Min-heap, may hold entries of completed calls */
+  std::vector<Deadline> deadlines_;
+  /* When the armed timer fires, invalid if none is armed */
+  Timestamp timer_at_;
+  TimerId timer_;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string_view>
+
+#include "callbacks.h"
+#include "macro.h"
+#include "tcp_connection.h"
+
+enum class RpcStatus : uint8_t {
+  Ok = 0,
+  /* No handler is registered for the method */
+  NoMethod = 1,
+  /* The handler rejected the request */
+  BadRequest = 2,
+  /* The handler failed */
+  Error = 3,
+  /* Set by RpcClient: no response before the deadline */
+  Timeout = 4,
+  /* Set by RpcClient: not connected, or the connection was lost */
+  Unavailable = 5,
+};
+
+/* Fixed part of every RPC frame, after the length */
+struct RpcHeader {
+  enum Type : uint8_t { Request = 0, Response = 1 };
+
+  Type type;
+  RpcStatus status;
+  uint16_t method;
+  /* Chosen by the caller, echoed in the response */
+  uint64_t id;
+};
+
+/**
+ * Codec of multiplexed RPC frames, all fields big-endian
+ *
+ * @code
+ * +-----------+------+--------+--------+---------+-----------------+
+ * | len (32)  | type | status | method |  id     |  payload        |
+ * |           | (8)  | (8)    | (16)   |  (64)   |  (len - 12)     |
+ * +-----------+------+--------+--------+---------+-----------------+
+ * @endcode
+ *
+ * Many calls share one connection: every request carries an id that its
+ * response echoes, so responses may come back in any order.
+ */
+class RpcCodec {
+ public:
+  /**
+   * @payload points into the input Buffer and is only valid during the call
+   */
+  using FrameCallback =
+      std::function<void(const TcpConnectionPtr&, const RpcHeader& header,
+                         std::string_view payload, Timestamp recv_time)>;
+
+  /* Bytes after the length field that are not payload */
+  static const size_t HeaderLen = 12;
+  static const size_t DefaultMaxFrameSize = 64 * 1024 * 1024;
+
+  explicit RpcCodec(const FrameCallback& cb,
+                    size_t max_frame_size = DefaultMaxFrameSize)
+      : frame_cb_(cb), max_frame_size_(max_frame_size) {}
+
+  DISALLOW_COPY(RpcCodec);
+
+  /**
+   * MessageCallback of TcpConnection
+   *
+   * Delivers every complete frame in @buf before returning. A malformed or
+   * oversized frame shuts the connection down
+   */
+  void onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                 Timestamp recv_time);
+
+  /* Append one frame to @output */
+  static void encode(const RpcHeader& header, std::string_view payload,
+                     Buffer* output);
+
+  /**
+   * Encode one frame and send it through @conn. Thread safe
+   *
+   * In the loop thread the frame is built in a per-thread scratch Buffer and
+   * copied into the connection's output, nothing is allocated once both have
+   * grown to fit
+   */
+  static void send(const TcpConnectionPtr& conn, const RpcHeader& header,
+                   std::string_view payload);
+
+ private:
+  FrameCallback frame_cb_;
+  const size_t max_frame_size_;
+};
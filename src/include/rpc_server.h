@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "macro.h"
+#include "rpc_codec.h"
+#include "tcp_server.h"
+
+/**
+ * One request being handled, copy it to reply later
+ *
+ * Holds the connection, so a late reply is written if the connection is
+ * still up and dropped otherwise.
+ */
+class RpcCall {
+ public:
+  RpcCall(const TcpConnectionPtr& conn, uint16_t method, uint64_t id,
+          Timestamp receive_time)
+      : conn_(conn), method_(method), id_(id), receive_time_(receive_time) {}
+
+  const TcpConnectionPtr& connection() const { return conn_; }
+
+  uint16_t method() const { return method_; }
+
+  uint64_t id() const { return id_; }
+
+  Timestamp receiveTime() const { return receive_time_; }
+
+  /* Reply exactly once per call. Thread safe */
+  void reply(std::string_view response, RpcStatus status = RpcStatus::Ok) const;
+
+ private:
+  TcpConnectionPtr conn_;
+  uint16_t method_;
+  uint64_t id_;
+  Timestamp receive_time_;
+};
+
+/**
+ * Multiplexed RPC server on top of TcpServer
+ *
+ * Requests are dispatched by method number through a handler table, an
+ * index instead of a lookup. A handler may reply before it returns or keep
+ * the RpcCall and reply later, from any thread, so responses leave in
+ * whatever order they complete. Connections are auto corked: the replies to
+ * every request read in one go are written with one syscall.
+ */
+class RpcServer {
+ public:
+  /* @request points into the input Buffer, only valid during the call */
+  using Handler =
+      std::function<void(const RpcCall& call, std::string_view request)>;
+
+  RpcServer(EventLoop* loop, const InetAddress& listen_addr);
+
+  DISALLOW_COPY(RpcServer);
+
+  /* Not thread safe, call it before start() */
+  void registerMethod(uint16_t method, const Handler& handler);
+
+  void setThreadNum(int num_threads) { server_.setThreadNum(num_threads); }
+
+  TcpServer& tcpServer() { return server_; }
+
+  void start() { server_.start(); }
+
+ private:
+  void onConnection(const TcpConnectionPtr& conn);
+
+  void onFrame(const TcpConnectionPtr& conn, const RpcHeader& header,
+               std::string_view payload, Timestamp recv_time);
+
+  TcpServer server_;
+  RpcCodec codec_;
+  /* Indexed by method, empty slots are unregistered */
+  std::vector<Handler> handlers_;
+};
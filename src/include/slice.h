@@ -0,0 +1,72 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * An immutable, reference counted view of bytes
+ *
+ * Copying a Slice only bumps the refcount of its owner, so one payload can be
+ * queued on many TcpConnections without copying and is freed after the last
+ * one has written it.
+ *
+ * @code
+ * owner_: [ ........ | data_ ... data_ + len_ | ........ ]
+ * @endcode
+ */
+class Slice {
+ public:
+  Slice() : data_(nullptr), len_(0) {}
+
+  /* Take ownership of @str, its bytes are not copied */
+  explicit Slice(std::string&& str) {
+    auto owner = std::make_shared<const std::string>(std::move(str));
+    data_ = owner->data();
+    len_ = owner->size();
+    owner_ = std::move(owner);
+  }
+
+  /* Share @owner, [data, data + len) must live inside it */
+  Slice(std::shared_ptr<const void> owner, const char* data, size_t len)
+      : owner_(std::move(owner)), data_(data), len_(len) {}
+
+  /* default copy/assignment are Okay, they share the owner */
+
+  /* Copy [data, data + len) into a new owner */
+  static Slice copyFrom(const void* data, size_t len) {
+    return Slice(std::string(static_cast<const char*>(data), len));
+  }
+
+  const char* data() const { return data_; }
+
+  size_t size() const { return len_; }
+
+  bool empty() const { return len_ == 0; }
+
+  std::string_view view() const { return std::string_view(data_, len_); }
+
+  /* Drop the first @n bytes from the view, the owner is untouched */
+  void removePrefix(size_t n) {
+    assert(n <= len_);
+    data_ += n;
+    len_ -= n;
+  }
+
+  /* Drop the last @n bytes from the view, the owner is untouched */
+  void removeSuffix(size_t n) {
+    assert(n <= len_);
+    len_ -= n;
+  }
+
+  /* Number of Slices sharing the owner */
+  long useCount() const { return owner_.use_count(); }
+
+ private:
+  std::shared_ptr<const void> owner_;
+  const char* data_;
+  size_t len_;
+};
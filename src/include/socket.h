@@ -1,3 +1,7 @@
+#pragma once
+
+#include <sys/socket.h>
+
 #include "macro.h"
 class InetAddress;
 
@@ -34,6 +38,12 @@ class Socket {
   /* Enable/disable SO_REUSEADDR */
   void setReuseAddr(bool on);
 
+  /**
+   * Enable/disable SO_REUSEPORT, so that every EventLoop can bind its own
+   * socket to the same port and let the kernel balance between them
+   */
+  void setReusePort(bool on);
+
   void shutdownWrite();
 
   /**
@@ -46,6 +56,9 @@ class Socket {
    */
   void setKeepAlive(bool on);
 
+  /* Unix domain sockets only, see sockets::getPeerCredentials() */
+  bool getPeerCredentials(struct ucred* cred) const;
+
  private:
   const int sockfd_;
 };
@@ -1,5 +1,10 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <endian.h>
+#include <sys/socket.h>
+
+class InetAddress;
 
 /**
  * Helper functions to manipulate sockets, e.g. create, bind, listen, accept,
@@ -20,25 +25,69 @@ inline uint32_t networkToHost32(uint32_t net32) { return ntohl(net32); }
 inline uint16_t networkToHost16(uint16_t net16) { return ntohs(net16); }
 
 /**
- * Creates a non-blocking socket file descriptor, abort if any error.
+ * Creates a non-blocking stream socket file descriptor of @family, AF_INET,
+ * AF_INET6 or AF_UNIX, abort if any error.
+ */
+int createNonblockingOrDie(sa_family_t family = AF_INET);
+
+/**
+ * Creates a non-blocking UDP socket file descriptor of @family, AF_INET or
+ * AF_INET6, abort if any error.
  */
-int createNonblockingOrDie();
+int createNonblockingUdpOrDie(sa_family_t family = AF_INET);
 
-void bindOrDie(int sockfd, const struct sockaddr_in& addr);
+void bindOrDie(int sockfd, const struct sockaddr* addr, socklen_t len);
 
 void listenOrDie(int sockfd);
 
-int accept(int sockfd, struct sockaddr_in* addr);
+/**
+ * Non-blocking connect(2)
+ * @return 0 or -1 with errno set, EINPROGRESS means in progress
+ */
+int connect(int sockfd, const struct sockaddr* addr, socklen_t len);
+
+/* @addrlen is the capacity of @addr, then the length of the peer address */
+int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen);
 
 void close(int sockfd);
 
+/* Close with SO_LINGER 0, the peer gets a RST instead of a FIN */
+void closeWithReset(int sockfd);
+
 void shutdownWrite(int sockfd);
 
-void toHostPort(char* buf, size_t size, const struct sockaddr_in& addr);
+/* IPv4 or IPv6 @addr as "1.2.3.4:80" or "[::1]:80" */
+void toHostPort(char* buf, size_t size, const struct sockaddr* addr);
 
 void fromHostPort(const char* ip, uint16_t port, struct sockaddr_in* addr);
 
-struct sockaddr_in getLocalAddr(int sockfd);
+void fromHostPort(const char* ip, uint16_t port, struct sockaddr_in6* addr);
+
+InetAddress getLocalAddr(int sockfd);
+
+InetAddress getPeerAddr(int sockfd);
+
+/**
+ * Whether a connection to a local port in the ephemeral range ended up
+ * connected to itself (TCP simultaneous open)
+ */
+bool isSelfConnect(int sockfd);
 
 int getSocketError(int sockfd);
+
+/* SCM_RIGHTS fds carried by one message at most */
+const int MaxFdsPerMessage = 16;
+
+/**
+ * Unix domain sockets only
+ *
+ * Send @len bytes of @data, @fds ride along with the first byte as
+ * SCM_RIGHTS, the receiver gets duplicates. At most MaxFdsPerMessage
+ * @return result of sendmsg(2), the fds were sent if it is positive
+ */
+ssize_t sendWithFds(int sockfd, const void* data, size_t len, const int* fds,
+                    int num_fds);
+
+/* Process, user and group of the peer when it connected, SO_PEERCRED */
+bool getPeerCredentials(int sockfd, struct ucred* cred);
 }  // namespace sockets
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "inet_addr.h"
+#include "macro.h"
+#include "thread.h"
+
+class EventLoop;
+
+/**
+ * Thread reporting EventLoops stuck in one iteration
+ *
+ * Each loop publishes when its running iteration started, see
+ * EventLoop::iterationStartMicros(), and what it runs, see
+ * EventLoop::CallbackScope. A loop in one iteration for longer than the
+ * threshold, e.g. blocked in a MessageCallback, is reported once per
+ * iteration: the watchdog signals the loop thread, whose handler captures a
+ * backtrace, the callback type and the connection, and the watchdog thread
+ * logs them. Stalls are counted per loop.
+ *
+ * The signal is Signal(), installed with SA_RESTART so most blocking calls
+ * it interrupts carry on. Those never restarted, e.g. nanosleep(2), poll(2)
+ * and anything with a timeout, return early with EINTR, once per stall.
+ * Loops must be unwatched before they are destroyed.
+ */
+class StallWatchdog {
+ public:
+  static const int MaxFrames = 64;
+
+  /* SIGRTMIN + 1, glibc reserves the ones below SIGRTMIN for itself */
+  static int Signal();
+
+  explicit StallWatchdog(double threshold_seconds = 0.1);
+
+  DISALLOW_COPY(StallWatchdog);
+
+  ~StallWatchdog();
+
+  /* Once, a stopped watchdog doesn't start again */
+  void start();
+
+  void stop();
+
+  /* Thread safe */
+  void watch(EventLoop* loop);
+
+  /* Waits for a report of @loop being taken, at most about 100ms */
+  void unwatch(EventLoop* loop);
+
+  /* Stalls of @loop while watched. Thread safe */
+  uint64_t stalls(const EventLoop* loop);
+
+ private:
+  struct Watched {
+    EventLoop* loop;
+    /* Iteration start already reported */
+    int64_t reported_start_us;
+    uint64_t stalls;
+  };
+
+  /* A stall found by check(), reported with mutex_ released */
+  struct Stall {
+    EventLoop* loop;
+    pid_t thread_id;
+    int64_t stalled_us;
+    uint64_t stalls;
+  };
+
+  /**
+   * Filled in by the signal handler on the loop thread. report() arms it,
+   * a handler that matches the loop moves it to Writing and then Done, and
+   * report() only takes it back to Idle from Armed or Done, so a handler
+   * running late never writes into a sample being reused
+   */
+  struct Sample {
+    enum State { Idle, Armed, Writing, Done };
+
+    Sample() : local_addr(0) {}
+
+    std::atomic<EventLoop*> loop{nullptr};
+    std::atomic<int> state{Idle};
+    int depth = 0;
+    void* frames[MaxFrames];
+    const char* callback = nullptr;
+    bool has_connection = false;
+    uint64_t connection_id = 0;
+    InetAddress local_addr;
+  };
+
+  void threadFunc();
+
+  /* With mutex_ held in @lock, released while reporting */
+  void check(std::unique_lock<std::mutex>& lock);
+
+  /* Signal the thread of @stall and log what it is doing */
+  void report(const Stall& stall);
+
+  static void handleSignal(int signo);
+
+  /* The one sample of the process, reports are serialized */
+  static Sample sample_;
+
+  const int64_t threshold_us_;
+  Thread thread_;
+  std::mutex mutex_;
+  /* Signals stop() to the thread, and the end of a report to unwatch() */
+  std::condition_variable cv_;
+  bool running_;
+  std::vector<Watched> watched_;
+  /* Loop being reported, unwatch() waits for it */
+  EventLoop* reporting_;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "callbacks.h"
+#include "macro.h"
+#include "slice.h"
+
+/**
+ * Source of a body streamed by TcpConnection::stream()
+ *
+ * The connection pulls: produce() is only called in the loop thread while the
+ * connection's pending output is below its stream low water mark, so at most
+ * that much plus one chunk is buffered per connection, however long the
+ * stream is.
+ */
+class StreamProducer {
+ public:
+  enum class State {
+    Data,     // @chunk holds the next bytes, empty counts as Pending
+    Pending,  // nothing yet, call TcpConnection::resumeStream() once there is
+    Done,     // end of stream
+    Error,    // abort, the connection is closed
+  };
+
+  virtual ~StreamProducer() = default;
+
+  /* Fill @chunk with at most @max_bytes of the next data */
+  virtual State produce(size_t max_bytes, Slice* chunk) = 0;
+};
+
+/**
+ * Streams a Slice in pieces of at most max_bytes, without copying
+ */
+class SliceProducer : public StreamProducer {
+ public:
+  explicit SliceProducer(const Slice& data) : data_(data) {}
+
+  State produce(size_t max_bytes, Slice* chunk) override;
+
+ private:
+  Slice data_;
+};
+
+/**
+ * Streams [offset, offset + length) of a file with pread(2), one chunk-sized
+ * read per produce()
+ */
+class FileProducer : public StreamProducer {
+ public:
+  /* @fd is closed by the destructor if @owns_fd */
+  FileProducer(int fd, off_t offset, size_t length, bool owns_fd);
+
+  DISALLOW_COPY(FileProducer);
+
+  ~FileProducer() override;
+
+  State produce(size_t max_bytes, Slice* chunk) override;
+
+ private:
+  const int fd_;
+  off_t offset_;
+  size_t remaining_;
+  const bool owns_fd_;
+};
+
+/**
+ * Bridge from an asynchronous source, e.g. a backend connection in another
+ * loop or a worker thread
+ *
+ * The source push()es chunks from any thread, the connection is resumed when
+ * the queue becomes non-empty. push() returns false once more than
+ * @capacity bytes are queued, the source should then wait for the space
+ * callback, which runs in the connection's loop when half of it is drained.
+ */
+class AsyncProducer : public StreamProducer {
+ public:
+  using SpaceCallback = std::function<void()>;
+
+  static const size_t DefaultCapacity = 1024 * 1024;
+
+  explicit AsyncProducer(const TcpConnectionPtr& conn,
+                         size_t capacity = DefaultCapacity);
+
+  DISALLOW_COPY(AsyncProducer);
+
+  void setSpaceCallback(const SpaceCallback& cb);
+
+  /**
+   * Thread safe. @chunk is always queued, except an empty one, which is
+   * ignored. False asks the source to pause
+   */
+  bool push(const Slice& chunk);
+
+  /* End of stream, @ok false aborts it. Thread safe */
+  void finish(bool ok = true);
+
+  State produce(size_t max_bytes, Slice* chunk) override;
+
+ private:
+  /* Resume the connection if it waits for data */
+  void wakeup();
+
+  const std::weak_ptr<TcpConnection> conn_;
+  const size_t capacity_;
+
+  std::mutex mutex_;
+  std::deque<Slice> chunks_;
+  size_t bytes_;
+  bool finished_;
+  bool ok_;
+  /* push() returned false, the space callback is owed */
+  bool full_;
+  SpaceCallback space_cb_;
+};
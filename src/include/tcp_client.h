@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "callbacks.h"
+#include "connector.h"
+#include "inet_addr.h"
+#include "macro.h"
+#include "tcp_connection.h"
+
+class EventLoop;
+
+/**
+ * Directly managed by the user, one outgoing connection at a time
+ *
+ * The established socket is wrapped in the same TcpConnection a TcpServer
+ * uses, so sending, corking and backpressure behave identically on both
+ * sides. With retry enabled, a lost connection is re-established through the
+ * Connector's backoff.
+ */
+class TcpClient {
+ public:
+  TcpClient(EventLoop* loop, const InetAddress& server_addr,
+            const std::string& name);
+
+  DISALLOW_COPY(TcpClient);
+
+  /* Must be called in the loop thread */
+  ~TcpClient();
+
+  /* Thread safe */
+  void connect();
+
+  /* Shut down the established connection. Thread safe */
+  void disconnect();
+
+  /* Stop connecting, the established connection is untouched. Thread safe */
+  void stop();
+
+  /* Must be called in the loop thread */
+  TcpConnectionPtr connection() const;
+
+  EventLoop* getLoop() const { return loop_; }
+
+  const std::string& name() const { return name_; }
+
+  bool retry() const { return retry_; }
+
+  /* Reconnect after an established connection is lost */
+  void enableRetry() { retry_ = true; }
+
+  Connector& connector() { return *connector_; }
+
+  /**
+   * Set connection callback. Not thread safe, call it before connect()
+   */
+  void setConnectionCallback(const ConnectionCallback& cb) {
+    connection_cb_ = cb;
+  }
+
+  /**
+   * Set message callback. Not thread safe, call it before connect()
+   */
+  void setMessageCallback(const MessageCallback& cb) { message_cb_ = cb; }
+
+  void setWriteCallback(const WriteCompleteCallback& cb) {
+    write_cmpl_cb_ = cb;
+  }
+
+  /**
+   * Speak TLS, @server_name is sent as SNI and verified, see TlsSession.
+   * Not thread safe, call it before connect()
+   */
+  void setTlsContext(const std::shared_ptr<TlsContext>& context,
+                     const std::string& server_name = std::string()) {
+    tls_context_ = context;
+    tls_server_name_ = server_name;
+  }
+
+ private:
+  /* NewConnectionCallback of connector_, in loop thread */
+  void newConnection(int sockfd);
+
+  /* CloseCallback of connection_, in loop thread */
+  void removeConnection(const TcpConnectionPtr& conn);
+
+  EventLoop* loop_;
+  ConnectorPtr connector_;
+  const std::string name_;
+  ConnectionCallback connection_cb_;
+  MessageCallback message_cb_;
+  WriteCompleteCallback write_cmpl_cb_;
+  std::shared_ptr<TlsContext> tls_context_;
+  std::string tls_server_name_;
+  std::atomic<bool> retry_;
+  std::atomic<bool> connect_;
+  uint64_t next_conn_id_;  // always in loop thread
+  TcpConnectionPtr connection_;  // always in loop thread
+};
@@ -1,13 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <any>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string_view>
 
 #include "buffer.h"
 #include "callbacks.h"
+#include "channel.h"
 #include "inet_addr.h"
+#include "memory_budget.h"
+#include "rate_limiter.h"
+#include "slice.h"
+#include "socket.h"
 
-class Channel;
 class EventLoop;
-class Socket;
 class Buffer;
+class ConnectionPool;
+class StreamProducer;
+class TlsContext;
+class TlsSession;
 
 using TcpConnectionPtr = std::shared_ptr<TcpConnection>;
 
@@ -21,13 +36,28 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
    *
    * User should not create this object.
    */
-  TcpConnection(EventLoop* loop, const std::string& name, int sockfd,
+  TcpConnection(EventLoop* loop, uint64_t id, int sockfd,
                 const InetAddress& localAddr, const InetAddress& peerAddr);
+
+  /**
+   * Same as above, Buffer storage is taken from and given back to @pool,
+   * which must belong to @loop. Called in the loop thread
+   */
+  TcpConnection(EventLoop* loop, uint64_t id, int sockfd,
+                const InetAddress& localAddr, const InetAddress& peerAddr,
+                const std::shared_ptr<ConnectionPool>& pool);
   ~TcpConnection();
 
   EventLoop* getLoop() const { return loop_; }
 
-  const std::string& name() const { return name_; }
+  /* Unique among connections of one TcpServer */
+  uint64_t id() const { return id_; }
+
+  /**
+   * "ip:port#id", only formatted on first use so that connection setup does
+   * not pay for a string nobody logs
+   */
+  const std::string& name() const;
 
   const InetAddress& localAddress() { return local_addr_; }
 
@@ -39,12 +69,112 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 
   void setTcpKeepAlive(bool on);
 
-  /* Thread safe */
+  /**
+   * Unix domain sockets only
+   *
+   * Process, user and group of the peer when it connected
+   */
+  bool peerCredentials(struct ucred* cred) const {
+    return socket_.getPeerCredentials(cred);
+  }
+
+  /**
+   * Receive file descriptors passed along with data (SCM_RIGHTS), take them
+   * with takeReceivedFds() in MessageCallback. Not thread safe, call it before
+   * the connection is established
+   */
+  void setReceiveFds(bool on) { receive_fds_ = on; }
+
+  /**
+   * Fds received so far, in order, owned by the caller from now on. Those
+   * never taken are closed with the connection. Use it in the loop thread
+   */
+  std::vector<int> takeReceivedFds() {
+    std::vector<int> fds;
+    fds.swap(received_fds_);
+    return fds;
+  }
+
+  /**
+   * Send @message with @fds attached to its first byte, the peer receives
+   * duplicates. Only when no output is pending, as fds can't be queued
+   * behind it: if some is, or the socket is full, nothing is sent and false
+   * is returned, retry from WriteCompleteCallback. Empty @fds make it a
+   * plain send, queued behind pending output. Must be called in the loop
+   * thread, @message must not be empty
+   */
+  bool sendWithFds(std::string_view message, const std::vector<int>& fds);
+
+  /**
+   * Send functions, all thread safe
+   *
+   * In the loop thread they try to write immediately. What the socket does not
+   * take is queued: borrowed bytes (string_view, pointer) are copied into
+   * output_buffer_, owned bytes (string&&, Buffer*, Slice) are queued by
+   * reference. Off-loop calls copy borrowed bytes once to hand them over.
+   */
   void send(const std::string& message);
 
+  /* @message is moved end to end, never copied */
+  void send(std::string&& message);
+
+  void send(std::string_view message);
+
+  void send(const char* message) { send(std::string_view(message)); }
+
+  void send(const void* data, size_t len);
+
+  /* Readable bytes of @buf are swapped out, @buf is left empty */
+  void send(Buffer* buf);
+
+  /* @slice is held by reference until written */
+  void send(const Slice& slice);
+
+  /**
+   * Stream the output of @producer, pulled whenever pending output is below
+   * the stream low water mark, so memory stays bounded whatever its length.
+   * @done runs in the loop thread when the stream ends, the connection is
+   * closed if it failed. Nothing else should be sent meanwhile, one stream at
+   * a time. shutdown() waits for the stream. Thread safe
+   */
+  void stream(const std::shared_ptr<StreamProducer>& producer,
+              const StreamCompleteCallback& done = StreamCompleteCallback());
+
+  /* A Pending producer has data again. Thread safe */
+  void resumeStream();
+
+  /* Not thread safe, use it in the loop thread */
+  bool streaming() const { return static_cast<bool>(producer_); }
+
+  /* Not thread safe, call it before stream() */
+  void setStreamLowWaterMark(size_t mark) { stream_low_water_mark_ = mark; }
+
   /* Thread safe */
   void shutdown();
 
+  /* Close now, dropping pending output. Thread safe */
+  void forceClose();
+
+  /**
+   * Resume reading from the socket. Thread safe
+   *
+   * Only undoes stopRead(): reading stays paused while backpressure or the
+   * rate limiter hold it
+   */
+  void startRead();
+
+  /* Stop reading from the socket, the peer is throttled by TCP. Thread safe */
+  void stopRead();
+
+  /* Not thread safe, may race with start/stopRead */
+  bool isReading() const { return read_pause_ == 0; }
+
+  /**
+   * Input not consumed by MessageCallback yet, e.g. pipelined requests held
+   * back while a response streams. Use it in the loop thread
+   */
+  Buffer* inputBuffer() { return &input_buffer_; }
+
   /* Callback provided by user, passed in TcpServer::newConnection */
   void setConnectionCallback(const ConnectionCallback& cb) {
     connection_cb_ = cb;
@@ -54,6 +184,124 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
     write_cmpl_cb_ = cb;
   }
 
+  /**
+   * High water callback for pending output
+   * Invoked when pending output grows across @high_water_mark
+   */
+  void setHighWaterMarkCallback(const HighWaterMarkCallback& cb,
+                                size_t high_water_mark) {
+    high_water_cb_ = cb;
+    high_water_mark_ = high_water_mark;
+  }
+
+  /**
+   * Automatic read backpressure
+   *
+   * Once pending output reaches @high_water_mark, stop reading from the
+   * backpressure target (this connection by default), resume it once pending
+   * output drains to @low_water_mark. Not thread safe, call it before the
+   * connection is established or in the loop thread
+   */
+  void enableBackpressure(size_t high_water_mark, size_t low_water_mark);
+
+  /**
+   * Throttle @upstream instead of this connection, e.g. the client side of a
+   * proxy while this backend connection can't keep up. @upstream may live in
+   * another loop. Must be called in the loop thread
+   */
+  void setBackpressureTarget(const TcpConnectionPtr& upstream) {
+    backpressure_target_ = upstream;
+  }
+
+  size_t outputBufferedBytes() const { return outputBytes(); }
+
+  /**
+   * Meter input and output with token buckets: this connection's own, set
+   * from limiter->perConnection(), and the loop-wide ones of @limiter, which
+   * must belong to this connection's loop. Reading pauses while ingress
+   * tokens are short, writing while egress tokens are, until the limiter's
+   * refill tick. Not thread safe, call it before the connection is
+   * established
+   */
+  void setRateLimiter(const std::shared_ptr<RateLimiter>& limiter);
+
+  /* Own buckets other than the limiter's defaults. In loop thread */
+  void setRateLimit(const RateLimit& limit);
+
+  /**
+   * Speak TLS over this connection, see TlsContext. The connection callback
+   * runs once the handshake is done, a connection failing it is closed
+   * without one. @server_name is for clients, see TlsSession. Not thread
+   * safe, call it before the connection is established
+   */
+  void startTls(const std::shared_ptr<TlsContext>& context,
+                const std::string& server_name = std::string());
+
+  /* Null without TLS. Use it in the loop thread */
+  const TlsSession* tlsSession() const { return tls_.get(); }
+
+  /**
+   * Charge the growth and shrink of memoryFootprint() to @account, which
+   * must belong to this connection's loop. Not thread safe, call it before
+   * the connection is established
+   */
+  void setMemoryAccount(const std::shared_ptr<MemoryAccount>& account) {
+    memory_account_ = account;
+  }
+
+  /**
+   * Buffer memory held: capacity of the input and output Buffers, and the
+   * Slices queued for output that nobody else holds. A Slice shared by a
+   * broadcast is charged to the connection holding it last, not once per
+   * receiver. Walks the output queue, use it in the loop thread
+   */
+  size_t memoryFootprint() const;
+
+  /**
+   * Fair share of each loop iteration, 0 means unlimited, both 0 (the
+   * default) disables it
+   *
+   * A readable connection is read and dispatched to MessageCallback until
+   * the socket is drained, or until it has read @bytes or spent @micros in
+   * read and MessageCallback during this iteration. Then, if data is left,
+   * it skips poll and continues from the loop's ready list on the next
+   * iteration, after the connections that became readable meanwhile. A
+   * callback already running is not interrupted, the budget bounds how
+   * often it is called. Not thread safe, call it before the connection is
+   * established or in the loop thread
+   */
+  void setReadBudget(size_t bytes, int64_t micros) {
+    read_budget_bytes_ = bytes;
+    read_budget_us_ = micros;
+  }
+
+  /**
+   * Per-connection state of the protocol layer, e.g. an HttpParser
+   * Not thread safe, use it in the loop thread
+   */
+  void setContext(const std::any& context) { context_ = context; }
+
+  const std::any& getContext() const { return context_; }
+
+  std::any* getMutableContext() { return &context_; }
+
+  /**
+   * Auto cork: output sent in the loop thread is only queued, and flushed
+   * once at the end of the EventLoop iteration with a single sendmsg(2), so
+   * several sends per request cost one syscall. Must be called in the loop
+   * thread or before the connection is established
+   */
+  void setAutoCork(bool on);
+
+  /**
+   * Hold all output until uncork(). If more than CorkFlushThreshold bytes are
+   * held they are flushed early with MSG_MORE. Must be called in the loop
+   * thread
+   */
+  void cork();
+
+  void uncork();
+
   /* Callback provided by user, passed in TcpServer::newConnection */
   void setMessageCallback(const MessageCallback& cb) { message_cb_ = cb; }
 
@@ -74,31 +322,183 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
    */
   void destroyConnection();
 
+  /**
+   * Internal use only
+   *
+   * Refill tick of RateLimiter, resume what the tokens allow
+   * @return whether still throttled
+   */
+  bool refillRate(int64_t now_us);
+
+  /**
+   * Internal use only
+   *
+   * Reading paused by MemoryAccount over a soft limit. In loop thread
+   */
+  void setMemoryPaused(bool paused);
+
+  bool memoryPaused() const { return read_pause_ & PausedByMemory; }
+
  private:
+  static const size_t DefaultHighWaterMark = 64 * 1024 * 1024;
+
+  /* At most this many pending chunks are gathered by one writev(2) */
+  static const int MaxWriteIov = 64;
+
+  /* Corked output over this size is flushed early with MSG_MORE */
+  static const size_t CorkFlushThreshold = 64 * 1024;
+
+  /* Stream defaults: pull below this much pending output, this much at once */
+  static const size_t DefaultStreamLowWaterMark = 64 * 1024;
+  static const size_t StreamChunkSize = 64 * 1024;
+
   enum class States { Connecting, Connected, Disconnecting, Disconnected };
 
+  /* Why reading is paused, the socket is read once none is left */
+  enum ReadPause : uint8_t {
+    PausedByUser = 1 << 0,
+    PausedByBackpressure = 1 << 1,
+    PausedByRateLimit = 1 << 2,
+    PausedByReadBudget = 1 << 3,
+    PausedByMemory = 1 << 4,
+  };
+
   void setState(States s) { state_ = s; }
 
   void handleRead(Timestamp recv_time);
 
+  /**
+   * One readv(2) and MessageCallback, close and error are handled here.
+   * EAGAIN, nothing left to read, is not an error
+   * @return result of readv(2)
+   */
+  ssize_t readOnce(Timestamp recv_time);
+
+  /* Drive the TLS handshake, then run connection_cb_ */
+  void continueHandshake();
+
+  /* connection_cb_, named for StallWatchdog */
+  void runConnectionCallback();
+
+  /* write(2), or SSL_write unless the kernel encrypts */
+  ssize_t writeSocket(const void* data, size_t len);
+
+  /* handleRead() with a read budget, see setReadBudget() */
+  void readWithBudget(Timestamp recv_time);
+
+  bool readBudgetSpent() const {
+    return (read_budget_bytes_ > 0 && read_bytes_ >= read_budget_bytes_) ||
+           (read_budget_us_ > 0 && read_us_ >= read_budget_us_);
+  }
+
+  /* Pause reading until the next iteration, resumeDeferredRead() then */
+  void deferRead();
+
+  void resumeDeferredRead();
+
   void handleWrite();
 
+  /* Drop @n written bytes from the front of the pending output */
+  void retrieveOutput(size_t n);
+
   void handleClose();
 
   void handleError();
 
-  void sendInLoop(const std::string& message);
+  /* Copy what can't be written immediately into output_buffer_ */
+  void sendInLoop(const void* data, size_t len);
+
+  /* Queue what can't be written immediately by reference */
+  void sendSliceInLoop(const Slice& slice);
+
+  /* Swap @buf into the pending output if it can't be written immediately */
+  void sendBufferInLoop(Buffer* buf);
+
+  /**
+   * write(2) straight from the caller's memory, only when nothing is queued
+   * @return bytes written
+   */
+  size_t writeImmediately(const void* data, size_t len);
+
+  /* Append @slice to output_queue_, keeping the order with output_buffer_ */
+  void queueSlice(const Slice& slice);
+
+  bool isCorked() const { return corked_ || auto_cork_; }
+
+  /* Write deferred output now, with MSG_MORE if @more */
+  void flushOutput(bool more);
+
+  /**
+   * Gather pending output into one sendmsg(2) with @flags
+   * @return result of sendmsg(2)
+   */
+  ssize_t writeOutput(int flags);
+
+  /* All pending output has been written */
+  void onOutputDrained();
+
+  /* Bytes waiting in output_queue_ and output_buffer_ */
+  size_t outputBytes() const {
+    return output_queue_bytes_ + output_buffer_.readableBytes();
+  }
 
   void shutdownInLoop();
 
+  void forceCloseInLoop();
+
+  void streamInLoop(const std::shared_ptr<StreamProducer>& producer,
+                    const StreamCompleteCallback& done);
+
+  void resumeStreamInLoop();
+
+  /* Queue chunks from producer_ until output reaches the low water mark */
+  void pullStream();
+
+  void finishStream(bool ok);
+
+  void pauseRead(uint8_t reason);
+
+  void resumeRead(uint8_t reason);
+
+  /* Charge @n bytes read or written to the token buckets */
+  void chargeIngress(size_t n, Timestamp now);
+
+  void chargeEgress(size_t n);
+
+  /* Put this on the limiter's refill tick, once */
+  void throttleRate();
+
+  /* Charge the change of memoryFootprint() to memory_account_ */
+  void updateMemory() {
+    const size_t footprint = memoryFootprint();
+    if (footprint != memory_charged_) {
+      memory_account_->charge(static_cast<int64_t>(footprint) -
+                              static_cast<int64_t>(memory_charged_));
+      memory_charged_ = footprint;
+    }
+  }
+
+  /**
+   * Called after output is queued, @old_len is the pending size before.
+   * Registers WriteEvent and applies the high water mark
+   */
+  void onOutputQueued(size_t old_len);
+
+  /* Stop/resume reading from backpressure_target_, or from this */
+  void pauseBackpressureTarget();
+
+  void resumeBackpressureTarget();
+
   EventLoop* loop_;
-  std::string name_;
+  const uint64_t id_;
+  mutable std::once_flag name_once_;
+  mutable std::string name_;
   States state_;  // FIXME: use atomic variable
   // we don't expose those classes to client.
 
-  /* TcpConnection owns Socket and Channel */
-  std::unique_ptr<Socket> socket_;
-  std::unique_ptr<Channel> channel_;
+  /* TcpConnection owns Socket and Channel, inline to share its allocation */
+  Socket socket_;
+  Channel channel_;
   InetAddress local_addr_;
   InetAddress peer_addr_;
 
@@ -119,9 +519,80 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
   /* Invoked when readable events arrive */
   MessageCallback message_cb_;
 
+  /* High water callback for pending output */
+  HighWaterMarkCallback high_water_cb_;
+  size_t high_water_mark_;
+
+  /* Automatic backpressure, see enableBackpressure() */
+  bool backpressure_;
+  bool backpressure_paused_;
+  size_t backpressure_high_;
+  size_t backpressure_low_;
+  std::weak_ptr<TcpConnection> backpressure_target_;
+
+  /* Recycles Buffer storage, may be null */
+  std::shared_ptr<ConnectionPool> pool_;
+
+  /* ReadPause bits, channel_ is polled for ReadEvent when 0 */
+  uint8_t read_pause_;
+
+  /* See setRateLimiter(), rate_limiter_ may be null */
+  std::shared_ptr<RateLimiter> rate_limiter_;
+  TokenBucket ingress_bucket_;
+  TokenBucket egress_bucket_;
+  /* Out of egress tokens, output waits for the refill tick */
+  bool egress_paused_;
+  /* On the limiter's throttled list */
+  bool rate_throttled_;
+
+  /* See startTls(), tls_ may be null */
+  std::unique_ptr<TlsSession> tls_;
+  bool tls_handshaking_;
+
+  /* See setReceiveFds() */
+  bool receive_fds_;
+  std::vector<int> received_fds_;
+
+  /* See setMemoryAccount(), memory_account_ may be null */
+  std::shared_ptr<MemoryAccount> memory_account_;
+  size_t memory_charged_;
+
+  /* See setReadBudget(), spent in EventLoop::iteration() read_iteration_ */
+  size_t read_budget_bytes_;
+  int64_t read_budget_us_;
+  uint64_t read_iteration_;
+  size_t read_bytes_;
+  int64_t read_us_;
+
+  /* See setAutoCork() and cork() */
+  bool auto_cork_;
+  bool corked_;
+  /* A flushOutput() is queued for the end of this loop iteration */
+  bool flush_scheduled_;
+
+  /* Active stream, see stream() */
+  std::shared_ptr<StreamProducer> producer_;
+  StreamCompleteCallback stream_cmpl_cb_;
+  size_t stream_low_water_mark_;
+  /* producer_ returned Pending, wait for resumeStream() */
+  bool stream_waiting_;
+  /* Inside pullStream(), sending may drain output and re-enter it */
+  bool pulling_;
+
   /* Invoked when */
   CloseCallback close_cb_;
+  std::any context_;
   Buffer input_buffer_;
+
+  /**
+   * Pending output, written in this order by handleWrite():
+   * 1. output_queue_: Slices queued by reference
+   * 2. output_buffer_: bytes copied from borrowed memory
+   * Before a Slice is queued, a non-empty output_buffer_ is swapped into
+   * output_queue_ to keep data in order
+   */
+  std::deque<Slice> output_queue_;
+  size_t output_queue_bytes_;
   Buffer output_buffer_;
 };
 
@@ -1,19 +1,59 @@
-#include <map>
+#pragma once
+
+#include <stdint.h>
+
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "callbacks.h"
+#include "connection_pool.h"
+#include "connection_registry.h"
 #include "macro.h"
+#include "memory_budget.h"
+#include "rate_limiter.h"
 #include "tcp_connection.h"
+#include "timer_id.h"
 
 class Acceptor;
 class EventLoop;
 class EventLoopThreadPool;
+class StallWatchdog;
+class TlsContext;
 
 /**
  * Directly managed by the user
  */
 class TcpServer {
  public:
+  /**
+   * What to do while the I/O loops lag behind, see EventLoop::lagMicros()
+   *
+   * The server is overloaded once the lag of any I/O loop exceeds high_lag
+   * seconds, and until all of them are back below low_lag for
+   * recovery_samples checks in a row. A loop sampled while it waits in poll
+   * reports no lag, one such sample must not end the overload of a loop
+   * that is otherwise saturated. Shedding new connections early keeps the
+   * latency of the accepted ones bounded.
+   */
+  struct OverloadPolicy {
+    enum class Action {
+      None,
+      /* Stop accepting, new connections wait in the listen backlog */
+      PauseAccept,
+      /* Accept and close at once, after writing reject_message, or with a
+       * RST if it is empty */
+      Reject,
+    };
+
+    Action action = Action::None;
+    double high_lag = 0.1;
+    double low_lag = 0.02;
+    int recovery_samples = 5;
+    /* e.g. "HTTP/1.1 503 Service Unavailable\r\n..." */
+    std::string reject_message;
+  };
+
   TcpServer(EventLoop* loop, const InetAddress& listenAddr);
 
   DISALLOW_COPY(TcpServer);
@@ -46,29 +86,172 @@ class TcpServer {
    * Not thread safe.
    */
   void setConnectionCallback(const ConnectionCallback& cb) {
-    connection_cb_ = cb;
+    options_->connection_cb = cb;
   }
 
   /**
    * Set message callback. This callback will be passed TcpConnection
    * Not thread safe.
    */
-  void setMessageCallback(const MessageCallback& cb) { message_cb_ = cb; }
+  void setMessageCallback(const MessageCallback& cb) {
+    options_->message_cb = cb;
+  }
 
   void setWriteCallback(const WriteCompleteCallback& cb) {
-    write_cmpl_cb_ = cb;
+    options_->write_cmpl_cb = cb;
+  }
+
+  /**
+   * Set high water callback of every new connection
+   * Not thread safe.
+   */
+  void setHighWaterMarkCallback(const HighWaterMarkCallback& cb,
+                                size_t high_water_mark) {
+    options_->high_water_cb = cb;
+    options_->high_water_mark = high_water_mark;
+  }
+
+  /**
+   * Opt in auto cork for every new connection, see
+   * TcpConnection::setAutoCork. Not thread safe.
+   */
+  void setAutoCork(bool on) { options_->auto_cork = on; }
+
+  /**
+   * Opt in automatic read backpressure for every new connection, see
+   * TcpConnection::enableBackpressure. Not thread safe.
+   */
+  void setBackpressure(size_t high_water_mark, size_t low_water_mark) {
+    options_->backpressure_high = high_water_mark;
+    options_->backpressure_low = low_water_mark;
+  }
+
+  /**
+   * Have @watchdog watch the I/O loops from start() until this server is
+   * destroyed. @watchdog must outlive it. Not thread safe, call it before
+   * start()
+   */
+  void setStallWatchdog(StallWatchdog* watchdog) { watchdog_ = watchdog; }
+
+  /**
+   * Serve TLS on every new connection, see TcpConnection::startTls.
+   * Not thread safe.
+   */
+  void setTlsContext(const std::shared_ptr<TlsContext>& context) {
+    options_->tls_context = context;
+  }
+
+  /**
+   * Per iteration read budget of every new connection, see
+   * TcpConnection::setReadBudget. Not thread safe.
+   */
+  void setReadBudget(size_t bytes, int64_t micros) {
+    options_->read_budget_bytes = bytes;
+    options_->read_budget_us = micros;
+  }
+
+  /**
+   * Bound the Buffer memory of the connections: @budget is process-wide,
+   * share it with the other servers of the process, @per_loop applies to
+   * each I/O loop, see MemoryAccount. New connections are refused while a
+   * hard limit is exceeded. Slices shared between connections, e.g. by a
+   * broadcast, are charged once they have a single holder, see
+   * TcpConnection::memoryFootprint(). Not thread safe, call it before start()
+   */
+  void setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget,
+                       const MemoryLimits& per_loop = MemoryLimits()) {
+    memory_budget_ = budget;
+    memory_per_loop_ = per_loop;
+  }
+
+  /* Not thread safe, call it before start() */
+  void setOverloadPolicy(const OverloadPolicy& policy) {
+    overload_policy_ = policy;
+  }
+
+  /* Whether the last check found the I/O loops lagging. In acceptor loop */
+  bool overloaded() const { return overloaded_; }
+
+  /* Connections closed by OverloadPolicy::Action::Reject. In acceptor loop */
+  uint64_t rejectedConnections() const { return rejected_; }
+
+  /**
+   * Token bucket rate limits, @per_connection for each connection and
+   * @per_loop shared by the connections of each I/O loop, see
+   * TcpConnection::setRateLimiter. Not thread safe, call it before start()
+   */
+  void setRateLimit(const RateLimit& per_connection,
+                    const RateLimit& per_loop = RateLimit()) {
+    rate_per_connection_ = per_connection;
+    rate_per_loop_ = per_loop;
   }
 
  private:
-  /* Not thread safe, but in loop */
+  /* How often a paused acceptor checks whether the loops caught up */
+  static constexpr double OverloadCheckInterval = 0.01;
+
+  /* Applied to every new connection, see the setters above */
+  struct ConnectionOptions {
+    ConnectionCallback connection_cb;
+    MessageCallback message_cb;
+    WriteCompleteCallback write_cmpl_cb;
+    HighWaterMarkCallback high_water_cb;
+    size_t high_water_mark = 0;
+    /* 0 means backpressure disabled */
+    size_t backpressure_high = 0;
+    size_t backpressure_low = 0;
+    size_t read_budget_bytes = 0;
+    int64_t read_budget_us = 0;
+    std::shared_ptr<TlsContext> tls_context;
+    bool auto_cork = false;
+  };
+
+  /**
+   * Connections owned by one I/O loop, and the pool they are allocated from
+   *
+   * Only touched in that loop's thread, so accepting and closing never take a
+   * lock or wait for the acceptor loop. Functors queued to the loop and close
+   * callbacks hold the shard rather than the server, which may be destroyed
+   * before they run
+   */
+  struct Shard {
+    Shard(EventLoop* io_loop, const std::string& server_name,
+          const std::shared_ptr<const ConnectionOptions>& connection_options)
+        : loop(io_loop),
+          name(server_name),
+          options(connection_options),
+          pool(std::make_shared<ConnectionPool>(io_loop)) {}
+
+    EventLoop* const loop;
+    /* Of the server, for logging */
+    const std::string name;
+    const std::shared_ptr<const ConnectionOptions> options;
+    ConnectionRegistry connections;
+    std::shared_ptr<ConnectionPool> pool;
+    /* Null unless a rate limit is set */
+    std::shared_ptr<RateLimiter> rate_limiter;
+    /* Null unless a memory budget is set */
+    std::shared_ptr<MemoryAccount> memory;
+  };
+
+  /* Not thread safe, but in acceptor loop */
   void newConnection(int sockfd, const InetAddress& peerAddr);
 
-  /* Not thread safe, but in loop */
-  void removeConnection(const TcpConnectionPtr& conn);
+  /* Not thread safe, but in the I/O loop of @shard */
+  static void newConnectionInLoop(const std::shared_ptr<Shard>& shard,
+                                  uint64_t id, int sockfd,
+                                  const InetAddress& peer_addr);
+
+  /* Not thread safe, but in the I/O loop of @shard */
+  static void removeConnection(Shard* shard, const TcpConnectionPtr& conn);
+
+  /* Update overloaded_ from the lag of the I/O loops, in acceptor loop */
+  bool checkOverload();
 
-  void removeConnectionInLoop(const TcpConnectionPtr& conn);
+  void rejectConnection(int sockfd);
 
-  using ConnectionMap = std::map<std::string, TcpConnectionPtr>;
+  /* Timer of a paused acceptor, in acceptor loop */
+  void onOverloadCheck();
 
   /* The acceptor loop */
   EventLoop* loop_;
@@ -79,11 +262,24 @@ class TcpServer {
    */
   std::unique_ptr<Acceptor> acceptor_;
   std::unique_ptr<EventLoopThreadPool> thread_pool_;
-  ConnectionCallback connection_cb_;
-  MessageCallback message_cb_;
-  WriteCompleteCallback write_cmpl_cb_;
+  /* Shared with the shards */
+  std::shared_ptr<ConnectionOptions> options_;
+  RateLimit rate_per_connection_;
+  RateLimit rate_per_loop_;
+  std::shared_ptr<MemoryBudget> memory_budget_;
+  StallWatchdog* watchdog_;
+  MemoryLimits memory_per_loop_;
+  OverloadPolicy overload_policy_;
+  bool overloaded_;
+  /* Consecutive checks below low_lag while overloaded_ */
+  int calm_samples_;
+  uint64_t rejected_;
+  /* Resumes accepting once the overload is over */
+  TimerId overload_timer_;
   bool started_;
-  int next_conn_id_;  // always in loop thread
-  ConnectionMap connections_;
+  uint64_t next_conn_id_;  // always in loop thread
+  /* One per I/O loop, created in start() */
+  std::vector<std::shared_ptr<Shard>> shards_;
+  size_t next_shard_;  // always in loop thread
 };
 
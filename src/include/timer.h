@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 
 #include "macro.h"
@@ -15,7 +16,8 @@ class Timer {
       : callback_(cb),
         expiration_(expiration),
         interval_(interval),
-        repeat_(interval > 0) {}
+        repeat_(interval > 0),
+        sequence_(num_created_.fetch_add(1, std::memory_order_relaxed) + 1) {}
 
   DISALLOW_COPY(Timer);
 
@@ -25,6 +27,8 @@ class Timer {
 
   bool isRepeat() { return repeat_; }
 
+  int64_t sequence() const { return sequence_; }
+
   void restart(Timestamp now) {
     if (repeat_) {
       expiration_ = addTime(now, interval_);
@@ -38,4 +42,7 @@ class Timer {
   Timestamp expiration_;
   const double interval_;
   const bool repeat_;
+  const int64_t sequence_;
+
+  static inline std::atomic<int64_t> num_created_{0};
 };
@@ -1,16 +1,28 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "macro.h"
 
 class Timer;
 
 /**
  * An opache identifier for canceling timer
+ *
+ * The sequence tells a timer from a later one allocated at the same address
  */
 class TimerId {
  public:
-  TimerId(Timer* timer) : timer_(timer) {}
+  TimerId() : timer_(nullptr), sequence_(0) {}
+
+  TimerId(Timer* timer, int64_t sequence)
+      : timer_(timer), sequence_(sequence) {}
+
+  // default copy/assignment are Okay
 
  private:
+  friend class TimerQueue;
+
   Timer* timer_;
+  int64_t sequence_;
 };
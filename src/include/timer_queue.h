@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <memory>
 #include <set>
 #include <utility>
@@ -20,16 +21,9 @@ class EventLoop;
 
 class TimerQueue {
  public:
-  class TimerEntryCmp {
-    /* Cannot use auto inside class, so make TimerEntryCmp a function object */
-    bool operator()(const std::unique_ptr<Timer>& l,
-                    const std::unique_ptr<Timer>& r) {
-      return l->getExpiration() < r->getExpiration();
-    }
-  };
-
   using TimerEntry = std::pair<Timestamp, std::unique_ptr<Timer>>;
-  using TimerSet = std::set<TimerEntry, TimerEntryCmp>;
+  /* A multimap, timers may expire at the same time */
+  using TimerSet = std::multimap<Timestamp, std::unique_ptr<Timer>>;
 
   TimerQueue(EventLoop* loop);
 
@@ -44,10 +38,20 @@ class TimerQueue {
   TimerId addTimer(const Timer::TimerCallback& cb, Timestamp when,
                    double interval);
 
+  /**
+   * The callback doesn't run once this returns in the loop thread, or from
+   * the next iteration if called from another thread. Canceling a timer that
+   * already ran is a no-op
+   */
   void cancel(TimerId timer_id);
 
  private:
-  void addTimerInLoop(std::unique_ptr<Timer>& timer);
+  /* Timer and its sequence, identifies it past its lifetime */
+  using ActiveTimer = std::pair<Timer*, int64_t>;
+
+  void addTimerInLoop(std::unique_ptr<Timer> timer);
+
+  void cancelInLoop(TimerId timer_id);
 
   /* Clear all expired timers */
   std::vector<TimerEntry> getExpired(Timestamp now);
@@ -62,8 +66,13 @@ class TimerQueue {
 
   EventLoop* loop_;
   const int timerfd_;
-  Channel channel_;
+  Channel timerfd_channel_;
 
   /* Timer set sorted by expiration */
   TimerSet timers_;
+  /* The timers in timers_, by address */
+  std::set<ActiveTimer> active_timers_;
+  /* Running expired timers, those canceled meanwhile are collected */
+  bool calling_expired_timers_;
+  std::set<ActiveTimer> canceling_timers_;
 };
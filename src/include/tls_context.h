@@ -0,0 +1,129 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+#include "macro.h"
+
+class Buffer;
+
+/* OpenSSL types, kept out of the headers that include this one */
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+
+/**
+ * TLS configuration shared by many connections, wraps SSL_CTX
+ *
+ * Kernel TLS is requested by default: once the handshake is done OpenSSL
+ * installs the session keys into the socket (TCP_ULP "tls"), and the
+ * connection's ordinary write(2), sendmsg(2) and readv(2) carry plaintext,
+ * encrypted by the kernel without a userspace copy. Kernels, ciphers or
+ * OpenSSL builds without it fall back to SSL_read/SSL_write, per direction.
+ *
+ * Needs OpenSSL 3.0 or later for kernel TLS, link with -lssl -lcrypto.
+ */
+class TlsContext {
+ public:
+  /**
+   * Server side with a PEM certificate chain and private key
+   * @return nullptr if they can't be loaded
+   */
+  static std::shared_ptr<TlsContext> newServer(const std::string& cert_file,
+                                               const std::string& key_file);
+
+  /**
+   * Client side, the server certificate is verified against the default CA
+   * paths if @verify
+   */
+  static std::shared_ptr<TlsContext> newClient(bool verify = true);
+
+  DISALLOW_COPY(TlsContext);
+
+  ~TlsContext();
+
+  bool isServer() const { return server_; }
+
+  /* On by default. Not thread safe, call it before connections use it */
+  void setKernelTls(bool on);
+
+  SSL_CTX* get() const { return ctx_; }
+
+ private:
+  TlsContext(SSL_CTX* ctx, bool server) : ctx_(ctx), server_(server) {}
+
+  SSL_CTX* ctx_;
+  const bool server_;
+};
+
+/**
+ * TLS state of one connection, driven by TcpConnection in its loop thread
+ *
+ * Calls return like the syscalls they stand in for: bytes, 0 at the end of
+ * the stream, or -1 with errno, EAGAIN while the other direction or more
+ * records are needed.
+ */
+class TlsSession {
+ public:
+  /**
+   * @server_name of a client: sent as SNI, and checked against the server
+   * certificate if the context verifies it. If OpenSSL can't allocate the
+   * session, handshake() fails
+   */
+  TlsSession(const std::shared_ptr<TlsContext>& context, int sockfd,
+             const std::string& server_name = std::string());
+
+  DISALLOW_COPY(TlsSession);
+
+  ~TlsSession();
+
+  /**
+   * Drive the handshake on readiness of the socket
+   * @return 1 done, 0 in progress, -1 failed. In progress, wantWrite() tells
+   * whether it waits for the socket to be writable rather than readable
+   */
+  int handshake();
+
+  bool wantWrite() const { return want_write_; }
+
+  /* Record encryption in the kernel, valid once the handshake is done */
+  bool kernelSend() const { return kernel_send_; }
+
+  bool kernelRecv() const { return kernel_recv_; }
+
+  /* Decrypted bytes OpenSSL holds, not read from the socket anymore */
+  bool hasPending() const;
+
+  /* The peer ended the stream with close_notify rather than just a FIN */
+  bool receivedShutdown() const;
+
+  /**
+   * Decrypt into @buf, up to about MaxReadBytes per call. With kernelRecv()
+   * it only handles records other than application data, e.g. alerts,
+   * which make readv(2) fail with EIO
+   */
+  ssize_t read(Buffer* buf, int* saved_errno);
+
+  /**
+   * Encrypt and send @data. After -1 with EAGAIN the same bytes must be
+   * passed again first, pending output keeps its order so they are
+   */
+  ssize_t write(const void* data, size_t len);
+
+  /* Send close_notify, best effort */
+  void shutdown();
+
+  static const size_t MaxReadBytes = 64 * 1024;
+
+ private:
+  /* errno for an SSL_get_error() result */
+  int mapError(int ret);
+
+  SSL* ssl_;
+  /* Holds SSL_CTX alive while ssl_ uses it */
+  std::shared_ptr<TlsContext> context_;
+  bool want_write_;
+  bool kernel_send_;
+  bool kernel_recv_;
+};
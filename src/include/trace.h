@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <string>
+
+#include "macro.h"
+
+/**
+ * Event tracing into per-thread rings, exported as Chrome trace-event JSON
+ *
+ * Each thread that records an event gets a ring of the last RingCapacity
+ * events, written by that thread only: an event is a few relaxed stores and
+ * a release store of the head, timestamped by the cycle counter where there
+ * is one. Disabled, which is the default, an event costs one relaxed load
+ * and a branch. The framework records:
+ * - "poll", the wait of a loop in poll(2), with the number of ready channels
+ * - "handleEvents" of a Channel, with its fd
+ * - "message", the MessageCallback of a connection, with its id
+ * - "functor", a functor queued by another thread, linked to where it was
+ *   queued by a flow arrow, so work can be followed across loops and the
+ *   threads that post to them
+ * - "timer", a timer callback
+ *
+ * dump() reads the rings while they are written. Open the result in
+ * chrome://tracing or https://ui.perfetto.dev.
+ */
+class Tracer {
+ public:
+  /* Events kept per thread, a power of 2 */
+  static const size_t RingCapacity = 1 << 16;
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  /* Thread safe. Enabling again drops the rings of exited threads */
+  static void enable();
+
+  static void disable();
+
+  /* Nested scope on the calling thread, @arg_name may be nullptr */
+  static void begin(const char* name, const char* arg_name = nullptr,
+                    uint64_t arg = 0) {
+    if (enabled()) {
+      record('B', name, arg_name, arg);
+    }
+  }
+
+  static void end(const char* name, const char* arg_name = nullptr,
+                  uint64_t arg = 0) {
+    if (enabled()) {
+      record('E', name, arg_name, arg);
+    }
+  }
+
+  static void instant(const char* name, const char* arg_name = nullptr,
+                      uint64_t arg = 0) {
+    if (enabled()) {
+      record('i', name, arg_name, arg);
+    }
+  }
+
+  /**
+   * Arrow from here to the flowEnd() with the same @id, possibly on another
+   * thread. Ids come from newFlowId()
+   */
+  static void flowStart(const char* name, uint64_t id) {
+    if (enabled()) {
+      record('s', name, nullptr, id);
+    }
+  }
+
+  /* Ends on the scope begun next, or running, on this thread */
+  static void flowEnd(const char* name, uint64_t id) {
+    if (enabled()) {
+      record('f', name, nullptr, id);
+    }
+  }
+
+  static uint64_t newFlowId() {
+    return next_flow_id_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /* Every ring, oldest event first. Thread safe */
+  static std::string dump();
+
+  static bool dumpToFile(const std::string& path);
+
+ private:
+  friend class TraceScope;
+
+  class Ring;
+
+  /* Marks the ring of an exiting thread */
+  class ThreadExit;
+
+  /* Rings of all threads and the clock anchor, behind a mutex */
+  struct State;
+
+  static State& state();
+
+  static void record(char phase, const char* name, const char* arg_name,
+                     uint64_t arg);
+
+  static Ring* attachThread();
+
+  static void detachThread(Ring* ring);
+
+  /* Cycles on x86, else nanoseconds, converted in dump() */
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+  }
+
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint64_t> next_flow_id_;
+  static inline thread_local Ring* thread_ring_ = nullptr;
+};
+
+/**
+ * begin() here and end() when the scope exits, if tracing was enabled here.
+ * The end is recorded even if tracing is disabled meanwhile
+ */
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, const char* arg_name = nullptr,
+                      uint64_t arg = 0)
+      : name_(Tracer::enabled() ? name : nullptr) {
+    if (name_ != nullptr) {
+      Tracer::record('B', name_, arg_name, arg);
+    }
+  }
+
+  DISALLOW_COPY(TraceScope);
+
+  ~TraceScope() {
+    if (name_ != nullptr) {
+      Tracer::record('E', name_, nullptr, 0);
+    }
+  }
+
+ private:
+  const char* name_;
+};
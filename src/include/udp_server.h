@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "inet_addr.h"
+#include "macro.h"
+#include "udp_socket.h"
+
+class EventLoop;
+class EventLoopThreadPool;
+
+/**
+ * Directly managed by the user
+ *
+ * Every I/O loop owns one UdpSocket bound to the same port with SO_REUSEPORT,
+ * the kernel spreads incoming flows among them. With no thread, a single
+ * socket lives in the base loop.
+ */
+class UdpServer {
+ public:
+  UdpServer(EventLoop* loop, const InetAddress& listen_addr);
+
+  DISALLOW_COPY(UdpServer);
+
+  ~UdpServer();  // force out-line dtor, for unique_ptr members.
+
+  /**
+   * Set the number of I/O threads, same as TcpServer::setThreadNum
+   * Must be called before @c start
+   */
+  void setThreadNum(int num_threads);
+
+  /* Datagrams received per recvmmsg(2). Must be called before @c start */
+  void setBatchSize(int batch_size) { batch_size_ = batch_size; }
+
+  /* Size of one receive slot. Must be called before @c start */
+  void setMaxDatagramSize(size_t size) { max_datagram_size_ = size; }
+
+  /* Enable UDP_GRO on receive. Must be called before @c start */
+  void enableGro(bool on) { gro_ = on; }
+
+  /* Enable UDP_SEGMENT on send. Must be called before @c start */
+  void enableGso(bool on) { gso_ = on; }
+
+  /**
+   * Set datagram callback, invoked in the I/O thread of the receiving socket
+   * Not thread safe.
+   */
+  void setDatagramCallback(const UdpSocket::DatagramCallback& cb) {
+    datagram_cb_ = cb;
+  }
+
+  /**
+   * Create one socket per loop and start receiving
+   * Must be called in the base loop thread, harmless to call it multiple times
+   */
+  void start();
+
+ private:
+  /* The base loop */
+  EventLoop* loop_;
+  InetAddress listen_addr_;
+  std::unique_ptr<EventLoopThreadPool> thread_pool_;
+  UdpSocket::DatagramCallback datagram_cb_;
+  int batch_size_;
+  size_t max_datagram_size_;
+  bool gro_;
+  bool gso_;
+  bool started_;
+  /* Shared so that the I/O loop can hold the socket while stopping it */
+  std::vector<std::shared_ptr<UdpSocket>> sockets_;
+};
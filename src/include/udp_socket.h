@@ -0,0 +1,163 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "channel.h"
+#include "inet_addr.h"
+#include "macro.h"
+#include "socket.h"
+#include "timestamp.h"
+
+class EventLoop;
+
+/**
+ * A datagram socket bound to one EventLoop
+ *
+ * Datagrams are received in batches with recvmmsg(2) into a pool of fixed-size
+ * slots allocated once. Replies queued by send() during a batch are flushed
+ * with a single sendmmsg(2) at the end of that batch.
+ *
+ * Optionally:
+ * - UDP_GRO: the kernel coalesces datagrams of one flow into a slot, they are
+ *   split again before DatagramCallback is invoked
+ * - UDP_SEGMENT (GSO): consecutive equal-sized replies to the same peer are
+ *   sent as one super-datagram and segmented by the kernel
+ *
+ * IPv4 or IPv6, as the listen address. Unix domain addresses are rejected.
+ *
+ * All methods except send() must be called in the loop thread.
+ */
+class UdpSocket {
+ public:
+  /**
+   * @data points into the receive pool and is only valid during the call
+   */
+  using DatagramCallback =
+      std::function<void(UdpSocket*, const InetAddress& peer,
+                         std::string_view data, Timestamp recv_time)>;
+
+  static const int DefaultBatchSize = 64;
+  static const size_t DefaultMaxDatagramSize = 2048;
+  /* A GRO slot must be able to hold a whole coalesced super-datagram */
+  static const size_t GroSlotSize = 65536;
+  /* Upper bound of segments the kernel accepts in one UDP_SEGMENT send */
+  static const int MaxGsoSegments = 64;
+  /* Queued replies over this many bytes are dropped instead of buffered */
+  static const size_t MaxPendingBytes = 4 * 1024 * 1024;
+
+  UdpSocket(EventLoop* loop, const InetAddress& listen_addr, bool reuse_port);
+
+  DISALLOW_COPY(UdpSocket);
+
+  ~UdpSocket();
+
+  /* Must be called before start() */
+  void setBatchSize(int batch_size) { batch_size_ = batch_size; }
+
+  /* Must be called before start() */
+  void setMaxDatagramSize(size_t size) { max_datagram_size_ = size; }
+
+  /* Must be called before start() */
+  void enableGro(bool on) { gro_ = on; }
+
+  /* Must be called before start() */
+  void enableGso(bool on) { gso_ = on; }
+
+  void setDatagramCallback(const DatagramCallback& cb) { datagram_cb_ = cb; }
+
+  /**
+   * Allocate the batch pools and register to the loop
+   * Must be called in the loop thread
+   */
+  void start();
+
+  /**
+   * Unregister from the loop
+   * Must be called in the loop thread
+   */
+  void stop();
+
+  /**
+   * Queue a datagram to @peer
+   *
+   * Inside DatagramCallback it is flushed at the end of the receive batch,
+   * otherwise immediately. A @peer of another family than the socket is
+   * dropped. Thread safe, off-loop calls copy @data
+   */
+  void send(const InetAddress& peer, const void* data, size_t len);
+
+  EventLoop* getLoop() const { return loop_; }
+
+  int getFd() const { return socket_.getFd(); }
+
+  /**
+   * Datagrams dropped because of truncation, a full send queue or a peer of
+   * the wrong family
+   */
+  uint64_t droppedCount() const { return dropped_; }
+
+ private:
+  /* A queued reply, payload lives in send_data_[offset, offset + len) */
+  struct PendingDatagram {
+    size_t offset;
+    size_t len;
+    InetAddress peer;
+  };
+
+  void handleRead(Timestamp recv_time);
+
+  void handleWrite();
+
+  void sendInLoop(const InetAddress& peer, const std::string& data);
+
+  /* Re-arm msg_namelen, msg_controllen and iov_len before each recvmmsg */
+  void resetRecvSlots();
+
+  /* Payload size of each GRO segment of slot @i, 0 if not coalesced */
+  size_t groSegmentSize(int i);
+
+  /* Send as many pending datagrams as the kernel accepts */
+  void flushPending();
+
+  EventLoop* loop_;
+  /* AF_INET or AF_INET6 */
+  const sa_family_t family_;
+  Socket socket_;
+  Channel channel_;
+  DatagramCallback datagram_cb_;
+
+  int batch_size_;
+  size_t max_datagram_size_;
+  bool gro_;
+  bool gso_;
+  bool started_;
+  /* True while dispatching a receive batch, sends are deferred */
+  bool in_batch_;
+
+  /* Receive pool: batch_size_ slots of slot_size_ bytes */
+  size_t slot_size_;
+  std::vector<char> recv_pool_;
+  std::vector<struct mmsghdr> recv_msgs_;
+  std::vector<struct iovec> recv_iovs_;
+  std::vector<struct sockaddr_storage> recv_addrs_;
+  std::vector<char> recv_control_;
+  size_t control_size_;
+
+  /* Send queue, payloads are packed back to back in send_data_ */
+  std::vector<char> send_data_;
+  std::vector<PendingDatagram> pending_;
+  std::vector<struct mmsghdr> send_msgs_;
+  std::vector<struct iovec> send_iovs_;
+  std::vector<char> send_control_;
+  /* Number of pending datagrams carried by each message of one sendmmsg */
+  std::vector<size_t> send_groups_;
+
+  uint64_t dropped_;
+};
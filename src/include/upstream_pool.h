@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "callbacks.h"
+#include "inet_addr.h"
+#include "macro.h"
+#include "tcp_client.h"
+
+class EventLoop;
+
+/**
+ * Warm connections from one EventLoop to a set of backends
+ *
+ * Create one pool per I/O loop, e.g. looked up by conn->getLoop() in a
+ * TcpServer callback. Every connection of the pool lives in that loop, so
+ * leasing and releasing are plain vector operations: no lock, no cross-thread
+ * handoff. Each backend keeps a fixed number of TcpClients with retry
+ * enabled, a lost connection is re-established through Connector backoff.
+ *
+ * All methods must be called in the loop thread.
+ */
+class UpstreamPool {
+ public:
+  /* Passed nullptr when the lease can't be served */
+  using LeaseCallback = std::function<void(const TcpConnectionPtr&)>;
+
+  /* Leases waiting for a connection beyond this are failed at once */
+  static const size_t DefaultMaxWaiters = 1024;
+
+  explicit UpstreamPool(EventLoop* loop);
+
+  DISALLOW_COPY(UpstreamPool);
+
+  ~UpstreamPool();
+
+  void setMaxWaiters(size_t max_waiters) { max_waiters_ = max_waiters; }
+
+  /**
+   * Open @connections connections to @server_addr
+   * @return backend index for lease() and release()
+   */
+  int addBackend(const InetAddress& server_addr, size_t connections);
+
+  /**
+   * Hand an idle connection of @backend to @cb, immediately if one is idle,
+   * otherwise once one is released or established.
+   *
+   * The lessee owns the connection until release(): it installs its own
+   * message and write complete callbacks and must not leave a request in
+   * flight when giving it back.
+   */
+  void lease(int backend, const LeaseCallback& cb);
+
+  /* Give @conn back to @backend, dropped if it is no longer connected */
+  void release(int backend, const TcpConnectionPtr& conn);
+
+  size_t idleCount(int backend) const;
+
+  size_t waiterCount(int backend) const;
+
+ private:
+  struct Backend {
+    explicit Backend(const InetAddress& addr) : server_addr(addr) {}
+
+    InetAddress server_addr;
+    std::vector<std::unique_ptr<TcpClient>> clients;
+    /* LIFO, the most recently used connection is the warmest */
+    std::vector<TcpConnectionPtr> idle;
+    std::deque<LeaseCallback> waiters;
+  };
+
+  /* ConnectionCallback of every client of @backend */
+  void onConnection(Backend* backend, const TcpConnectionPtr& conn);
+
+  /* MessageCallback of idle connections, no response is expected */
+  void onIdleMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                     Timestamp recv_time);
+
+  /* Serve the oldest waiter with @conn, or park it in idle */
+  void putIdle(Backend* backend, const TcpConnectionPtr& conn);
+
+  EventLoop* loop_;
+  size_t max_waiters_;
+  std::vector<std::unique_ptr<Backend>> backends_;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "callbacks.h"
+#include "slice.h"
+#include "tcp_connection.h"
+
+class HttpRequest;
+class HttpResponse;
+
+enum class WebSocketOpcode : uint8_t {
+  Continuation = 0x0,
+  Text = 0x1,
+  Binary = 0x2,
+  Close = 0x8,
+  Ping = 0x9,
+  Pong = 0xA,
+};
+
+/**
+ * Server side codec of WebSocket frames (RFC 6455), one per connection
+ *
+ * @code
+ * +-+-+-+-+-------+-+-------------+-------------------------------+
+ * |F|R|R|R| opcode|M| Payload len |    Extended payload length    |
+ * |I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
+ * |N|V|V|V|       |S|             |                               |
+ * +-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
+ * |     Masking-key (32), client to server only   |  Payload ...  |
+ * +-----------------------------------------------+---------------+
+ * @endcode
+ *
+ * Frames are decoded in place: the payload is unmasked inside the input
+ * Buffer and an unfragmented message is delivered as a view of it. Fragments
+ * are joined in a per-connection string whose capacity is reused. Pings are
+ * answered, pongs are dropped, a close frame is echoed and the connection is
+ * shut down. Protocol errors close the connection with the matching status.
+ *
+ * Usually installed by HttpServer after the upgrade handshake, see
+ * HttpServer::setWebSocketCallback(). Over a raw TcpServer, answer the
+ * handshake yourself and then route the connection's messages to onMessage().
+ */
+class WebSocketCodec {
+ public:
+  /**
+   * A complete Text or Binary message
+   * @payload points into the input Buffer or the codec, and is only valid
+   * during the call
+   */
+  using MessageCallback =
+      std::function<void(const TcpConnectionPtr&, WebSocketOpcode opcode,
+                         std::string_view payload, Timestamp recv_time)>;
+
+  static const size_t DefaultMaxMessageSize = 16 * 1024 * 1024;
+
+  /* Control frames carry at most this much payload */
+  static const size_t MaxControlPayload = 125;
+
+  /* Close status codes */
+  static const uint16_t CloseNormal = 1000;
+  static const uint16_t CloseGoingAway = 1001;
+  static const uint16_t CloseProtocolError = 1002;
+  static const uint16_t CloseMessageTooBig = 1009;
+
+  explicit WebSocketCodec(const MessageCallback& cb,
+                          size_t max_message_size = DefaultMaxMessageSize)
+      : message_cb_(cb),
+        max_message_size_(max_message_size),
+        fragment_opcode_(WebSocketOpcode::Continuation),
+        closing_(false) {}
+
+  /* default copy is Okay, std::any needs it; copy before the first frame */
+
+  /**
+   * MessageCallback of TcpConnection
+   *
+   * Handles every complete frame in @buf before returning
+   */
+  void onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                 Timestamp recv_time);
+
+  /* A close frame was sent, further input is discarded */
+  bool closing() const { return closing_; }
+
+  /**
+   * Append one unmasked server frame to @output
+   * Unset @fin for all but the last fragment of a message
+   */
+  static void encode(WebSocketOpcode opcode, std::string_view payload,
+                     bool fin, Buffer* output);
+
+  /* Same as above, serialized once into a Slice to share */
+  static Slice makeFrame(WebSocketOpcode opcode, std::string_view payload,
+                         bool fin = true);
+
+  /* Send one unfragmented message. Thread safe */
+  static void send(const TcpConnectionPtr& conn, WebSocketOpcode opcode,
+                   std::string_view payload);
+
+  /**
+   * Send one message to every connection in @conns
+   *
+   * The frame is serialized once and queued on each connection by reference,
+   * so fanning out costs a refcount per connection. Thread safe
+   */
+  static void broadcast(const std::vector<TcpConnectionPtr>& conns,
+                        WebSocketOpcode opcode, std::string_view payload);
+
+  /* Send a close frame and shut the connection down. Thread safe */
+  static void close(const TcpConnectionPtr& conn,
+                    uint16_t code = CloseNormal,
+                    std::string_view reason = std::string_view());
+
+  /**
+   * XOR @data in place with the 4-byte masking key, the key phase starting
+   * at @data. Vectorized where the target allows it
+   */
+  static void unmask(char* data, size_t len, const uint8_t key[4]);
+
+  /* GET with "Upgrade: websocket" and "Connection: Upgrade" */
+  static bool isUpgradeRequest(const HttpRequest& request);
+
+  /**
+   * Answer an upgrade request: a 101 response carrying Sec-WebSocket-Accept,
+   * or 400 if the handshake is not valid
+   * @return whether the upgrade is accepted
+   */
+  static bool acceptUpgrade(const HttpRequest& request,
+                            HttpResponse* response);
+
+  /* base64(SHA-1(@key + GUID)), the Sec-WebSocket-Accept value */
+  static std::string acceptKey(std::string_view key);
+
+ private:
+  /**
+   * Handle one decoded frame, @payload is already unmasked
+   * @return 0, or the close status of a protocol error
+   */
+  uint16_t onFrame(const TcpConnectionPtr& conn, bool fin,
+                   WebSocketOpcode opcode, std::string_view payload,
+                   Timestamp recv_time);
+
+  /* Close with @code and drop the rest of the input */
+  void fail(const TcpConnectionPtr& conn, Buffer* buf, uint16_t code);
+
+  MessageCallback message_cb_;
+  size_t max_message_size_;
+  /* Fragments of the message in progress, Continuation if none */
+  std::string fragments_;
+  WebSocketOpcode fragment_opcode_;
+  bool closing_;
+};
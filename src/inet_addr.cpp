@@ -1,8 +1,13 @@
 #include "inet_addr.h"
 
 #include <netinet/in.h>
+#include <stddef.h>  // offsetof
+#include <string.h>
 #include <strings.h>  // bzero
 
+#include <algorithm>
+
+#include "logging.h"
 #include "sockets_options.h"
 
 /**
@@ -24,20 +29,107 @@
 
 static const in_addr_t kInaddrAny = INADDR_ANY;
 
-InetAddress::InetAddress(uint16_t port) {
+const socklen_t InetAddress::Capacity = sizeof(InetAddress::addr_);
+
+InetAddress::InetAddress(uint16_t port, bool ipv6) {
   bzero(&addr_, sizeof addr_);
-  addr_.sin_family = AF_INET;
-  addr_.sin_addr.s_addr = sockets::hostToNetwork32(kInaddrAny);
-  addr_.sin_port = sockets::hostToNetwork16(port);
+  if (ipv6) {
+    addr_.in6.sin6_family = AF_INET6;
+    addr_.in6.sin6_addr = in6addr_any;
+    addr_.in6.sin6_port = sockets::hostToNetwork16(port);
+    len_ = sizeof addr_.in6;
+  } else {
+    addr_.in.sin_family = AF_INET;
+    addr_.in.sin_addr.s_addr = sockets::hostToNetwork32(kInaddrAny);
+    addr_.in.sin_port = sockets::hostToNetwork16(port);
+    len_ = sizeof addr_.in;
+  }
 }
 
 InetAddress::InetAddress(const std::string& ip, uint16_t port) {
   bzero(&addr_, sizeof addr_);
-  sockets::fromHostPort(ip.c_str(), port, &addr_);
+  if (ip.find(':') != std::string::npos) {
+    sockets::fromHostPort(ip.c_str(), port, &addr_.in6);
+    len_ = sizeof addr_.in6;
+  } else {
+    sockets::fromHostPort(ip.c_str(), port, &addr_.in);
+    len_ = sizeof addr_.in;
+  }
+}
+
+InetAddress::InetAddress(const struct sockaddr_in& addr) {
+  setSockAddrInet(addr);
+}
+
+InetAddress::InetAddress(const struct sockaddr_in6& addr) {
+  bzero(&addr_, sizeof addr_);
+  addr_.in6 = addr;
+  len_ = sizeof addr_.in6;
+}
+
+InetAddress::InetAddress(const struct sockaddr* addr, socklen_t len) {
+  bzero(&addr_, sizeof addr_);
+  len_ = std::min(len, Capacity);
+  memcpy(&addr_, addr, len_);
+}
+
+/**
+ * The length counts the path: with its terminating NUL in the filesystem,
+ * without any in the abstract namespace, whose names start with a NUL
+ */
+InetAddress InetAddress::fromUnixPath(const std::string& path) {
+  InetAddress addr;
+  bzero(&addr.addr_, sizeof addr.addr_);
+  addr.addr_.un.sun_family = AF_UNIX;
+  const size_t max_len = sizeof addr.addr_.un.sun_path - 1;
+  const size_t len = std::min(path.size(), max_len);
+  if (len < path.size()) {
+    LOG << "InetAddress::fromUnixPath path too long " << path;
+  }
+  memcpy(addr.addr_.un.sun_path, path.data(), len);
+  if (!path.empty() && path[0] == '@') {
+    addr.addr_.un.sun_path[0] = '\0';
+    addr.len_ = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                       len);
+  } else {
+    addr.len_ = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                       len + 1);
+  }
+  return addr;
+}
+
+void InetAddress::setSockAddrInet(const struct sockaddr_in& addr) {
+  bzero(&addr_, sizeof addr_);
+  addr_.in = addr;
+  len_ = sizeof addr_.in;
+}
+
+uint16_t InetAddress::port() const {
+  switch (family()) {
+    case AF_INET:
+      return sockets::networkToHost16(addr_.in.sin_port);
+    case AF_INET6:
+      return sockets::networkToHost16(addr_.in6.sin6_port);
+    default:
+      return 0;
+  }
 }
 
 std::string InetAddress::toHostPort() const {
-  char buf[32];
-  sockets::toHostPort(buf, sizeof buf, addr_);
+  if (isUnix()) {
+    const size_t path_len =
+        len_ > offsetof(struct sockaddr_un, sun_path)
+            ? len_ - offsetof(struct sockaddr_un, sun_path)
+            : 0;
+    if (path_len == 0) {
+      return "unix";
+    }
+    if (addr_.un.sun_path[0] == '\0') {
+      return "@" + std::string(addr_.un.sun_path + 1, path_len - 1);
+    }
+    return std::string(addr_.un.sun_path, strnlen(addr_.un.sun_path, path_len));
+  }
+  char buf[64];
+  sockets::toHostPort(buf, sizeof buf, getSockAddr());
   return buf;
 }
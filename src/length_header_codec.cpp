@@ -0,0 +1,43 @@
+#include "length_header_codec.h"
+
+#include "buffer.h"
+#include "logging.h"
+
+void LengthHeaderCodec::onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                                  Timestamp recv_time) {
+  /* Drain all complete frames read by this handleRead() */
+  while (buf->readableBytes() >= HeaderLen) {
+    const int32_t len = buf->peekInt32();
+    if (len < 0 || static_cast<size_t>(len) > max_frame_size_) {
+      LOG << "LengthHeaderCodec::onMessage [" << conn->name()
+          << "] invalid frame length " << len;
+      buf->retrieveAll();
+      conn->shutdown();
+      break;
+    }
+
+    if (buf->readableBytes() < HeaderLen + len) {
+      /* Incomplete frame, wait for more data */
+      break;
+    }
+
+    buf->retrieveInt32();
+    frame_cb_(conn, std::string_view(buf->peek(), len), recv_time);
+    buf->retrieve(len);
+  }
+}
+
+void LengthHeaderCodec::encode(Buffer* body) {
+  body->prependInt32(static_cast<int32_t>(body->readableBytes()));
+}
+
+bool LengthHeaderCodec::send(const TcpConnectionPtr& conn, Buffer* body) const {
+  if (body->readableBytes() > max_frame_size_) {
+    LOG << "LengthHeaderCodec::send [" << conn->name() << "] frame of "
+        << body->readableBytes() << " bytes exceeds " << max_frame_size_;
+    return false;
+  }
+  encode(body);
+  conn->send(body);
+  return true;
+}
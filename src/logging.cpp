@@ -0,0 +1,41 @@
+#include "logging.h"
+
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+std::string Logger::logFileName_ = "./yatws.log";
+
+Logger::Impl::Impl(const char *fileName, int line)
+    : stream_(), line_(line), basename_(fileName) {
+  const size_t slash = basename_.rfind('/');
+  if (slash != std::string::npos) {
+    basename_ = basename_.substr(slash + 1);
+  }
+  formatTime();
+}
+
+void Logger::Impl::formatTime() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  struct tm tm_time;
+  localtime_r(&tv.tv_sec, &tm_time);
+  char buf[32];
+  size_t len = strftime(buf, sizeof buf, "%Y-%m-%d %H:%M:%S", &tm_time);
+  len += snprintf(buf + len, sizeof buf - len, ".%06ld ",
+                  static_cast<long>(tv.tv_usec));
+  stream_.append(buf, static_cast<int>(len));
+}
+
+Logger::Logger(const char *fileName, int line) : impl_(fileName, line) {}
+
+/**
+ * One write(2) per line, so lines of concurrent threads don't interleave.
+ * AsyncLogging isn't wired in, lines go to stderr
+ */
+Logger::~Logger() {
+  impl_.stream_ << " -- " << impl_.basename_ << ':' << impl_.line_ << '\n';
+  const LogStream::Buffer &buf(stream().buffer());
+  ssize_t n = ::write(STDERR_FILENO, buf.data(), buf.length());
+  (void)n;
+}
@@ -0,0 +1,127 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+
+#include "connection_registry.h"
+#include "event_loop.h"
+#include "logging.h"
+#include "tcp_connection.h"
+
+constexpr double MemoryAccount::CheckInterval;
+
+MemoryAccount::MemoryAccount(
+    EventLoop* loop,
+    const std::shared_ptr<const ConnectionRegistry>& connections,
+    const std::shared_ptr<MemoryBudget>& budget, const MemoryLimits& per_loop)
+    : loop_(loop),
+      connections_(connections),
+      budget_(budget),
+      limits_(per_loop),
+      used_(0),
+      check_armed_(false) {
+  assert(budget_);
+}
+
+MemoryAccount::~MemoryAccount() {
+  if (check_armed_) {
+    loop_->cancel(check_timer_);
+  }
+}
+
+void MemoryAccount::armCheck() {
+  check_armed_ = true;
+  check_timer_ = loop_->runAfter(CheckInterval, [this] { onCheck(); });
+}
+
+size_t MemoryAccount::excessOver(size_t loop_limit,
+                                 size_t process_limit) const {
+  size_t excess = 0;
+  if (loop_limit > 0 && used_ > loop_limit) {
+    excess = used_ - loop_limit;
+  }
+  const size_t process_used = budget_->used();
+  if (process_limit > 0 && process_used > process_limit) {
+    /* Other loops may hold most of it, this loop can only give its own */
+    excess = std::max(excess, std::min(process_used - process_limit, used_));
+  }
+  return excess;
+}
+
+void MemoryAccount::collectConsumers(const ConnectionRegistry& connections) {
+  consumers_.clear();
+  connections.forEach([this](const TcpConnectionPtr& conn) {
+    if (conn->connected()) {
+      consumers_.emplace_back(conn->memoryFootprint(), conn);
+    }
+  });
+  std::sort(consumers_.begin(), consumers_.end(),
+            [](const Consumer& a, const Consumer& b) {
+              return a.first > b.first;
+            });
+}
+
+bool MemoryAccount::belowResumeMark() const {
+  const size_t loop_mark = limits_.soft_limit / 8 * 7;
+  const size_t process_mark = budget_->limits().soft_limit / 8 * 7;
+  return (loop_mark == 0 || used_ < loop_mark) &&
+         (process_mark == 0 || budget_->used() < process_mark);
+}
+
+/**
+ * Hard limit first: closing frees memory at once, pausing only stops the
+ * growth. A consumer counts once, its footprint settles the excess it covers
+ */
+void MemoryAccount::onCheck() {
+  loop_->assertInLoopThread();
+  check_armed_ = false;
+  std::shared_ptr<const ConnectionRegistry> connections = connections_.lock();
+  if (!connections) {
+    /* The server is gone and has destroyed its connections */
+    paused_.clear();
+    return;
+  }
+
+  size_t excess = excessOver(limits_.hard_limit, budget_->limits().hard_limit);
+  if (excess > 0) {
+    collectConsumers(*connections);
+    for (const Consumer& consumer : consumers_) {
+      if (excess == 0 || consumer.first == 0) {
+        break;
+      }
+      LOG << "MemoryAccount::onCheck hard limit, closing ["
+          << consumer.second->name() << "] holding " << consumer.first;
+      consumer.second->forceClose();
+      budget_->noteClosed();
+      excess -= std::min(excess, consumer.first);
+    }
+  }
+
+  excess = excessOver(limits_.soft_limit, budget_->limits().soft_limit);
+  if (excess > 0) {
+    collectConsumers(*connections);
+    for (const Consumer& consumer : consumers_) {
+      if (excess == 0 || consumer.first == 0) {
+        break;
+      }
+      if (!consumer.second->memoryPaused()) {
+        consumer.second->setMemoryPaused(true);
+        paused_.push_back(consumer.second);
+        budget_->notePausedRead();
+      }
+      excess -= std::min(excess, consumer.first);
+    }
+  } else if (!paused_.empty() && belowResumeMark()) {
+    for (const auto& weak_conn : paused_) {
+      TcpConnectionPtr conn = weak_conn.lock();
+      if (conn) {
+        conn->setMemoryPaused(false);
+      }
+    }
+    paused_.clear();
+  }
+  consumers_.clear();
+
+  if (!paused_.empty() || overSoftLimit() || overHardLimit()) {
+    armCheck();
+  }
+}
@@ -0,0 +1,221 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "logging.h"
+
+namespace {
+double toDouble(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof value);
+  return value;
+}
+
+uint64_t toBits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  return bits;
+}
+}  // namespace
+
+class MetricsRegistry::ThreadExit {
+ public:
+  explicit ThreadExit(ThreadCells* cells) : cells_(cells) {}
+
+  ~ThreadExit() { MetricsRegistry::instance().detachThread(cells_); }
+
+ private:
+  ThreadCells* cells_;
+};
+
+MetricsRegistry::ThreadCells::ThreadCells() {
+  for (size_t i = 0; i < MaxCells; ++i) {
+    cells[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+/* Never destroyed, threads still running at exit may update metrics */
+MetricsRegistry& MetricsRegistry::instance() {
+  static MetricsRegistry* registry = new MetricsRegistry;
+  return *registry;
+}
+
+MetricsRegistry::MetricsRegistry() : double_cells_(MaxCells), next_cell_(0) {}
+
+size_t MetricsRegistry::add(Metric* metric, size_t count,
+                            size_t double_count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (next_cell_ + count > MaxCells) {
+    LOG << "MetricsRegistry::add " << metric->name() << " exceeds "
+        << static_cast<int>(MaxCells) << " cells";
+    assert(false);
+  }
+  const size_t first = next_cell_;
+  next_cell_ += count;
+  for (size_t i = count - double_count; i < count; ++i) {
+    double_cells_[first + i] = true;
+  }
+  metrics_.push_back(metric);
+  return first;
+}
+
+void MetricsRegistry::remove(Metric* metric) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metrics_.erase(std::find(metrics_.begin(), metrics_.end(), metric));
+}
+
+MetricsRegistry::ThreadCells* MetricsRegistry::attachThread() {
+  ThreadCells* cells = new ThreadCells;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(cells);
+  }
+  thread_cells_ = cells;
+  thread_local ThreadExit thread_exit(cells);
+  return cells;
+}
+
+void MetricsRegistry::detachThread(ThreadCells* cells) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < next_cell_; ++i) {
+      const uint64_t value = cells->cells[i].load(std::memory_order_relaxed);
+      std::atomic<uint64_t>& retired = retired_.cells[i];
+      if (double_cells_[i]) {
+        retired.store(toBits(toDouble(retired.load()) + toDouble(value)));
+      } else {
+        retired.fetch_add(value);
+      }
+    }
+    threads_.erase(std::find(threads_.begin(), threads_.end(), cells));
+  }
+  thread_cells_ = nullptr;
+  delete cells;
+}
+
+uint64_t MetricsRegistry::sum(size_t cell) const {
+  uint64_t total = retired_.cells[cell].load(std::memory_order_relaxed);
+  for (const ThreadCells* cells : threads_) {
+    total += cells->cells[cell].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+double MetricsRegistry::sumDouble(size_t cell) const {
+  double total =
+      toDouble(retired_.cells[cell].load(std::memory_order_relaxed));
+  for (const ThreadCells* cells : threads_) {
+    total += toDouble(cells->cells[cell].load(std::memory_order_relaxed));
+  }
+  return total;
+}
+
+std::string MetricsRegistry::scrape() {
+  std::string out;
+  std::lock_guard<std::mutex> lock(mutex_);
+  out.reserve(metrics_.size() * 128);
+  for (const Metric* metric : metrics_) {
+    out += "# HELP ";
+    out += metric->name_;
+    out += ' ';
+    out += metric->help_;
+    out += "\n# TYPE ";
+    out += metric->name_;
+    out += ' ';
+    out += metric->type_;
+    out += '\n';
+    metric->collect(&out);
+  }
+  return out;
+}
+
+Metric::Metric(const std::string& name, const std::string& help,
+               const char* type, size_t cell_count, size_t double_count)
+    : registry_(&MetricsRegistry::instance()),
+      name_(name),
+      help_(help),
+      type_(type),
+      first_cell_(0) {
+  first_cell_ = registry_->add(this, cell_count, double_count);
+}
+
+Metric::~Metric() { registry_->remove(this); }
+
+uint64_t Metric::sum(size_t i) const {
+  return registry_->sum(first_cell_ + i);
+}
+
+uint64_t Metric::total(size_t i) const {
+  std::lock_guard<std::mutex> lock(registry_->mutex_);
+  return registry_->sum(first_cell_ + i);
+}
+
+double Metric::sumDouble(size_t i) const {
+  return registry_->sumDouble(first_cell_ + i);
+}
+
+void Metric::appendSample(std::string* out, const std::string& name,
+                          const char* suffix, const char* labels,
+                          double value) {
+  char buf[64];
+  out->append(name);
+  out->append(suffix);
+  out->append(labels);
+  snprintf(buf, sizeof buf, " %.16g\n", value);
+  out->append(buf);
+}
+
+void Counter::collect(std::string* out) const {
+  appendSample(out, name(), "", "", static_cast<double>(sum(0)));
+}
+
+void Gauge::collect(std::string* out) const {
+  const int64_t level = static_cast<int64_t>(sum(0));
+  appendSample(out, name(), "", "", static_cast<double>(level));
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help,
+                     const std::vector<double>& bounds)
+    : Metric(name, help, "histogram", bounds.size() + 2, 1), bounds_(bounds) {
+  assert(std::is_sorted(bounds_.begin(), bounds_.end()));
+}
+
+std::vector<double> Histogram::exponentialBuckets(double start, double factor,
+                                                  size_t count) {
+  std::vector<double> bounds(count);
+  for (size_t i = 0; i < count; ++i) {
+    bounds[i] = start;
+    start *= factor;
+  }
+  return bounds;
+}
+
+/* Cells: a count per bucket, the +Inf bucket, then the sum */
+void Histogram::observe(double value) {
+  const size_t bucket =
+      std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+  addTo(cell(bucket), 1);
+  std::atomic<uint64_t>& sum_cell = cell(bounds_.size() + 1);
+  sum_cell.store(
+      toBits(toDouble(sum_cell.load(std::memory_order_relaxed)) + value),
+      std::memory_order_relaxed);
+}
+
+void Histogram::collect(std::string* out) const {
+  char labels[48];
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < bounds_.size(); ++i) {
+    cumulative += sum(i);
+    snprintf(labels, sizeof labels, "{le=\"%.9g\"}", bounds_[i]);
+    appendSample(out, name(), "_bucket", labels,
+                 static_cast<double>(cumulative));
+  }
+  cumulative += sum(bounds_.size());
+  appendSample(out, name(), "_bucket", "{le=\"+Inf\"}",
+               static_cast<double>(cumulative));
+  appendSample(out, name(), "_sum", "", sumDouble(bounds_.size() + 1));
+  appendSample(out, name(), "_count", "", static_cast<double>(cumulative));
+}
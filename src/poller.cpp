@@ -4,12 +4,22 @@
 
 #include "channel.h"
 #include "logging.h"
+#include "metrics.h"
+
+namespace {
+Histogram ready_histogram("poller_ready_channels",
+                          "Channels reported ready per poll(2) return",
+                          {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024});
+}  // namespace
 
 Poller::Poller(EventLoop* loop) : owner_loop_(loop) {}
 
 Timestamp Poller::poll(int timeoutMs, ChannelList* activeChannels) {
   int numEvents = ::poll(poll_fds_.data(), poll_fds_.size(), timeoutMs);
   Timestamp now(Timestamp::now());
+  if (numEvents >= 0) {
+    ready_histogram.observe(numEvents);
+  }
   if (numEvents > 0) {
     LOG << numEvents << " events happened";
     fillActiveChannels(numEvents, activeChannels);
@@ -64,13 +74,19 @@ void Poller::updateChannel(Channel* channel) {
     /* Update */
     struct pollfd& pfd = poll_fds_[idx];
     assert(pfd.fd == channel->getFd() || pfd.fd == -channel->getFd() - 1);
-    pfd.events = channel->getEvents();
-    pfd.revents = 0;
-    if (channel->isNoneEvent()) {
-      /* Ignore this pollfd */
-      // TODO(Q): why set to this?
-      pfd.fd = -channel->getFd() - 1;
+    /**
+     * poll(2) ignores negative fds, -fd - 1 keeps fd 0 negative too and the
+     * fd recoverable. Restored once the Channel is interested again
+     */
+    const int fd =
+        channel->isNoneEvent() ? -channel->getFd() - 1 : channel->getFd();
+    if (pfd.fd == fd && pfd.events == channel->getEvents()) {
+      /* Changes of the last iteration cancelled out */
+      return;
     }
+    pfd.fd = fd;
+    pfd.events = static_cast<short>(channel->getEvents());
+    pfd.revents = 0;
   }
 }
 
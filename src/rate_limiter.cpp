@@ -0,0 +1,49 @@
+#include "rate_limiter.h"
+
+#include "event_loop.h"
+#include "tcp_connection.h"
+
+constexpr double RateLimiter::RefillInterval;
+
+RateLimiter::RateLimiter(EventLoop* loop, const RateLimit& per_connection,
+                         const RateLimit& per_loop)
+    : loop_(loop),
+      per_connection_(per_connection),
+      ingress_(per_loop.ingress_rate, per_loop.ingress_burst),
+      egress_(per_loop.egress_rate, per_loop.egress_burst),
+      timer_armed_(false) {}
+
+RateLimiter::~RateLimiter() {
+  if (timer_armed_) {
+    loop_->cancel(timer_);
+  }
+}
+
+void RateLimiter::throttle(const TcpConnectionPtr& conn) {
+  loop_->assertInLoopThread();
+  throttled_.push_back(conn);
+  if (!timer_armed_) {
+    timer_armed_ = true;
+    timer_ = loop_->runAfter(RefillInterval, [this] { onTick(); });
+  }
+}
+
+/**
+ * Refill the loop-wide buckets first, so a connection that only waited for
+ * them can go again. Connections still short stay on the list, in order
+ */
+void RateLimiter::onTick() {
+  timer_armed_ = false;
+  const int64_t now_us = Timestamp::now().microSecondsSinceEpoch();
+  ingress_.refill(now_us);
+  egress_.refill(now_us);
+
+  refilling_.swap(throttled_);
+  for (const auto& weak_conn : refilling_) {
+    TcpConnectionPtr conn = weak_conn.lock();
+    if (conn && conn->refillRate(now_us)) {
+      throttle(conn);
+    }
+  }
+  refilling_.clear();
+}
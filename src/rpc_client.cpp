@@ -0,0 +1,174 @@
+#include "rpc_client.h"
+
+#include <algorithm>
+
+#include "event_loop.h"
+#include "logging.h"
+
+constexpr double RpcClient::DefaultTimeout;
+constexpr double RpcClient::DeadlineResolution;
+
+RpcClient::RpcClient(EventLoop* loop, const InetAddress& server_addr,
+                     const std::string& name)
+    : loop_(loop),
+      client_(loop, server_addr, name),
+      codec_(std::bind(&RpcClient::onFrame, this, std::placeholders::_1,
+                       std::placeholders::_2, std::placeholders::_3,
+                       std::placeholders::_4)),
+      pending_(0) {
+  client_.setConnectionCallback(
+      std::bind(&RpcClient::onConnection, this, std::placeholders::_1));
+  client_.setMessageCallback(
+      std::bind(&RpcCodec::onMessage, &codec_, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+}
+
+RpcClient::~RpcClient() {
+  loop_->assertInLoopThread();
+  if (conn_) {
+    /* The connection outlives the client until ~TcpClient closes it */
+    conn_->setConnectionCallback([](const TcpConnectionPtr&) {});
+    conn_->setMessageCallback(
+        [](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+          buf->retrieveAll();
+        });
+    conn_.reset();
+  }
+  failAll(RpcStatus::Unavailable);
+  if (timer_at_.valid()) {
+    loop_->cancel(timer_);
+  }
+}
+
+void RpcClient::onConnection(const TcpConnectionPtr& conn) {
+  if (conn->connected()) {
+    conn->setTcpNoDelay(true);
+    /* Calls issued in one loop iteration leave with one syscall */
+    conn->setAutoCork(true);
+    conn_ = conn;
+  } else {
+    conn_.reset();
+    /* Their responses are lost with the connection */
+    failAll(RpcStatus::Unavailable);
+  }
+  if (connection_cb_) {
+    connection_cb_(conn);
+  }
+}
+
+void RpcClient::call(uint16_t method, std::string_view request,
+                     ResponseCallback cb, double timeout) {
+  loop_->assertInLoopThread();
+  if (!conn_) {
+    cb(RpcStatus::Unavailable, std::string_view());
+    return;
+  }
+
+  uint32_t index;
+  if (!free_slots_.empty()) {
+    index = free_slots_.back();
+    free_slots_.pop_back();
+  } else {
+    index = static_cast<uint32_t>(slots_.size());
+    slots_.emplace_back();
+  }
+  Slot& slot = slots_[index];
+  slot.cb = std::move(cb);
+  slot.active = true;
+  ++pending_;
+  const uint64_t id = idOf(index, slot.generation);
+
+  deadlines_.push_back(Deadline{addTime(Timestamp::now(), timeout), id});
+  std::push_heap(deadlines_.begin(), deadlines_.end());
+  armTimer();
+
+  RpcHeader header;
+  header.type = RpcHeader::Request;
+  header.status = RpcStatus::Ok;
+  header.method = method;
+  header.id = id;
+  RpcCodec::send(conn_, header, request);
+}
+
+void RpcClient::onFrame(const TcpConnectionPtr& conn, const RpcHeader& header,
+                        std::string_view payload, Timestamp) {
+  if (header.type != RpcHeader::Response) {
+    LOG << "RpcClient::onFrame [" << conn->name() << "] unexpected request";
+    conn->shutdown();
+    return;
+  }
+  complete(header.id, header.status, payload);
+}
+
+/**
+ * The callback is moved out and the slot freed first, so the callback may
+ * issue the next call into the same slot
+ */
+void RpcClient::complete(uint64_t id, RpcStatus status,
+                         std::string_view response) {
+  const uint32_t index = static_cast<uint32_t>(id);
+  if (index >= slots_.size()) {
+    return;
+  }
+  Slot& slot = slots_[index];
+  if (!slot.active || slot.generation != static_cast<uint32_t>(id >> 32)) {
+    /* Timed out already, or a stray id */
+    return;
+  }
+  ResponseCallback cb = std::move(slot.cb);
+  slot.cb = nullptr;
+  slot.active = false;
+  ++slot.generation;
+  free_slots_.push_back(index);
+  if (--pending_ == 0) {
+    /* Every entry left is stale */
+    deadlines_.clear();
+  }
+  cb(status, response);
+}
+
+void RpcClient::failAll(RpcStatus status) {
+  for (size_t i = 0; i < slots_.size() && pending_ > 0; ++i) {
+    if (slots_[i].active) {
+      complete(idOf(static_cast<uint32_t>(i), slots_[i].generation), status,
+               std::string_view());
+    }
+  }
+}
+
+/**
+ * The timer is only rearmed if the armed one would be late by more than
+ * DeadlineResolution, and never sooner than that from now, so a steady
+ * stream of calls arms at most one timer per DeadlineResolution
+ */
+void RpcClient::armTimer() {
+  if (deadlines_.empty()) {
+    return;
+  }
+  const Timestamp earliest = deadlines_.front().when;
+  if (timer_at_.valid() &&
+      timer_at_ < addTime(earliest, DeadlineResolution)) {
+    return;
+  }
+  if (timer_at_.valid()) {
+    loop_->cancel(timer_);
+  }
+  timer_at_ = std::max(earliest,
+                       addTime(Timestamp::now(), DeadlineResolution));
+  timer_ = loop_->runAt(timer_at_, [this] {
+    timer_at_ = Timestamp();
+    onTimer();
+  });
+}
+
+void RpcClient::onTimer() {
+  const Timestamp now = Timestamp::now();
+  while (!deadlines_.empty() && !(now < deadlines_.front().when)) {
+    const uint64_t id = deadlines_.front().id;
+    std::pop_heap(deadlines_.begin(), deadlines_.end());
+    deadlines_.pop_back();
+    /* A no-op if the call has completed */
+    complete(id, RpcStatus::Timeout, std::string_view());
+  }
+  armTimer();
+}
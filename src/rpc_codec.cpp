@@ -0,0 +1,62 @@
+#include "rpc_codec.h"
+
+#include "buffer.h"
+#include "logging.h"
+
+void RpcCodec::onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                         Timestamp recv_time) {
+  while (buf->readableBytes() >= sizeof(int32_t)) {
+    const int32_t len = buf->peekInt32();
+    if (len < static_cast<int32_t>(HeaderLen) ||
+        static_cast<size_t>(len) > max_frame_size_) {
+      LOG << "RpcCodec::onMessage [" << conn->name()
+          << "] invalid frame length " << len;
+      buf->retrieveAll();
+      conn->shutdown();
+      break;
+    }
+    if (buf->readableBytes() < sizeof(int32_t) + len) {
+      /* Incomplete frame, wait for more data */
+      break;
+    }
+
+    const char* p = buf->peek() + sizeof(int32_t);
+    uint16_t method;
+    uint64_t id;
+    memcpy(&method, p + 2, sizeof method);
+    memcpy(&id, p + 4, sizeof id);
+    RpcHeader header;
+    header.type = static_cast<RpcHeader::Type>(p[0]);
+    header.status = static_cast<RpcStatus>(p[1]);
+    header.method = sockets::networkToHost16(method);
+    header.id = sockets::networkToHost64(id);
+    frame_cb_(conn, header, std::string_view(p + HeaderLen, len - HeaderLen),
+              recv_time);
+    buf->retrieve(sizeof(int32_t) + len);
+  }
+}
+
+void RpcCodec::encode(const RpcHeader& header, std::string_view payload,
+                      Buffer* output) {
+  char head[sizeof(int32_t) + HeaderLen];
+  const uint32_t len = sockets::hostToNetwork32(
+      static_cast<uint32_t>(HeaderLen + payload.size()));
+  const uint16_t method = sockets::hostToNetwork16(header.method);
+  const uint64_t id = sockets::hostToNetwork64(header.id);
+  memcpy(head, &len, sizeof len);
+  head[4] = static_cast<char>(header.type);
+  head[5] = static_cast<char>(header.status);
+  memcpy(head + 6, &method, sizeof method);
+  memcpy(head + 8, &id, sizeof id);
+  output->ensureWritableBytes(sizeof head + payload.size());
+  output->append(head, sizeof head);
+  output->append(payload.data(), payload.size());
+}
+
+void RpcCodec::send(const TcpConnectionPtr& conn, const RpcHeader& header,
+                    std::string_view payload) {
+  thread_local Buffer scratch;
+  scratch.retrieveAll();
+  encode(header, payload, &scratch);
+  conn->send(std::string_view(scratch.peek(), scratch.readableBytes()));
+}
@@ -0,0 +1,53 @@
+#include "rpc_server.h"
+
+#include "logging.h"
+
+void RpcCall::reply(std::string_view response, RpcStatus status) const {
+  RpcHeader header;
+  header.type = RpcHeader::Response;
+  header.status = status;
+  header.method = method_;
+  header.id = id_;
+  RpcCodec::send(conn_, header, response);
+}
+
+RpcServer::RpcServer(EventLoop* loop, const InetAddress& listen_addr)
+    : server_(loop, listen_addr),
+      codec_(std::bind(&RpcServer::onFrame, this, std::placeholders::_1,
+                       std::placeholders::_2, std::placeholders::_3,
+                       std::placeholders::_4)) {
+  server_.setConnectionCallback(
+      std::bind(&RpcServer::onConnection, this, std::placeholders::_1));
+  server_.setMessageCallback(
+      std::bind(&RpcCodec::onMessage, &codec_, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+  server_.setAutoCork(true);
+}
+
+void RpcServer::registerMethod(uint16_t method, const Handler& handler) {
+  if (method >= handlers_.size()) {
+    handlers_.resize(method + 1);
+  }
+  handlers_[method] = handler;
+}
+
+void RpcServer::onConnection(const TcpConnectionPtr& conn) {
+  if (conn->connected()) {
+    conn->setTcpNoDelay(true);
+  }
+}
+
+void RpcServer::onFrame(const TcpConnectionPtr& conn, const RpcHeader& header,
+                        std::string_view payload, Timestamp recv_time) {
+  if (header.type != RpcHeader::Request) {
+    LOG << "RpcServer::onFrame [" << conn->name() << "] unexpected response";
+    conn->shutdown();
+    return;
+  }
+  RpcCall call(conn, header.method, header.id, recv_time);
+  if (header.method >= handlers_.size() || !handlers_[header.method]) {
+    call.reply(std::string_view(), RpcStatus::NoMethod);
+    return;
+  }
+  handlers_[header.method](call, payload);
+}
@@ -5,32 +5,46 @@
 #include <strings.h>  // bzero
 
 #include "inet_addr.h"
+#include "logging.h"
 #include "sockets_options.h"
 
 Socket::~Socket() { sockets::close(sockfd_); }
 
 void Socket::bindAddress(const InetAddress& addr) {
-  sockets::bindOrDie(sockfd_, addr.getSockAddrInet());
+  sockets::bindOrDie(sockfd_, addr.getSockAddr(), addr.getSockLen());
 }
 
 void Socket::listen() { sockets::listenOrDie(sockfd_); }
 
 int Socket::accept(InetAddress* peeraddr) {
-  struct sockaddr_in addr;
-  bzero(&addr, sizeof addr);
-  int connfd = sockets::accept(sockfd_, &addr);
+  socklen_t addrlen = InetAddress::Capacity;
+  int connfd =
+      sockets::accept(sockfd_, peeraddr->getMutableSockAddr(), &addrlen);
   if (connfd >= 0) {
-    peeraddr->setSockAddrInet(addr);
+    peeraddr->setSockLen(addrlen);
   }
   return connfd;
 }
 
+bool Socket::getPeerCredentials(struct ucred* cred) const {
+  return sockets::getPeerCredentials(sockfd_, cred);
+}
+
 void Socket::setReuseAddr(bool on) {
   int optval = on ? 1 : 0;
   ::setsockopt(sockfd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
   // FIXME CHECK
 }
 
+void Socket::setReusePort(bool on) {
+  int optval = on ? 1 : 0;
+  int ret = ::setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &optval,
+                         static_cast<socklen_t>(sizeof optval));
+  if (ret < 0 && on) {
+    LOG << "SO_REUSEPORT failed";
+  }
+}
+
 void Socket::shutdownWrite() { sockets::shutdownWrite(sockfd_); }
 
 void Socket::setTcpNoDelay(bool on) {
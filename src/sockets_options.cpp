@@ -3,10 +3,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>    // snprintf
+#include <string.h>   // memcmp
 #include <strings.h>  // bzero
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "inet_addr.h"
 #include "logging.h"
 
 using SA = struct sockaddr;
@@ -25,18 +27,18 @@ void setNonBlockAndCloseOnExec(int sockfd) {
   // FIXME check
 }
 
-int sockets::createNonblockingOrDie() {
+int sockets::createNonblockingOrDie(sa_family_t family) {
 // socket
 #if VALGRIND
-  int sockfd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  int sockfd = ::socket(family, SOCK_STREAM, 0);
   if (sockfd < 0) {
     LOG << "sockets::createNonblockingOrDie() failed";
   }
 
   setNonBlockAndCloseOnExec(sockfd);
 #else
-  int sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
-                        IPPROTO_TCP);
+  int sockfd =
+      ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   if (sockfd < 0) {
     LOG << "sockets::createNonblockingOrDie() failed";
   }
@@ -44,8 +46,27 @@ int sockets::createNonblockingOrDie() {
   return sockfd;
 }
 
-void sockets::bindOrDie(int sockfd, const struct sockaddr_in& addr) {
-  int ret = ::bind(sockfd, reinterpret_cast<const SA*>(&addr), sizeof addr);
+int sockets::createNonblockingUdpOrDie(sa_family_t family) {
+#if VALGRIND
+  int sockfd = ::socket(family, SOCK_DGRAM, IPPROTO_UDP);
+  if (sockfd < 0) {
+    LOG << "sockets::createNonblockingUdpOrDie() failed";
+  }
+
+  setNonBlockAndCloseOnExec(sockfd);
+#else
+  int sockfd = ::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        IPPROTO_UDP);
+  if (sockfd < 0) {
+    LOG << "sockets::createNonblockingUdpOrDie() failed";
+  }
+#endif
+  return sockfd;
+}
+
+void sockets::bindOrDie(int sockfd, const struct sockaddr* addr,
+                        socklen_t len) {
+  int ret = ::bind(sockfd, addr, len);
   if (ret < 0) {
     LOG << "sockets::bindOrDie";
   }
@@ -58,13 +79,16 @@ void sockets::listenOrDie(int sockfd) {
   }
 }
 
-int sockets::accept(int sockfd, struct sockaddr_in* addr) {
-  socklen_t addrlen = sizeof *addr;
+int sockets::connect(int sockfd, const struct sockaddr* addr, socklen_t len) {
+  return ::connect(sockfd, addr, len);
+}
+
+int sockets::accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
 #if VALGRIND
-  int connfd = ::accept(sockfd, reinterpret_cast<SA*>(addr), &addrlen);
+  int connfd = ::accept(sockfd, addr, addrlen);
   setNonBlockAndCloseOnExec(connfd);
 #else
-  int connfd = ::accept4(sockfd, addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  int connfd = ::accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
 #endif
   if (connfd < 0) {
     int savedErrno = errno;
@@ -104,18 +128,35 @@ void sockets::close(int sockfd) {
   }
 }
 
+void sockets::closeWithReset(int sockfd) {
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  if (::setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg) < 0) {
+    LOG << "sockets::closeWithReset";
+  }
+  close(sockfd);
+}
+
 void sockets::shutdownWrite(int sockfd) {
   if (shutdown(sockfd, SHUT_WR) < 0) {
     LOG << "Error: sockets::shutdownWrite";
   }
 }
 
-void sockets::toHostPort(char* buf, size_t size,
-                         const struct sockaddr_in& addr) {
-  char host[INET_ADDRSTRLEN] = "INVALID";
-  ::inet_ntop(AF_INET, &addr.sin_addr, host, sizeof host);
-  uint16_t port = sockets::networkToHost16(addr.sin_port);
-  snprintf(buf, size, "%s:%u", host, port);
+void sockets::toHostPort(char* buf, size_t size, const struct sockaddr* addr) {
+  char host[INET6_ADDRSTRLEN] = "INVALID";
+  if (addr->sa_family == AF_INET6) {
+    const auto* addr6 = reinterpret_cast<const struct sockaddr_in6*>(addr);
+    ::inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof host);
+    uint16_t port = sockets::networkToHost16(addr6->sin6_port);
+    snprintf(buf, size, "[%s]:%u", host, port);
+  } else {
+    const auto* addr4 = reinterpret_cast<const struct sockaddr_in*>(addr);
+    ::inet_ntop(AF_INET, &addr4->sin_addr, host, sizeof host);
+    uint16_t port = sockets::networkToHost16(addr4->sin_port);
+    snprintf(buf, size, "%s:%u", host, port);
+  }
 }
 
 void sockets::fromHostPort(const char* ip, uint16_t port,
@@ -127,14 +168,56 @@ void sockets::fromHostPort(const char* ip, uint16_t port,
   }
 }
 
-struct sockaddr_in sockets::getLocalAddr(int sockfd) {
-  struct sockaddr_in local_addr;
+void sockets::fromHostPort(const char* ip, uint16_t port,
+                           struct sockaddr_in6* addr) {
+  addr->sin6_family = AF_INET6;
+  addr->sin6_port = hostToNetwork16(port);
+  if (::inet_pton(AF_INET6, ip, &addr->sin6_addr) <= 0) {
+    LOG << "sockets::fromHostPort";
+  }
+}
+
+InetAddress sockets::getLocalAddr(int sockfd) {
+  struct sockaddr_storage local_addr;
   bzero(&local_addr, sizeof local_addr);
   socklen_t addrlen = sizeof(local_addr);
   if (::getsockname(sockfd, reinterpret_cast<SA*>(&local_addr), &addrlen) < 0) {
     LOG << "sockets::getLocalAddr";
   }
-  return local_addr;
+  return InetAddress(reinterpret_cast<SA*>(&local_addr), addrlen);
+}
+
+InetAddress sockets::getPeerAddr(int sockfd) {
+  struct sockaddr_storage peer_addr;
+  bzero(&peer_addr, sizeof peer_addr);
+  socklen_t addrlen = sizeof(peer_addr);
+  if (::getpeername(sockfd, reinterpret_cast<SA*>(&peer_addr), &addrlen) < 0) {
+    LOG << "sockets::getPeerAddr";
+  }
+  return InetAddress(reinterpret_cast<SA*>(&peer_addr), addrlen);
+}
+
+/* Unix domain sockets have no ports, they never connect to themselves */
+bool sockets::isSelfConnect(int sockfd) {
+  InetAddress local_addr = getLocalAddr(sockfd);
+  InetAddress peer_addr = getPeerAddr(sockfd);
+  if (local_addr.family() != peer_addr.family()) {
+    return false;
+  }
+  if (local_addr.family() == AF_INET) {
+    const struct sockaddr_in& l = local_addr.getSockAddrInet();
+    const struct sockaddr_in& r = peer_addr.getSockAddrInet();
+    return l.sin_port == r.sin_port && l.sin_addr.s_addr == r.sin_addr.s_addr;
+  }
+  if (local_addr.family() == AF_INET6) {
+    const auto* l =
+        reinterpret_cast<const struct sockaddr_in6*>(local_addr.getSockAddr());
+    const auto* r =
+        reinterpret_cast<const struct sockaddr_in6*>(peer_addr.getSockAddr());
+    return l->sin6_port == r->sin6_port &&
+           memcmp(&l->sin6_addr, &r->sin6_addr, sizeof l->sin6_addr) == 0;
+  }
+  return false;
 }
 
 int sockets::getSocketError(int sockfd) {
@@ -147,3 +230,39 @@ int sockets::getSocketError(int sockfd) {
     return optval;
   }
 }
+
+ssize_t sockets::sendWithFds(int sockfd, const void* data, size_t len,
+                             const int* fds, int num_fds) {
+  assert(len > 0);
+  assert(0 < num_fds && num_fds <= MaxFdsPerMessage);
+  struct iovec vec;
+  vec.iov_base = const_cast<void*>(data);
+  vec.iov_len = len;
+  /* Aligned for struct cmsghdr */
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * MaxFdsPerMessage)];
+    struct cmsghdr align;
+  } control;
+  bzero(&control, sizeof control);
+  struct msghdr msg;
+  bzero(&msg, sizeof msg);
+  msg.msg_iov = &vec;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+  return ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+}
+
+bool sockets::getPeerCredentials(int sockfd, struct ucred* cred) {
+  socklen_t len = sizeof *cred;
+  if (::getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, cred, &len) < 0) {
+    LOG << "sockets::getPeerCredentials";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,231 @@
+#include "stall_watchdog.h"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+#include "logging.h"
+#include "metrics.h"
+#include "tcp_connection.h"
+
+namespace {
+Counter stall_counter("event_loop_stalls_total",
+                      "Loop iterations that ran past the stall threshold");
+
+/* Serializes the reports of all watchdogs, they share the signal */
+std::mutex report_mutex;
+
+/* How long the loop thread gets to run the signal handler */
+const int64_t SampleTimeoutUs = 100 * 1000;
+}  // namespace
+
+StallWatchdog::Sample StallWatchdog::sample_;
+
+int StallWatchdog::Signal() { return SIGRTMIN + 1; }
+
+StallWatchdog::StallWatchdog(double threshold_seconds)
+    : threshold_us_(static_cast<int64_t>(threshold_seconds *
+                                         Timestamp::microSecondsPerSecond)),
+      thread_(std::bind(&StallWatchdog::threadFunc, this), "StallWatchdog"),
+      running_(false),
+      reporting_(nullptr) {}
+
+StallWatchdog::~StallWatchdog() { stop(); }
+
+void StallWatchdog::start() {
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    /* The first backtrace() loads libgcc, which a signal handler can't */
+    void* frame;
+    ::backtrace(&frame, 1);
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = &StallWatchdog::handleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(Signal(), &action, nullptr) != 0) {
+      LOG << "StallWatchdog::start sigaction failed";
+    }
+  });
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(!running_ && !thread_.started());
+    running_ = true;
+  }
+  thread_.start();
+}
+
+void StallWatchdog::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void StallWatchdog::watch(EventLoop* loop) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  watched_.push_back({loop, 0, 0});
+}
+
+void StallWatchdog::unwatch(EventLoop* loop) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  /* The loop may be destroyed once this returns */
+  cv_.wait(lock, [this, loop] { return reporting_ != loop; });
+  watched_.erase(std::remove_if(watched_.begin(), watched_.end(),
+                                [loop](const Watched& watched) {
+                                  return watched.loop == loop;
+                                }),
+                 watched_.end());
+}
+
+uint64_t StallWatchdog::stalls(const EventLoop* loop) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const Watched& watched : watched_) {
+    if (watched.loop == loop) {
+      return watched.stalls;
+    }
+  }
+  return 0;
+}
+
+void StallWatchdog::threadFunc() {
+  /* A stall is caught within a quarter of the threshold past it */
+  const std::chrono::microseconds interval(
+      std::max<int64_t>(threshold_us_ / 4, 1000));
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    cv_.wait_for(lock, interval);
+    if (running_) {
+      check(lock);
+    }
+  }
+}
+
+void StallWatchdog::check(std::unique_lock<std::mutex>& lock) {
+  const int64_t now_us = Timestamp::now().microSecondsSinceEpoch();
+  std::vector<Stall> stalls;
+  for (Watched& watched : watched_) {
+    const int64_t start_us = watched.loop->iterationStartMicros();
+    if (start_us == 0 || start_us == watched.reported_start_us ||
+        now_us - start_us < threshold_us_) {
+      continue;
+    }
+    watched.reported_start_us = start_us;
+    ++watched.stalls;
+    stall_counter.inc();
+    stalls.push_back({watched.loop, watched.loop->threadId(),
+                      now_us - start_us, watched.stalls});
+  }
+  /* A report waits for the loop thread, watch() and stalls() don't */
+  for (const Stall& stall : stalls) {
+    const bool still_watched =
+        std::any_of(watched_.begin(), watched_.end(),
+                    [&stall](const Watched& watched) {
+                      return watched.loop == stall.loop;
+                    });
+    if (!still_watched) {
+      continue;
+    }
+    reporting_ = stall.loop;
+    lock.unlock();
+    report(stall);
+    lock.lock();
+    reporting_ = nullptr;
+    cv_.notify_all();
+  }
+}
+
+void StallWatchdog::report(const Stall& stall) {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  sample_.loop.store(stall.loop, std::memory_order_relaxed);
+  sample_.state.store(Sample::Armed, std::memory_order_release);
+  bool captured = false;
+  if (::syscall(SYS_tgkill, ::getpid(), stall.thread_id, Signal()) == 0) {
+    for (int64_t waited_us = 0; waited_us < SampleTimeoutUs && !captured;
+         waited_us += 1000) {
+      ::usleep(1000);
+      captured = sample_.state.load(std::memory_order_acquire) ==
+                 Sample::Done;
+    }
+  }
+  /* Disarm, or wait out a handler that is writing the sample */
+  int state = Sample::Armed;
+  while (!sample_.state.compare_exchange_strong(state, Sample::Idle,
+                                                std::memory_order_acquire)) {
+    if (state == Sample::Done) {
+      captured = true;
+      sample_.state.store(Sample::Idle, std::memory_order_relaxed);
+      break;
+    }
+    state = Sample::Armed;
+    ::usleep(100);
+  }
+
+  LOG << "StallWatchdog EventLoop " << stall.loop << " thread "
+      << stall.thread_id << " stalled for " << stall.stalled_us / 1000
+      << " ms, stall " << stall.stalls;
+  if (!captured) {
+    LOG << "StallWatchdog no backtrace, the loop thread didn't answer";
+    return;
+  }
+  std::string connection("none");
+  if (sample_.has_connection) {
+    /* As TcpConnection::name() formats it */
+    connection = sample_.local_addr.toHostPort() + "#" +
+                 std::to_string(sample_.connection_id);
+  }
+  LOG << "StallWatchdog in "
+      << (sample_.callback ? sample_.callback : "EventLoop")
+      << " of connection [" << connection << "]";
+  char** symbols = ::backtrace_symbols(sample_.frames, sample_.depth);
+  for (int i = 0; i < sample_.depth; ++i) {
+    LOG << "  #" << i << " " << (symbols ? symbols[i] : "?");
+  }
+  ::free(symbols);
+}
+
+/**
+ * Runs on the loop thread, inside the stalled callback, so the connection
+ * it names is alive. Only copies, backtrace() was loaded by start()
+ */
+void StallWatchdog::handleSignal(int) {
+  const int saved_errno = errno;
+  EventLoop* loop = EventLoop::getEventLoopOfCurrentThread();
+  int state = Sample::Armed;
+  if (loop != nullptr &&
+      sample_.loop.load(std::memory_order_relaxed) == loop &&
+      sample_.state.compare_exchange_strong(state, Sample::Writing,
+                                            std::memory_order_acquire)) {
+    /* Rearmed for another loop since the check above, leave it */
+    if (sample_.loop.load(std::memory_order_relaxed) != loop) {
+      sample_.state.store(Sample::Armed, std::memory_order_release);
+      errno = saved_errno;
+      return;
+    }
+    sample_.depth = ::backtrace(sample_.frames, MaxFrames);
+    sample_.callback = loop->callbackType();
+    TcpConnection* conn = loop->callbackConnection();
+    sample_.has_connection = conn != nullptr;
+    if (conn != nullptr) {
+      sample_.connection_id = conn->id();
+      sample_.local_addr = conn->localAddress();
+    }
+    sample_.state.store(Sample::Done, std::memory_order_release);
+  }
+  errno = saved_errno;
+}
@@ -0,0 +1,140 @@
+#include "stream_producer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "logging.h"
+#include "tcp_connection.h"
+
+StreamProducer::State SliceProducer::produce(size_t max_bytes, Slice* chunk) {
+  if (data_.empty()) {
+    return State::Done;
+  }
+  size_t len = std::min(max_bytes, data_.size());
+  *chunk = data_;
+  /* Same owner, only the view differs */
+  chunk->removeSuffix(data_.size() - len);
+  data_.removePrefix(len);
+  return State::Data;
+}
+
+FileProducer::FileProducer(int fd, off_t offset, size_t length, bool owns_fd)
+    : fd_(fd), offset_(offset), remaining_(length), owns_fd_(owns_fd) {}
+
+FileProducer::~FileProducer() {
+  if (owns_fd_) {
+    ::close(fd_);
+  }
+}
+
+StreamProducer::State FileProducer::produce(size_t max_bytes, Slice* chunk) {
+  if (remaining_ == 0) {
+    return State::Done;
+  }
+  std::string data(std::min(max_bytes, remaining_), '\0');
+  ssize_t n;
+  do {
+    n = ::pread(fd_, &data[0], data.size(), offset_);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    /* A file that shrank under us can't fill the promised length */
+    LOG << "Error: FileProducer::produce fd = " << fd_ << " errno = " << errno;
+    return State::Error;
+  }
+  data.resize(n);
+  offset_ += n;
+  remaining_ -= n;
+  *chunk = Slice(std::move(data));
+  return State::Data;
+}
+
+AsyncProducer::AsyncProducer(const TcpConnectionPtr& conn, size_t capacity)
+    : conn_(conn),
+      capacity_(capacity),
+      bytes_(0),
+      finished_(false),
+      ok_(true),
+      full_(false) {}
+
+void AsyncProducer::setSpaceCallback(const SpaceCallback& cb) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  space_cb_ = cb;
+}
+
+bool AsyncProducer::push(const Slice& chunk) {
+  bool was_empty;
+  bool accepting;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    /* produce() would hand it out as an empty Data, i.e. Pending */
+    if (chunk.empty()) {
+      return bytes_ <= capacity_;
+    }
+    was_empty = chunks_.empty();
+    chunks_.push_back(chunk);
+    bytes_ += chunk.size();
+    accepting = bytes_ <= capacity_;
+    if (!accepting) {
+      full_ = true;
+    }
+  }
+  if (was_empty) {
+    wakeup();
+  }
+  return accepting;
+}
+
+void AsyncProducer::finish(bool ok) {
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    ok_ = ok;
+    was_empty = chunks_.empty();
+  }
+  if (was_empty) {
+    wakeup();
+  }
+}
+
+void AsyncProducer::wakeup() {
+  TcpConnectionPtr conn = conn_.lock();
+  if (conn) {
+    conn->resumeStream();
+  }
+}
+
+StreamProducer::State AsyncProducer::produce(size_t max_bytes, Slice* chunk) {
+  SpaceCallback space_cb;
+  State state;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (chunks_.empty()) {
+      if (!finished_) {
+        return State::Pending;
+      }
+      return ok_ ? State::Done : State::Error;
+    }
+
+    Slice& front = chunks_.front();
+    *chunk = front;
+    if (front.size() > max_bytes) {
+      chunk->removeSuffix(front.size() - max_bytes);
+      front.removePrefix(max_bytes);
+    } else {
+      chunks_.pop_front();
+    }
+    bytes_ -= chunk->size();
+    if (full_ && bytes_ <= capacity_ / 2) {
+      full_ = false;
+      space_cb = space_cb_;
+    }
+    state = State::Data;
+  }
+  if (space_cb) {
+    space_cb();
+  }
+  return state;
+}
@@ -0,0 +1,93 @@
+#include "tcp_client.h"
+
+#include "event_loop.h"
+#include "logging.h"
+#include "sockets_options.h"
+
+TcpClient::TcpClient(EventLoop* loop, const InetAddress& server_addr,
+                     const std::string& name)
+    : loop_(loop),
+      connector_(std::make_shared<Connector>(loop, server_addr)),
+      name_(name),
+      retry_(false),
+      connect_(false),
+      next_conn_id_(1) {
+  connector_->setNewConnectionCallback(
+      std::bind(&TcpClient::newConnection, this, std::placeholders::_1));
+  LOG << "TcpClient::TcpClient [" << name_ << "]";
+}
+
+/**
+ * A live connection outlives the client: it is closed with a close callback
+ * that no longer refers to this
+ */
+TcpClient::~TcpClient() {
+  loop_->assertInLoopThread();
+  LOG << "TcpClient::~TcpClient [" << name_ << "]";
+  if (connection_) {
+    EventLoop* loop = loop_;
+    connection_->setCloseCallback([loop](const TcpConnectionPtr& conn) {
+      loop->queueInLoop(std::bind(&TcpConnection::destroyConnection, conn));
+    });
+    connection_->forceClose();
+  } else {
+    connector_->stop();
+  }
+}
+
+void TcpClient::connect() {
+  LOG << "TcpClient::connect [" << name_ << "] - connecting to "
+      << connector_->serverAddress().toHostPort();
+  connect_ = true;
+  connector_->start();
+}
+
+void TcpClient::disconnect() {
+  connect_ = false;
+  loop_->runInLoop([this] {
+    if (connection_) {
+      connection_->shutdown();
+    }
+  });
+}
+
+void TcpClient::stop() {
+  connect_ = false;
+  connector_->stop();
+}
+
+TcpConnectionPtr TcpClient::connection() const {
+  loop_->assertInLoopThread();
+  return connection_;
+}
+
+void TcpClient::newConnection(int sockfd) {
+  loop_->assertInLoopThread();
+  InetAddress peer_addr(sockets::getPeerAddr(sockfd));
+  InetAddress local_addr(sockets::getLocalAddr(sockfd));
+  TcpConnectionPtr conn = std::make_shared<TcpConnection>(
+      loop_, next_conn_id_++, sockfd, local_addr, peer_addr);
+  conn->setConnectionCallback(connection_cb_);
+  conn->setMessageCallback(message_cb_);
+  conn->setWriteCallback(write_cmpl_cb_);
+  if (tls_context_) {
+    conn->startTls(tls_context_, tls_server_name_);
+  }
+  conn->setCloseCallback(
+      std::bind(&TcpClient::removeConnection, this, std::placeholders::_1));
+  connection_ = conn;
+  conn->establishConnection();
+}
+
+void TcpClient::removeConnection(const TcpConnectionPtr& conn) {
+  loop_->assertInLoopThread();
+  assert(loop_ == conn->getLoop());
+  assert(connection_ == conn);
+  connection_.reset();
+  loop_->queueInLoop(std::bind(&TcpConnection::destroyConnection, conn));
+  if (retry_ && connect_) {
+    LOG << "TcpClient::removeConnection [" << name_ << "] - reconnecting to "
+        << connector_->serverAddress().toHostPort();
+    connector_->restart();
+  }
+}
@@ -2,40 +2,102 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <strings.h>  // bzero
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <functional>
 
 #include "buffer.h"
 #include "channel.h"
+#include "connection_pool.h"
 #include "event_loop.h"
 #include "logging.h"
+#include "metrics.h"
 #include "socket.h"
 #include "sockets_options.h"
+#include "stream_producer.h"
+#include "tls_context.h"
+#include "trace.h"
 
-TcpConnection::TcpConnection(EventLoop* loop, const std::string& name_arg,
-                             int sockfd, const InetAddress& local_addr,
+namespace {
+Gauge connection_gauge("tcp_connections", "Established TCP connections");
+Counter read_bytes_counter("tcp_read_bytes_total",
+                           "Bytes read from connections");
+Counter written_bytes_counter("tcp_written_bytes_total",
+                              "Bytes written to connections");
+}  // namespace
+
+TcpConnection::TcpConnection(EventLoop* loop, uint64_t id, int sockfd,
+                             const InetAddress& local_addr,
                              const InetAddress& peer_addr)
+    : TcpConnection(loop, id, sockfd, local_addr, peer_addr, nullptr) {}
+
+TcpConnection::TcpConnection(EventLoop* loop, uint64_t id, int sockfd,
+                             const InetAddress& local_addr,
+                             const InetAddress& peer_addr,
+                             const std::shared_ptr<ConnectionPool>& pool)
     : loop_(loop),
-      name_(name_arg),
+      id_(id),
       state_(States::Connecting),
-      socket_(new Socket(sockfd)),
-      channel_(new Channel(loop, sockfd)),
+      socket_(sockfd),
+      channel_(loop, sockfd),
       local_addr_(local_addr),
-      peer_addr_(peer_addr) {
-  LOG << "TcpConnection::ctor[" << name_ << "] at " << this << " fd=" << sockfd;
-  channel_->setReadCallback(
-      std::bind(&TcpConnection::handleRead, this, std::placeholders::_1));
-  channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
-  channel_->setErrorCallback(std::bind(&TcpConnection::handleError, this));
-  channel_->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
+      peer_addr_(peer_addr),
+      high_water_mark_(DefaultHighWaterMark),
+      backpressure_(false),
+      backpressure_paused_(false),
+      backpressure_high_(0),
+      backpressure_low_(0),
+      pool_(pool),
+      read_pause_(0),
+      egress_paused_(false),
+      rate_throttled_(false),
+      tls_handshaking_(false),
+      receive_fds_(false),
+      memory_charged_(0),
+      read_budget_bytes_(0),
+      read_budget_us_(0),
+      read_iteration_(0),
+      read_bytes_(0),
+      read_us_(0),
+      auto_cork_(false),
+      corked_(false),
+      flush_scheduled_(false),
+      stream_low_water_mark_(DefaultStreamLowWaterMark),
+      stream_waiting_(false),
+      pulling_(false),
+      input_buffer_(pool ? pool->takeStorage() : std::vector<char>()),
+      output_queue_bytes_(0),
+      output_buffer_(pool ? pool->takeStorage() : std::vector<char>()) {
+  LOG << "TcpConnection::ctor[#" << id_ << "] at " << this << " fd=" << sockfd;
+  /* Capture only this, small enough to be stored inside std::function */
+  channel_.setReadCallback([this](Timestamp t) { handleRead(t); });
+  channel_.setWriteCallback([this] { handleWrite(); });
+  channel_.setErrorCallback([this] { handleError(); });
+  channel_.setCloseCallback([this] { handleClose(); });
 }
 
 /**
  * The destructor of Socket will close fd
  */
 TcpConnection::~TcpConnection() {
-  LOG << "TcpConnection::dtor[" << name_ << "] at " << this
-      << " fd=" << channel_->getFd();
+  LOG << "TcpConnection::dtor[#" << id_ << "] at " << this
+      << " fd=" << channel_.getFd();
+  if (pool_) {
+    pool_->recycleStorage(input_buffer_.releaseStorage());
+    pool_->recycleStorage(output_buffer_.releaseStorage());
+  }
+  for (int fd : received_fds_) {
+    sockets::close(fd);
+  }
+}
+
+const std::string& TcpConnection::name() const {
+  std::call_once(name_once_, [this] {
+    name_ = local_addr_.toHostPort() + "#" + std::to_string(id_);
+  });
+  return name_;
 }
 
 /**
@@ -45,28 +107,82 @@ TcpConnection::~TcpConnection() {
  * threads
  */
 void TcpConnection::send(const std::string& message) {
+  send(std::string_view(message));
+}
+
+void TcpConnection::send(std::string&& message) {
+  if (state_ == States::Connected) {
+    Slice slice(std::move(message));
+    if (loop_->isInLoopThread()) {
+      sendSliceInLoop(slice);
+    } else {
+      loop_->runInLoop(std::bind(&TcpConnection::sendSliceInLoop,
+                                 shared_from_this(), std::move(slice)));
+    }
+  }
+}
+
+void TcpConnection::send(std::string_view message) {
+  send(message.data(), message.size());
+}
+
+void TcpConnection::send(const void* data, size_t len) {
   if (state_ == States::Connected) {
     if (loop_->isInLoopThread()) {
-      sendInLoop(message);
+      sendInLoop(data, len);
     } else {
-      loop_->runInLoop(std::bind(&TcpConnection::sendInLoop, this, message));
+      /* The only copy: the caller's memory can't outlive this call */
+      loop_->runInLoop(std::bind(&TcpConnection::sendSliceInLoop,
+                                 shared_from_this(),
+                                 Slice::copyFrom(data, len)));
     }
   }
 }
 
-void TcpConnection::sendInLoop(const std::string& message) {
+void TcpConnection::send(Buffer* buf) {
+  if (state_ == States::Connected) {
+    if (loop_->isInLoopThread()) {
+      sendBufferInLoop(buf);
+    } else {
+      auto owned = std::make_shared<Buffer>();
+      owned->swap(*buf);
+      Slice slice(owned, owned->peek(), owned->readableBytes());
+      loop_->runInLoop(std::bind(&TcpConnection::sendSliceInLoop,
+                                 shared_from_this(), std::move(slice)));
+    }
+  }
+}
+
+void TcpConnection::send(const Slice& slice) {
+  if (state_ == States::Connected) {
+    if (loop_->isInLoopThread()) {
+      sendSliceInLoop(slice);
+    } else {
+      loop_->runInLoop(std::bind(&TcpConnection::sendSliceInLoop,
+                                 shared_from_this(), slice));
+    }
+  }
+}
+
+size_t TcpConnection::writeImmediately(const void* data, size_t len) {
   loop_->assertInLoopThread();
   ssize_t nwrote = 0;
   /**
-   * If channel_ is not writing and output_buffer_ has no remaining data, write
-   * immediately
+   * If channel_ is not writing and no output is pending, write immediately
    */
-  if (!channel_->isWriting() && output_buffer_.readableBytes() == 0) {
-    nwrote = write(channel_->getFd(), message.data(), message.size());
+  if (!channel_.isWriting() && outputBytes() == 0 && !isCorked() &&
+      !egress_paused_) {
+    nwrote = writeSocket(data, len);
+    if (nwrote > 0) {
+      written_bytes_counter.inc(nwrote);
+      if (rate_limiter_) {
+        chargeEgress(nwrote);
+      }
+    }
     if (nwrote >= 0) {
-      if (static_cast<size_t>(nwrote) < message.size()) {
+      if (static_cast<size_t>(nwrote) < len) {
         LOG << "I am going to write more data";
-      } else if (write_cmpl_cb_) {
+      } else if (write_cmpl_cb_ && !producer_) {
         loop_->queueInLoop(std::bind(write_cmpl_cb_, shared_from_this()));
       }
     } else {
@@ -76,25 +192,161 @@ void TcpConnection::sendInLoop(const std::string& message) {
       }
     }
   }
-
-  /**
-   * Several scenarios:
-   * 1. None of @message is sent cos output_buffer_ has remaining data;
-   * 2. Only part of @message is sent;
-   * to prevent data be out of order, append data at the end of output_buffer_,
-   * register channel_'s WriteEvent, and send data together later in
-   * handleWrite()
-   */
   assert(nwrote >= 0);
-  // TODO(Q): resizing?
-  if (static_cast<size_t>(nwrote) < message.size()) {
-    output_buffer_.append(message.data() + nwrote, message.size() - nwrote);
-    if (!channel_->isWriting()) {
-      channel_->enableWriting();
+  return static_cast<size_t>(nwrote);
+}
+
+/**
+ * Several scenarios:
+ * 1. None of @data is sent cos output is pending;
+ * 2. Only part of @data is sent;
+ * to prevent data be out of order, queue the rest after the pending output,
+ * register channel_'s WriteEvent, and send data together later in
+ * handleWrite()
+ */
+void TcpConnection::sendInLoop(const void* data, size_t len) {
+  size_t nwrote = writeImmediately(data, len);
+  if (nwrote < len) {
+    size_t old_len = outputBytes();
+    output_buffer_.append(static_cast<const char*>(data) + nwrote,
+                          len - nwrote);
+    onOutputQueued(old_len);
+  }
+}
+
+void TcpConnection::sendSliceInLoop(const Slice& slice) {
+  size_t nwrote = writeImmediately(slice.data(), slice.size());
+  if (nwrote < slice.size()) {
+    size_t old_len = outputBytes();
+    Slice rest(slice);
+    rest.removePrefix(nwrote);
+    queueSlice(rest);
+    onOutputQueued(old_len);
+  }
+}
+
+void TcpConnection::sendBufferInLoop(Buffer* buf) {
+  size_t nwrote = writeImmediately(buf->peek(), buf->readableBytes());
+  if (nwrote < buf->readableBytes()) {
+    size_t old_len = outputBytes();
+    buf->retrieve(nwrote);
+    if (old_len == 0) {
+      /* Nothing pending, adopt the storage of @buf */
+      output_buffer_.swap(*buf);
+    } else {
+      auto owned = std::make_shared<Buffer>();
+      owned->swap(*buf);
+      queueSlice(Slice(owned, owned->peek(), owned->readableBytes()));
+    }
+    onOutputQueued(old_len);
+  }
+  buf->retrieveAll();
+}
+
+void TcpConnection::onOutputQueued(size_t old_len) {
+  const size_t new_len = outputBytes();
+  if (high_water_cb_ && old_len < high_water_mark_ &&
+      new_len >= high_water_mark_) {
+    loop_->queueInLoop(
+        std::bind(high_water_cb_, shared_from_this(), new_len));
+  }
+  if (backpressure_ && !backpressure_paused_ &&
+      new_len >= backpressure_high_) {
+    backpressure_paused_ = true;
+    pauseBackpressureTarget();
+  }
+
+  if (channel_.isWriting()) {
+    /* handleWrite() will pick it up */
+  } else if (egress_paused_) {
+    /* Written once the rate limiter refills the egress tokens */
+  } else if (corked_) {
+    /* Held until uncork(), unless so much is held that more should follow */
+    if (new_len >= CorkFlushThreshold) {
+      flushOutput(true);
     }
+  } else if (auto_cork_) {
+    if (!flush_scheduled_) {
+      flush_scheduled_ = true;
+      loop_->runAfterIteration(
+          std::bind(&TcpConnection::flushOutput, shared_from_this(), false));
+    }
+  } else {
+    channel_.enableWriting();
+  }
+  if (memory_account_) {
+    updateMemory();
+  }
+}
+
+void TcpConnection::setAutoCork(bool on) {
+  auto_cork_ = on;
+  if (!on && outputBytes() > 0 && loop_->isInLoopThread()) {
+    flushOutput(false);
+  }
+}
+
+void TcpConnection::cork() {
+  loop_->assertInLoopThread();
+  corked_ = true;
+}
+
+void TcpConnection::uncork() {
+  loop_->assertInLoopThread();
+  if (corked_) {
+    corked_ = false;
+    flushOutput(false);
   }
 }
 
+/**
+ * Write deferred output now
+ *
+ * @more: tell the kernel more data follows (MSG_MORE), so it can hold back a
+ * partial segment
+ */
+void TcpConnection::flushOutput(bool more) {
+  loop_->assertInLoopThread();
+  flush_scheduled_ = false;
+  if (channel_.isWriting() || outputBytes() == 0 || egress_paused_ ||
+      (state_ != States::Connected && state_ != States::Disconnecting)) {
+    return;
+  }
+
+  ssize_t n = writeOutput(more ? MSG_MORE : 0);
+  if (n < 0 && errno != EWOULDBLOCK) {
+    LOG << "Error: TcpConnection::flushOutput";
+  }
+  if (outputBytes() == 0) {
+    onOutputDrained();
+  } else {
+    channel_.enableWriting();
+  }
+}
+
+size_t TcpConnection::memoryFootprint() const {
+  size_t owned = 0;
+  for (const Slice& slice : output_queue_) {
+    if (slice.useCount() == 1) {
+      owned += slice.size();
+    }
+  }
+  return input_buffer_.capacity() + output_buffer_.capacity() + owned;
+}
+
+void TcpConnection::queueSlice(const Slice& slice) {
+  if (output_buffer_.readableBytes() > 0) {
+    /* output_buffer_ is older than @slice, move it into the queue first */
+    auto pending = std::make_shared<Buffer>();
+    pending->swap(output_buffer_);
+    output_queue_bytes_ += pending->readableBytes();
+    output_queue_.emplace_back(pending, pending->peek(),
+                               pending->readableBytes());
+  }
+  output_queue_bytes_ += slice.size();
+  output_queue_.push_back(slice);
+}
+
 /**
  * Shutdown write side of the connected socket
  * Delegate the actual shutdown work to shutdownInLoop() to ensure thread safe
@@ -113,47 +365,499 @@ void TcpConnection::shutdown() {
  */
 void TcpConnection::shutdownInLoop() {
   loop_->assertInLoopThread();
-  if (!channel_->isWriting()) {
-    // we are not writing
-    socket_->shutdownWrite();
+  if (producer_) {
+    /* finishStream() comes back here */
+    return;
+  }
+  if (!channel_.isWriting()) {
+    if (outputBytes() == 0) {
+      // we are not writing
+      if (tls_ && !tls_handshaking_) {
+        tls_->shutdown();
+      }
+      socket_.shutdownWrite();
+    } else {
+      /* Deferred output must go out before FIN */
+      corked_ = false;
+      flushOutput(false);
+    }
+  }
+}
+
+void TcpConnection::forceClose() {
+  if (state_ == States::Connected || state_ == States::Disconnecting) {
+    setState(States::Disconnecting);
+    loop_->queueInLoop(
+        std::bind(&TcpConnection::forceCloseInLoop, shared_from_this()));
+  }
+}
+
+void TcpConnection::forceCloseInLoop() {
+  loop_->assertInLoopThread();
+  if (state_ == States::Connected || state_ == States::Disconnecting) {
+    /* as if we received 0 byte in handleRead() */
+    handleClose();
+  }
+}
+
+void TcpConnection::stream(const std::shared_ptr<StreamProducer>& producer,
+                           const StreamCompleteCallback& done) {
+  if (state_ == States::Connected) {
+    loop_->runInLoop(std::bind(&TcpConnection::streamInLoop,
+                               shared_from_this(), producer, done));
+  }
+}
+
+void TcpConnection::streamInLoop(
+    const std::shared_ptr<StreamProducer>& producer,
+    const StreamCompleteCallback& done) {
+  loop_->assertInLoopThread();
+  assert(!producer_);
+  if (state_ != States::Connected) {
+    if (done) {
+      done(shared_from_this(), false);
+    }
+    return;
+  }
+  producer_ = producer;
+  stream_cmpl_cb_ = done;
+  stream_waiting_ = false;
+  pullStream();
+}
+
+void TcpConnection::resumeStream() {
+  loop_->runInLoop(
+      std::bind(&TcpConnection::resumeStreamInLoop, shared_from_this()));
+}
+
+void TcpConnection::resumeStreamInLoop() {
+  loop_->assertInLoopThread();
+  if (producer_ && stream_waiting_) {
+    stream_waiting_ = false;
+    pullStream();
+  }
+}
+
+/**
+ * Called when a stream starts, resumes, or its output drains below the low
+ * water mark. Chunks go through sendSliceInLoop(), so a socket with room
+ * takes them right away and only the rest is queued
+ */
+void TcpConnection::pullStream() {
+  if (pulling_) {
+    return;
+  }
+  pulling_ = true;
+  while (producer_ && !stream_waiting_ &&
+         outputBytes() < stream_low_water_mark_ &&
+         (state_ == States::Connected || state_ == States::Disconnecting)) {
+    Slice chunk;
+    switch (producer_->produce(StreamChunkSize, &chunk)) {
+      case StreamProducer::State::Data:
+        if (!chunk.empty()) {
+          sendSliceInLoop(chunk);
+          break;
+        }
+        /* Nothing was produced, pulling again could spin forever */
+        stream_waiting_ = true;
+        break;
+      case StreamProducer::State::Pending:
+        stream_waiting_ = true;
+        break;
+      case StreamProducer::State::Done:
+        finishStream(true);
+        break;
+      case StreamProducer::State::Error:
+        finishStream(false);
+        break;
+    }
+  }
+  pulling_ = false;
+}
+
+void TcpConnection::finishStream(bool ok) {
+  producer_.reset();
+  stream_waiting_ = false;
+  StreamCompleteCallback done;
+  done.swap(stream_cmpl_cb_);
+  if (state_ == States::Disconnected) {
+    if (done) {
+      done(shared_from_this(), false);
+    }
+    return;
+  }
+
+  if (done) {
+    loop_->queueInLoop(std::bind(done, shared_from_this(), ok));
+  }
+  if (!ok) {
+    /* The peer got part of a body, the stream can't be framed anymore */
+    forceClose();
+  } else if (outputBytes() == 0) {
+    onOutputDrained();
+  }
+}
+
+void TcpConnection::startRead() {
+  loop_->runInLoop(std::bind(&TcpConnection::resumeRead, shared_from_this(),
+                             PausedByUser));
+}
+
+void TcpConnection::stopRead() {
+  loop_->runInLoop(std::bind(&TcpConnection::pauseRead, shared_from_this(),
+                             PausedByUser));
+}
+
+void TcpConnection::pauseRead(uint8_t reason) {
+  loop_->assertInLoopThread();
+  read_pause_ |= reason;
+  if (channel_.isReading()) {
+    channel_.disableReading();
+  }
+}
+
+void TcpConnection::resumeRead(uint8_t reason) {
+  loop_->assertInLoopThread();
+  read_pause_ &= static_cast<uint8_t>(~reason);
+  if (read_pause_ == 0 &&
+      (state_ == States::Connected || state_ == States::Disconnecting) &&
+      !channel_.isReading()) {
+    channel_.enableReading();
+  }
+}
+
+void TcpConnection::enableBackpressure(size_t high_water_mark,
+                                       size_t low_water_mark) {
+  assert(low_water_mark < high_water_mark);
+  backpressure_ = true;
+  backpressure_high_ = high_water_mark;
+  backpressure_low_ = low_water_mark;
+}
+
+void TcpConnection::pauseBackpressureTarget() {
+  TcpConnectionPtr target = backpressure_target_.lock();
+  LOG << "TcpConnection::pauseBackpressureTarget [#" << id_ << "] pending "
+      << outputBytes();
+  if (target) {
+    target->getLoop()->runInLoop(std::bind(&TcpConnection::pauseRead, target,
+                                           PausedByBackpressure));
+  } else {
+    pauseRead(PausedByBackpressure);
+  }
+}
+
+void TcpConnection::resumeBackpressureTarget() {
+  TcpConnectionPtr target = backpressure_target_.lock();
+  if (target) {
+    target->getLoop()->runInLoop(std::bind(&TcpConnection::resumeRead, target,
+                                           PausedByBackpressure));
+  } else {
+    resumeRead(PausedByBackpressure);
+  }
+}
+
+void TcpConnection::setRateLimiter(const std::shared_ptr<RateLimiter>& limiter) {
+  assert(limiter->getLoop() == loop_);
+  rate_limiter_ = limiter;
+  setRateLimit(limiter->perConnection());
+}
+
+void TcpConnection::setRateLimit(const RateLimit& limit) {
+  ingress_bucket_ = TokenBucket(limit.ingress_rate, limit.ingress_burst);
+  egress_bucket_ = TokenBucket(limit.egress_rate, limit.egress_burst);
+}
+
+/**
+ * Charged after the read, the debt pauses reading until it is paid back.
+ * The poll time stands in for the clock
+ */
+void TcpConnection::chargeIngress(size_t n, Timestamp now) {
+  const int64_t now_us = now.microSecondsSinceEpoch();
+  TokenBucket& shared = rate_limiter_->ingress();
+  ingress_bucket_.refill(now_us);
+  ingress_bucket_.consume(n);
+  shared.refill(now_us);
+  shared.consume(n);
+  if (!ingress_bucket_.available() || !shared.available()) {
+    pauseRead(PausedByRateLimit);
+    throttleRate();
+  }
+}
+
+void TcpConnection::chargeEgress(size_t n) {
+  const int64_t now_us = loop_->pollReturnTime().microSecondsSinceEpoch();
+  TokenBucket& shared = rate_limiter_->egress();
+  egress_bucket_.refill(now_us);
+  egress_bucket_.consume(n);
+  shared.refill(now_us);
+  shared.consume(n);
+  if (!egress_bucket_.available() || !shared.available()) {
+    egress_paused_ = true;
+    throttleRate();
+  }
+}
+
+void TcpConnection::throttleRate() {
+  if (!rate_throttled_) {
+    rate_throttled_ = true;
+    rate_limiter_->throttle(shared_from_this());
+  }
+}
+
+bool TcpConnection::refillRate(int64_t now_us) {
+  loop_->assertInLoopThread();
+  if (state_ != States::Connected && state_ != States::Disconnecting) {
+    rate_throttled_ = false;
+    return false;
+  }
+  ingress_bucket_.refill(now_us);
+  egress_bucket_.refill(now_us);
+  if ((read_pause_ & PausedByRateLimit) && ingress_bucket_.available() &&
+      rate_limiter_->ingress().available()) {
+    resumeRead(PausedByRateLimit);
+  }
+  if (egress_paused_ && egress_bucket_.available() &&
+      rate_limiter_->egress().available()) {
+    egress_paused_ = false;
+    if (outputBytes() > 0 && !channel_.isWriting()) {
+      channel_.enableWriting();
+    }
+  }
+  rate_throttled_ = (read_pause_ & PausedByRateLimit) || egress_paused_;
+  return rate_throttled_;
+}
+
+bool TcpConnection::sendWithFds(std::string_view message,
+                                const std::vector<int>& fds) {
+  loop_->assertInLoopThread();
+  assert(!message.empty());
+  if (fds.empty()) {
+    /* Nothing to attach, ordinary output may queue */
+    if (state_ != States::Connected) {
+      return false;
+    }
+    sendInLoop(message.data(), message.size());
+    return true;
+  }
+  if (state_ != States::Connected || tls_ || channel_.isWriting() ||
+      outputBytes() > 0 || egress_paused_) {
+    return false;
+  }
+  ssize_t n =
+      sockets::sendWithFds(channel_.getFd(), message.data(), message.size(),
+                           fds.data(), static_cast<int>(fds.size()));
+  if (n <= 0) {
+    if (n < 0 && errno != EWOULDBLOCK) {
+      LOG << "Error: TcpConnection::sendWithFds";
+    }
+    return false;
+  }
+  written_bytes_counter.inc(n);
+  if (rate_limiter_) {
+    chargeEgress(n);
+  }
+  /* The fds went with the first byte, the rest is ordinary output */
+  if (static_cast<size_t>(n) < message.size()) {
+    sendInLoop(message.data() + n, message.size() - n);
+  } else if (write_cmpl_cb_ && !producer_) {
+    loop_->queueInLoop(std::bind(write_cmpl_cb_, shared_from_this()));
+  }
+  return true;
+}
+
+void TcpConnection::setMemoryPaused(bool paused) {
+  if (paused) {
+    pauseRead(PausedByMemory);
+  } else {
+    resumeRead(PausedByMemory);
   }
 }
 
-void TcpConnection::setTcpNoDelay(bool on) { socket_->setTcpNoDelay(on); }
+void TcpConnection::setTcpNoDelay(bool on) { socket_.setTcpNoDelay(on); }
 
-void TcpConnection::setTcpKeepAlive(bool on) { socket_->setKeepAlive(on); }
+void TcpConnection::setTcpKeepAlive(bool on) { socket_.setKeepAlive(on); }
 
 /**
  * Called in TcpServer::newConnection()
  *
- * Register ReadEvent on socket_->getFd() and invoke connection_cb_ passed by
+ * Register ReadEvent on socket_.getFd() and invoke connection_cb_ passed by
  * TcpServer
  */
 void TcpConnection::establishConnection() {
   loop_->assertInLoopThread();
   assert(state_ == States::Connecting);
   setState(States::Connected);
-  channel_->enableReading();
+  connection_gauge.inc();
+  if (read_pause_ == 0) {
+    channel_.enableReading();
+  }
+  if (tls_) {
+    tls_handshaking_ = true;
+    /* A client speaks first */
+    continueHandshake();
+    return;
+  }
 
+  runConnectionCallback();
+}
+
+void TcpConnection::startTls(const std::shared_ptr<TlsContext>& context,
+                             const std::string& server_name) {
+  assert(state_ == States::Connecting);
+  tls_.reset(new TlsSession(context, channel_.getFd(), server_name));
+}
+
+void TcpConnection::continueHandshake() {
+  const int ret = tls_->handshake();
+  if (ret == 0) {
+    if (tls_->wantWrite() && !channel_.isWriting()) {
+      channel_.enableWriting();
+    } else if (!tls_->wantWrite() && channel_.isWriting()) {
+      channel_.disableWriting();
+    }
+    return;
+  }
+  if (channel_.isWriting() && outputBytes() == 0) {
+    channel_.disableWriting();
+  }
+  if (ret < 0) {
+    LOG << "TcpConnection::continueHandshake [" << name() << "] failed";
+    handleClose();
+    return;
+  }
+  tls_handshaking_ = false;
+  LOG << "TcpConnection::continueHandshake [" << name() << "] kernel tls send "
+      << (tls_->kernelSend() ? "on" : "off") << " recv "
+      << (tls_->kernelRecv() ? "on" : "off");
+  runConnectionCallback();
+  /* Data that came with the last handshake flight is decrypted already */
+  if (tls_->hasPending() && channel_.isReading()) {
+    handleRead(loop_->pollReturnTime());
+  }
+}
+
+void TcpConnection::runConnectionCallback() {
+  EventLoop::CallbackScope callback(loop_, "ConnectionCallback", this);
   connection_cb_(shared_from_this());
 }
 
+ssize_t TcpConnection::writeSocket(const void* data, size_t len) {
+  if (tls_ && !tls_->kernelSend()) {
+    return tls_->write(data, len);
+  }
+  return ::write(channel_.getFd(), data, len);
+}
+
 /**
  * ReadEventCallback of channel_
  */
 void TcpConnection::handleRead(Timestamp recv_time) {
+  if (tls_handshaking_) {
+    continueHandshake();
+    return;
+  }
+  if (read_budget_bytes_ > 0 || read_budget_us_ > 0) {
+    readWithBudget(recv_time);
+  } else {
+    readOnce(recv_time);
+  }
+}
+
+ssize_t TcpConnection::readOnce(Timestamp recv_time) {
   int saved_errno = 0;
-  ssize_t n = input_buffer_.readFd(channel_->getFd(), &saved_errno);
+  ssize_t n = 0;
+  if (tls_ && (!tls_->kernelRecv() || tls_->hasPending())) {
+    n = tls_->read(&input_buffer_, &saved_errno);
+  } else {
+    n = receive_fds_ ? input_buffer_.readFd(channel_.getFd(), &saved_errno,
+                                            &received_fds_)
+                     : input_buffer_.readFd(channel_.getFd(), &saved_errno);
+    if (n < 0 && saved_errno == EIO && tls_) {
+      /* Kernel TLS only passes data records, OpenSSL handles the others */
+      n = tls_->read(&input_buffer_, &saved_errno);
+    }
+  }
   /* Invoke message callback when readable events arrive */
   if (n > 0) {
-    message_cb_(shared_from_this(), &input_buffer_, recv_time);
+    read_bytes_counter.inc(n);
+    if (rate_limiter_) {
+      chargeIngress(n, recv_time);
+    }
+    {
+      TraceScope scope("message", "conn", id_);
+      EventLoop::CallbackScope callback(loop_, "MessageCallback", this);
+      message_cb_(shared_from_this(), &input_buffer_, recv_time);
+    }
+    if (memory_account_) {
+      updateMemory();
+    }
     /* POLLRDHUP */
   } else if (n == 0) {
     handleClose();
+  } else if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK) {
+    /**
+     * Drained: a budgeted read after a full one, or a deferred read, has no
+     * readiness event behind it. With TLS also part of a record, or one
+     * without application data
+     */
   } else {
     errno = saved_errno;
     LOG << "Error: TcpConnection::handleRead";
     handleError();
+    if (tls_) {
+      /* The session is unusable after a TLS error */
+      handleClose();
+    }
+  }
+  return n;
+}
+
+/**
+ * Reading in a loop saves the poll round trip of a busy connection, the
+ * budget keeps it from starving the others of the same loop
+ */
+void TcpConnection::readWithBudget(Timestamp recv_time) {
+  const uint64_t iteration = loop_->iteration();
+  if (read_iteration_ != iteration) {
+    read_iteration_ = iteration;
+    read_bytes_ = 0;
+    read_us_ = 0;
+  }
+  int64_t start_us = Timestamp::now().microSecondsSinceEpoch();
+  for (;;) {
+    const size_t capacity =
+        input_buffer_.writableBytes() + Buffer::ExtraBufferSize;
+    const ssize_t n = readOnce(recv_time);
+    const int64_t end_us = Timestamp::now().microSecondsSinceEpoch();
+    read_us_ += end_us - start_us;
+    start_us = end_us;
+    /* Closed, failed, or paused by the callback, backpressure or limiter */
+    if (n <= 0 || read_pause_ != 0 || !channel_.isReading()) {
+      return;
+    }
+    read_bytes_ += static_cast<size_t>(n);
+    if (static_cast<size_t>(n) < capacity) {
+      /* Drained, poll reports the next data */
+      return;
+    }
+    if (readBudgetSpent()) {
+      deferRead();
+      return;
+    }
+  }
+}
+
+void TcpConnection::deferRead() {
+  pauseRead(PausedByReadBudget);
+  loop_->deferToNextIteration(
+      std::bind(&TcpConnection::resumeDeferredRead, shared_from_this()));
+}
+
+void TcpConnection::resumeDeferredRead() {
+  resumeRead(PausedByReadBudget);
+  /* Unless closed meanwhile or paused for another reason */
+  if (channel_.isReading()) {
+    readWithBudget(loop_->pollReturnTime());
   }
 }
 
@@ -162,43 +866,139 @@ void TcpConnection::handleRead(Timestamp recv_time) {
  */
 void TcpConnection::handleWrite() {
   loop_->assertInLoopThread();
-  if (channel_->isWriting()) {
-    ssize_t n = write(channel_->getFd(), output_buffer_.peek(),
-                      output_buffer_.readableBytes());
+  if (tls_handshaking_) {
+    continueHandshake();
+    return;
+  }
+  if (egress_paused_) {
+    /* Level triggered, stop polling until the refill tick */
+    channel_.disableWriting();
+    return;
+  }
+  if (channel_.isWriting()) {
+    ssize_t n = writeOutput(0);
     if (n > 0) {
-      output_buffer_.retrieve(n);
+      if (producer_ && outputBytes() < stream_low_water_mark_) {
+        pullStream();
+      }
       /**
        * Data has been written completely, unregistering WriteEvent of this fd
        */
-      if (output_buffer_.readableBytes() == 0) {
-        channel_->disableWriting();
-        if (write_cmpl_cb_) {
-          loop_->queueInLoop(std::bind(write_cmpl_cb_, shared_from_this()));
-        }
-        if (state_ == States::Disconnecting) {
-          shutdownInLoop();
-        }
-      } else { /* if (output_buffer_.readableBytes() == 0) */
+      if (outputBytes() == 0) {
+        channel_.disableWriting();
+        onOutputDrained();
+      } else { /* if (outputBytes() == 0) */
         LOG << "I am going to write more data";
       }
     } else { /* if (n > 0) */
       LOG << "TcpConnection::handleWrite";
     }
     /* Write side of this socket has been shutdown() */
-  } else { /* if (channel_->isWriting()) */
+  } else { /* if (channel_.isWriting()) */
     LOG << "Connection is down, no more writing";
   }
 }
 
+/**
+ * Gather output_queue_ and output_buffer_ into one sendmsg(2)
+ */
+ssize_t TcpConnection::writeOutput(int flags) {
+  struct iovec vec[MaxWriteIov];
+  int iovcnt = 0;
+  for (auto it = output_queue_.begin();
+       it != output_queue_.end() && iovcnt < MaxWriteIov - 1; ++it) {
+    vec[iovcnt].iov_base = const_cast<char*>(it->data());
+    vec[iovcnt].iov_len = it->size();
+    ++iovcnt;
+  }
+  if (output_buffer_.readableBytes() > 0 &&
+      static_cast<size_t>(iovcnt) == output_queue_.size()) {
+    vec[iovcnt].iov_base = const_cast<char*>(output_buffer_.peek());
+    vec[iovcnt].iov_len = output_buffer_.readableBytes();
+    ++iovcnt;
+  }
+
+  ssize_t n = 0;
+  if (tls_ && !tls_->kernelSend()) {
+    /* A record per chunk, stop at the first that doesn't go out whole */
+    for (int i = 0; i < iovcnt; ++i) {
+      ssize_t nwrote = tls_->write(vec[i].iov_base, vec[i].iov_len);
+      if (nwrote < 0) {
+        n = n > 0 ? n : -1;
+        break;
+      }
+      n += nwrote;
+      if (static_cast<size_t>(nwrote) < vec[i].iov_len) {
+        break;
+      }
+    }
+  } else {
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = vec;
+    msg.msg_iovlen = iovcnt;
+    n = ::sendmsg(channel_.getFd(), &msg, flags);
+  }
+  if (n > 0) {
+    written_bytes_counter.inc(n);
+    retrieveOutput(n);
+    if (rate_limiter_) {
+      chargeEgress(n);
+    }
+    if (backpressure_paused_ && outputBytes() <= backpressure_low_) {
+      backpressure_paused_ = false;
+      resumeBackpressureTarget();
+    }
+  }
+  return n;
+}
+
+void TcpConnection::onOutputDrained() {
+  if (producer_) {
+    /* A stream's write complete is its StreamCompleteCallback */
+    pullStream();
+    return;
+  }
+  if (write_cmpl_cb_) {
+    loop_->queueInLoop(std::bind(write_cmpl_cb_, shared_from_this()));
+  }
+  if (state_ == States::Disconnecting) {
+    shutdownInLoop();
+  }
+}
+
+/**
+ * Consume @n written bytes, Slices are released as soon as they are fully
+ * written
+ */
+void TcpConnection::retrieveOutput(size_t n) {
+  while (n > 0 && !output_queue_.empty()) {
+    Slice& front = output_queue_.front();
+    size_t consumed = std::min(n, front.size());
+    front.removePrefix(consumed);
+    output_queue_bytes_ -= consumed;
+    n -= consumed;
+    if (front.empty()) {
+      output_queue_.pop_front();
+    }
+  }
+  if (n > 0) {
+    output_buffer_.retrieve(n);
+  }
+  if (memory_account_) {
+    updateMemory();
+  }
+}
+
 /**
  * CloseCallback of channel_
  */
 void TcpConnection::handleClose() {
   loop_->assertInLoopThread();
-  LOG << "TcpConnection::handleClose state = " << state_;
+  LOG << "TcpConnection::handleClose state = " << static_cast<int>(state_);
   assert(state_ == States::Connected || state_ == States::Disconnecting);
   // we don't close fd, leave it to dtor, so we can find leaks easily.
-  channel_->disableAllEvents();
+  channel_.disableAllEvents();
   // must be the last line
   close_cb_(shared_from_this());
 }
@@ -207,9 +1007,9 @@ void TcpConnection::handleClose() {
  * ErrorCallback of channel_
  */
 void TcpConnection::handleError() {
-  int err = sockets::getSocketError(channel_->getFd());
-  LOG << "TcpConnection::handleError [" << name_ << "] - SO_ERROR = " << err
-      << " " << strerror_tl(err);
+  int err = sockets::getSocketError(channel_.getFd());
+  LOG << "TcpConnection::handleError [" << name() << "] - SO_ERROR = " << err
+      << " " << strerror(err);
 }
 
 /**
@@ -220,8 +1020,25 @@ void TcpConnection::destroyConnection() {
   loop_->assertInLoopThread();
   assert(state_ == States::Connected || state_ == States::Disconnecting);
   setState(States::Disconnected);
-  channel_->disableAllEvents();
-  connection_cb_(shared_from_this());
+  connection_gauge.dec();
+  channel_.disableAllEvents();
+  /* Don't leave a linked upstream throttled forever */
+  if (backpressure_paused_ && !backpressure_target_.expired()) {
+    backpressure_paused_ = false;
+    resumeBackpressureTarget();
+  }
+  if (producer_) {
+    finishStream(false);
+  }
+  /* A connection that failed its TLS handshake was never reported up */
+  if (!tls_handshaking_) {
+    runConnectionCallback();
+  }
+  if (memory_account_ && memory_charged_ > 0) {
+    /* Storage goes back to the pool or the heap with this connection */
+    memory_account_->charge(-static_cast<int64_t>(memory_charged_));
+    memory_charged_ = 0;
+  }
 
-  loop_->removeChannel(channel_.get());
+  loop_->removeChannel(&channel_);
 }
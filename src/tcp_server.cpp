@@ -1,6 +1,8 @@
 #include "tcp_server.h"
 
-#include <stdio.h>  // snprintf
+#include <unistd.h>
+
+#include <algorithm>
 
 #include "acceptor.h"
 #include "event_loop.h"
@@ -8,6 +10,7 @@
 #include "inet_addr.h"
 #include "logging.h"
 #include "sockets_options.h"
+#include "stall_watchdog.h"
 
 /**
  * Once a TcpServer object is constructed, a Socket has been created and binded
@@ -18,8 +21,14 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& listen_addr)
       name_(listen_addr.toHostPort()),
       acceptor_(new Acceptor(loop, listen_addr)),
       thread_pool_(new EventLoopThreadPool(loop)),
+      options_(std::make_shared<ConnectionOptions>()),
+      watchdog_(nullptr),
+      overloaded_(false),
+      calm_samples_(0),
+      rejected_(0),
       started_(false),
-      next_conn_id_(1) {
+      next_conn_id_(1),
+      next_shard_(0) {
   /**
    * Use placeholders to provide arguments when invoking
    * TcpServer::newConnection
@@ -29,7 +38,26 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& listen_addr)
                                                 std::placeholders::_2));
 }
 
-TcpServer::~TcpServer() {}
+/**
+ * Each shard is handed over to its loop, which destroys the remaining
+ * connections in the right thread
+ */
+TcpServer::~TcpServer() {
+  loop_->assertInLoopThread();
+  /* A no-op unless accepting is paused for overload */
+  loop_->cancel(overload_timer_);
+  for (auto& shard : shards_) {
+    if (watchdog_) {
+      watchdog_->unwatch(shard->loop);
+    }
+    std::shared_ptr<Shard> owned(std::move(shard));
+    owned->loop->runInLoop([owned] {
+      owned->connections.forEach([](const TcpConnectionPtr& conn) {
+        conn->destroyConnection();
+      });
+    });
+  }
+}
 
 void TcpServer::setThreadNum(int num_threads) {
   assert(0 <= num_threads);
@@ -43,6 +71,24 @@ void TcpServer::start() {
   if (!started_) {
     started_ = true;
     thread_pool_->start();
+    for (EventLoop* io_loop : thread_pool_->getAllLoops()) {
+      shards_.push_back(std::make_shared<Shard>(io_loop, name_, options_));
+      if (rate_per_connection_.limited() || rate_per_loop_.limited()) {
+        shards_.back()->rate_limiter = std::make_shared<RateLimiter>(
+            io_loop, rate_per_connection_, rate_per_loop_);
+      }
+      if (memory_budget_) {
+        const std::shared_ptr<Shard>& shard = shards_.back();
+        /* Connections may keep the account alive past the shard */
+        std::shared_ptr<const ConnectionRegistry> connections(
+            shard, &shard->connections);
+        shard->memory = std::make_shared<MemoryAccount>(
+            io_loop, connections, memory_budget_, memory_per_loop_);
+      }
+      if (watchdog_) {
+        watchdog_->watch(io_loop);
+      }
+    }
   }
 
   if (!acceptor_->listenning()) {
@@ -51,39 +97,163 @@ void TcpServer::start() {
 }
 
 /**
- * Create a new connection by constructing a TcpConnection object and pass
- * connection_cb_ and message_cb_ to it. Call connection->establishConnection to
- * register fd returned by syscall accept() on poll_fds_
+ * Pick an I/O loop for the accepted sockfd. The TcpConnection is created,
+ * registered and established in that loop, so that it is allocated from the
+ * loop's ConnectionPool and fd returned by syscall accept() is registered on
+ * that loop's poll_fds_
  */
-void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
+void TcpServer::newConnection(int sockfd, const InetAddress& peer_addr) {
   loop_->assertInLoopThread();
-  char buf[32];
-  snprintf(buf, sizeof buf, "#%d", next_conn_id_);
-  ++next_conn_id_;
-  std::string connName = name_ + buf;
+  assert(!shards_.empty());
+  if (memory_budget_ && memory_budget_->overHardLimit()) {
+    LOG << "TcpServer::newConnection [" << name_
+        << "] - refused, buffer memory over the hard limit";
+    memory_budget_->noteRejected();
+    sockets::closeWithReset(sockfd);
+    return;
+  }
+  if (overload_policy_.action != OverloadPolicy::Action::None &&
+      checkOverload()) {
+    if (overload_policy_.action == OverloadPolicy::Action::Reject) {
+      rejectConnection(sockfd);
+      return;
+    }
+    if (!acceptor_->paused()) {
+      /* This one is accepted already, the next ones wait */
+      acceptor_->pause();
+      overload_timer_ = loop_->runAfter(OverloadCheckInterval,
+                                        [this] { onOverloadCheck(); });
+    }
+  }
+  const uint64_t id = next_conn_id_++;
+  std::shared_ptr<Shard> shard = shards_[next_shard_];
+  /* round-robin */
+  if (++next_shard_ >= shards_.size()) {
+    next_shard_ = 0;
+  }
 
-  LOG << "TcpServer::newConnection [" << name_ << "] - new connection ["
-      << connName << "] from " << peerAddr.toHostPort();
-  InetAddress localAddr(sockets::getLocalAddr(sockfd));
+  LOG << "TcpServer::newConnection [" << name_ << "] - new connection #" << id
+      << " from " << peer_addr.toHostPort();
+  EventLoop* io_loop = shard->loop;
+  io_loop->runInLoop(std::bind(&TcpServer::newConnectionInLoop,
+                               std::move(shard), id, sockfd, peer_addr));
+}
+
+/**
+ * Pass the connection options of @shard to the new connection, then register
+ * it and call connection->establishConnection
+ */
+void TcpServer::newConnectionInLoop(const std::shared_ptr<Shard>& shard,
+                                    uint64_t id, int sockfd,
+                                    const InetAddress& peer_addr) {
+  shard->loop->assertInLoopThread();
+  if (shard->memory && shard->memory->overHardLimit()) {
+    /* This loop is over its own limit, the acceptor can't see that */
+    shard->memory->budget()->noteRejected();
+    sockets::closeWithReset(sockfd);
+    return;
+  }
+  InetAddress local_addr(sockets::getLocalAddr(sockfd));
   // FIXME poll with zero timeout to double confirm the new connection
-  EventLoop* io_loop = thread_pool_->getNextLoop();
-  TcpConnectionPtr conn(
-      new TcpConnection(io_loop, connName, sockfd, localAddr, peerAddr));
-  connections_[connName] = conn;
-  conn->setConnectionCallback(connection_cb_);
-  conn->setMessageCallback(message_cb_);
-  conn->setWriteCallback(write_cmpl_cb_);
-  conn->setCloseCallback(
-      std::bind(&TcpServer::removeConnection, this, std::placeholders::_1));
+  /* Control block and TcpConnection share one pooled block */
+  TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(
+      PoolAllocator<TcpConnection>(shard->pool), shard->loop, id, sockfd,
+      local_addr, peer_addr, shard->pool);
+  const ConnectionOptions& options = *shard->options;
+  conn->setConnectionCallback(options.connection_cb);
+  conn->setMessageCallback(options.message_cb);
+  conn->setWriteCallback(options.write_cmpl_cb);
+  if (options.high_water_cb) {
+    conn->setHighWaterMarkCallback(options.high_water_cb,
+                                   options.high_water_mark);
+  }
+  if (options.backpressure_high > 0) {
+    conn->enableBackpressure(options.backpressure_high,
+                             options.backpressure_low);
+  }
+  conn->setAutoCork(options.auto_cork);
+  conn->setReadBudget(options.read_budget_bytes, options.read_budget_us);
+  if (shard->rate_limiter) {
+    conn->setRateLimiter(shard->rate_limiter);
+  }
+  if (shard->memory) {
+    conn->setMemoryAccount(shard->memory);
+  }
+  if (options.tls_context) {
+    conn->startTls(options.tls_context);
+  }
+  /* A shard gone with its server has destroyed its connections already */
+  std::weak_ptr<Shard> weak_shard(shard);
+  conn->setCloseCallback([weak_shard](const TcpConnectionPtr& c) {
+    if (std::shared_ptr<Shard> owner = weak_shard.lock()) {
+      removeConnection(owner.get(), c);
+    }
+  });
+  shard->connections.insert(id, conn);
   conn->establishConnection();
 }
 
-void TcpServer::removeConnection(const TcpConnectionPtr& conn) {
-  loop_->assertInLoopThread();
-  LOG << "TcpServer::removeConnection [" << name_ << "] - connection "
-      << conn->name();
-  size_t n = connections_.erase(conn->name());
-  assert(n == 1);
+/**
+ * CloseCallback of every connection, runs in the connection's own loop
+ */
+void TcpServer::removeConnection(Shard* shard, const TcpConnectionPtr& conn) {
+  shard->loop->assertInLoopThread();
+  LOG << "TcpServer::removeConnection [" << shard->name << "] - connection #"
+      << conn->id();
+  bool erased = shard->connections.erase(conn->id());
+  assert(erased);
+  (void)erased;
+  shard->loop->queueInLoop(std::bind(&TcpConnection::destroyConnection, conn));
+}
+
+/**
+ * Hysteresis between high_lag and low_lag, so shedding doesn't flap on
+ * every sample around one threshold. Recovery takes recovery_samples calm
+ * checks in a row, a sample may catch a busy loop in poll
+ */
+bool TcpServer::checkOverload() {
+  int64_t lag_us = 0;
+  for (const auto& shard : shards_) {
+    lag_us = std::max(lag_us, shard->loop->lagMicros());
+  }
+  const double lag = static_cast<double>(lag_us) / 1e6;
+  if (!overloaded_) {
+    if (lag > overload_policy_.high_lag) {
+      overloaded_ = true;
+      calm_samples_ = 0;
+      LOG << "TcpServer::checkOverload [" << name_ << "] overloaded, lag "
+          << lag_us << "us";
+    }
+  } else if (lag >= overload_policy_.low_lag) {
+    calm_samples_ = 0;
+  } else if (++calm_samples_ >= overload_policy_.recovery_samples) {
+    overloaded_ = false;
+    LOG << "TcpServer::checkOverload [" << name_ << "] recovered";
+  }
+  return overloaded_;
+}
+
+/**
+ * A fresh socket's send buffer takes a short message whole, so one
+ * non-blocking write is enough
+ */
+void TcpServer::rejectConnection(int sockfd) {
+  ++rejected_;
+  const std::string& message = overload_policy_.reject_message;
+  if (message.empty()) {
+    sockets::closeWithReset(sockfd);
+    return;
+  }
+  ssize_t n = ::write(sockfd, message.data(), message.size());
   (void)n;
-  loop_->queueInLoop(std::bind(&TcpConnection::destroyConnection, conn));
+  sockets::close(sockfd);
+}
+
+void TcpServer::onOverloadCheck() {
+  if (!checkOverload()) {
+    acceptor_->resume();
+    return;
+  }
+  overload_timer_ = loop_->runAfter(OverloadCheckInterval,
+                                    [this] { onOverloadCheck(); });
 }
@@ -17,7 +17,7 @@
 #include "timestamp.h"
 
 namespace {
-pid_t gettid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+pid_t getTid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
 
 void afterFork() {
   // Need to set t_cachedTid everytime a new thread is forked otherwise it is
@@ -34,9 +34,9 @@ thread_local const char* t_threadName = "default";
 
 pid_t tid() {
   if (t_cachedTid == 0) {
-    t_cachedTid = gettid();
-    return t_cachedTid;
+    t_cachedTid = getTid();
   }
+  return t_cachedTid;
 }
 
 const char* name() { return t_threadName; }
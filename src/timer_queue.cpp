@@ -10,6 +10,13 @@
 
 #include "event_loop.h"
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
+
+namespace {
+Gauge timer_gauge("timer_queue_timers", "Timers waiting to expire");
+Counter fired_counter("timer_queue_fired_total", "Timer callbacks run");
+}  // namespace
 
 int createTimerfd() {
   int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
@@ -59,29 +66,68 @@ TimerQueue::TimerQueue(EventLoop* loop)
     : loop_(loop),
       timerfd_(createTimerfd()),
       timerfd_channel_(loop, timerfd_),
-      timers_() {
+      timers_(),
+      calling_expired_timers_(false) {
   timerfd_channel_.setReadCallback(std::bind(&TimerQueue::handleRead, this));
   // we are always reading the timerfd, we disarm it with timerfd_settime.
   timerfd_channel_.enableReading();
 }
 
 // Timer object is auto managed by unique_ptr
-TimerQueue::~TimerQueue() { close(timerfd_); }
+TimerQueue::~TimerQueue() {
+  timerfd_channel_.disableAllEvents();
+  loop_->removeChannel(&timerfd_channel_);
+  close(timerfd_);
+  timer_gauge.add(-static_cast<int64_t>(timers_.size()));
+}
 
 TimerId TimerQueue::addTimer(const Timer::TimerCallback& cb, Timestamp when,
                              double interval) {
-  auto timer = std::make_unique<Timer>(cb, when, interval);
-  loop_->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-  return TimerId(timer.get());
+  /* std::function must be copyable, the functor owns the timer until run */
+  Timer* timer = new Timer(cb, when, interval);
+  const TimerId timer_id(timer, timer->sequence());
+  loop_->runInLoop([this, timer] {
+    addTimerInLoop(std::unique_ptr<Timer>(timer));
+  });
+  return timer_id;
+}
+
+void TimerQueue::cancel(TimerId timer_id) {
+  loop_->runInLoop([this, timer_id] { cancelInLoop(timer_id); });
 }
 
-void TimerQueue::addTimerInLoop(std::unique_ptr<Timer>& timer) {
+void TimerQueue::cancelInLoop(TimerId timer_id) {
+  loop_->assertInLoopThread();
+  const ActiveTimer timer(timer_id.timer_, timer_id.sequence_);
+  auto active = active_timers_.find(timer);
+  if (active == active_timers_.end()) {
+    /* Expired, or being run: a repeating one must not be restarted */
+    if (calling_expired_timers_) {
+      canceling_timers_.insert(timer);
+    }
+    return;
+  }
+  /* Not dereferenced before it is known to be alive */
+  auto range = timers_.equal_range(timer.first->getExpiration());
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.get() == timer.first) {
+      timers_.erase(it);
+      break;
+    }
+  }
+  active_timers_.erase(active);
+  timer_gauge.dec();
+}
+
+void TimerQueue::addTimerInLoop(std::unique_ptr<Timer> timer) {
   // Can only add timer event in I/O thread
   loop_->assertInLoopThread();
+  const Timestamp when = timer->getExpiration();
   bool earliest_to_alarm = insert(std::move(timer));
+  timer_gauge.inc();
 
   if (earliest_to_alarm) {
-    resetTimerfd(timerfd_, timer->getExpiration());
+    resetTimerfd(timerfd_, when);
   }
 }
 
@@ -91,25 +137,38 @@ void TimerQueue::handleRead() {
   readTimerfd(timerfd_, now);
 
   std::vector<TimerEntry> expired = getExpired(now);
+  fired_counter.inc(expired.size());
 
+  calling_expired_timers_ = true;
+  canceling_timers_.clear();
   /* Safe to callback outside critical section */
   for (auto it = expired.begin(); it != expired.end(); ++it) {
+    /* Canceled by a timer of the same batch */
+    if (!canceling_timers_.empty() &&
+        canceling_timers_.count(ActiveTimer(it->second.get(),
+                                            it->second->sequence()))) {
+      continue;
+    }
+    TraceScope scope("timer");
+    EventLoop::CallbackScope callback(loop_, "TimerCallback");
     it->second->run();
   }
+  calling_expired_timers_ = false;
 
   reset(expired, now);
 }
 
 std::vector<TimerQueue::TimerEntry> TimerQueue::getExpired(Timestamp now) {
   std::vector<TimerEntry> expired;
-  Timer* ptr = reinterpret_cast<Timer*>(UINTPTR_MAX);
-  auto sentry = std::make_pair(now, std::unique_ptr<Timer>(ptr));
-  // Get the iterator pointing to the first Timer that has nor expired
-  auto it = timers_.lower_bound(sentry);
-  assert(it == timers_.end() || now < it->first);
+  // Get the iterator pointing to the first Timer that has not expired
+  auto end = timers_.upper_bound(now);
+  assert(end == timers_.end() || now < end->first);
   // Expired Timers now owned by expired
-  std::copy(timers_.begin(), it, std::back_inserter(expired));
-  timers_.erase(timers_.begin(), it);
+  for (auto it = timers_.begin(); it != end; ++it) {
+    active_timers_.erase(ActiveTimer(it->second.get(), it->second->sequence()));
+    expired.emplace_back(it->first, std::move(it->second));
+  }
+  timers_.erase(timers_.begin(), end);
   return expired;
 }
 
@@ -117,11 +176,13 @@ void TimerQueue::reset(std::vector<TimerEntry>& expired, Timestamp now) {
   Timestamp next_expire;
 
   for (auto it = expired.begin(); it != expired.end(); ++it) {
-    if (it->second->isRepeat()) {
+    const ActiveTimer timer(it->second.get(), it->second->sequence());
+    if (it->second->isRepeat() && !canceling_timers_.count(timer)) {
       it->second->restart(now);
       insert(std::move(it->second));
     } else {
       it->second.reset();
+      timer_gauge.dec();
     }
   }
 
@@ -142,7 +203,7 @@ bool TimerQueue::insert(std::unique_ptr<Timer> timer) {
     earliest_to_alarm = true;
   }
   // Timer is owned by timers_
-  auto result = timers_.insert(std::make_pair(when, std::move(timer)));
-  assert(result.second);
+  active_timers_.emplace(timer.get(), timer->sequence());
+  timers_.emplace(when, std::move(timer));
   return earliest_to_alarm;
 }
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #undef __STDC_FORMAT_MACROS
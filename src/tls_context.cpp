@@ -0,0 +1,201 @@
+#include "tls_context.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "buffer.h"
+#include "logging.h"
+
+namespace {
+/* The reason of the last OpenSSL error, clearing the queue */
+const char* lastError() {
+  unsigned long err = ERR_get_error();
+  ERR_clear_error();
+  const char* reason = err ? ERR_reason_error_string(err) : nullptr;
+  return reason ? reason : "unknown";
+}
+
+/**
+ * Partial writes, so a large SSL_write returns after the records that fit
+ * in the socket, and retries with the same bytes at another address, as
+ * pending output moves between Buffers and Slices
+ */
+const long kSslModes =
+    SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER;
+}  // namespace
+
+std::shared_ptr<TlsContext> TlsContext::newServer(const std::string& cert_file,
+                                                  const std::string& key_file) {
+  SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == nullptr) {
+    LOG << "TlsContext::newServer " << lastError();
+    return nullptr;
+  }
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) !=
+          1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    LOG << "TlsContext::newServer " << cert_file << " " << lastError();
+    SSL_CTX_free(ctx);
+    return nullptr;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_mode(ctx, kSslModes);
+  std::shared_ptr<TlsContext> context(new TlsContext(ctx, true));
+  context->setKernelTls(true);
+  return context;
+}
+
+std::shared_ptr<TlsContext> TlsContext::newClient(bool verify) {
+  SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+  if (ctx == nullptr) {
+    LOG << "TlsContext::newClient " << lastError();
+    return nullptr;
+  }
+  if (verify) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    SSL_CTX_set_default_verify_paths(ctx);
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_mode(ctx, kSslModes);
+  std::shared_ptr<TlsContext> context(new TlsContext(ctx, false));
+  context->setKernelTls(true);
+  return context;
+}
+
+TlsContext::~TlsContext() { SSL_CTX_free(ctx_); }
+
+void TlsContext::setKernelTls(bool on) {
+#ifdef SSL_OP_ENABLE_KTLS
+  if (on) {
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+  } else {
+    SSL_CTX_clear_options(ctx_, SSL_OP_ENABLE_KTLS);
+  }
+#else
+  (void)on;
+#endif
+}
+
+TlsSession::TlsSession(const std::shared_ptr<TlsContext>& context, int sockfd,
+                       const std::string& server_name)
+    : ssl_(SSL_new(context->get())),
+      context_(context),
+      want_write_(false),
+      kernel_send_(false),
+      kernel_recv_(false) {
+  if (ssl_ == nullptr) {
+    /* Out of memory, handshake() fails and the connection closes */
+    LOG << "TlsSession SSL_new " << lastError();
+    return;
+  }
+  /* A socket BIO, which OpenSSL can switch to kernel TLS */
+  SSL_set_fd(ssl_, sockfd);
+  if (context->isServer()) {
+    SSL_set_accept_state(ssl_);
+  } else {
+    SSL_set_connect_state(ssl_);
+    if (!server_name.empty()) {
+      SSL_set_tlsext_host_name(ssl_, server_name.c_str());
+      SSL_set1_host(ssl_, server_name.c_str());
+    }
+  }
+}
+
+TlsSession::~TlsSession() { SSL_free(ssl_); }
+
+int TlsSession::handshake() {
+  if (ssl_ == nullptr) {
+    return -1;
+  }
+  const int ret = SSL_do_handshake(ssl_);
+  if (ret == 1) {
+    want_write_ = false;
+#ifdef SSL_OP_ENABLE_KTLS
+    kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    kernel_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+#endif
+    return 1;
+  }
+  switch (SSL_get_error(ssl_, ret)) {
+    case SSL_ERROR_WANT_READ:
+      want_write_ = false;
+      return 0;
+    case SSL_ERROR_WANT_WRITE:
+      want_write_ = true;
+      return 0;
+    default:
+      LOG << "TlsSession::handshake " << lastError();
+      return -1;
+  }
+}
+
+bool TlsSession::hasPending() const { return SSL_pending(ssl_) > 0; }
+
+bool TlsSession::receivedShutdown() const {
+  return ssl_ != nullptr &&
+         (SSL_get_shutdown(ssl_) & SSL_RECEIVED_SHUTDOWN) != 0;
+}
+
+ssize_t TlsSession::read(Buffer* buf, int* saved_errno) {
+  ssize_t total = 0;
+  while (static_cast<size_t>(total) < MaxReadBytes) {
+    /* One record at most per SSL_read */
+    buf->ensureWritableBytes(16 * 1024);
+    size_t n = 0;
+    const int ret =
+        SSL_read_ex(ssl_, buf->beginWrite(), buf->writableBytes(), &n);
+    if (ret == 1) {
+      buf->hasWritten(n);
+      total += static_cast<ssize_t>(n);
+      continue;
+    }
+    const int err = mapError(0);
+    if (total > 0) {
+      break;
+    }
+    if (err == 0) {
+      return 0;
+    }
+    *saved_errno = err;
+    return -1;
+  }
+  return total;
+}
+
+ssize_t TlsSession::write(const void* data, size_t len) {
+  size_t n = 0;
+  if (SSL_write_ex(ssl_, data, len, &n) == 1) {
+    return static_cast<ssize_t>(n);
+  }
+  errno = mapError(0);
+  return -1;
+}
+
+void TlsSession::shutdown() {
+  if (SSL_shutdown(ssl_) < 0) {
+    ERR_clear_error();
+  }
+}
+
+/**
+ * Decided by the last call on ssl_, @ret is the value it returned: 0 for
+ * the _ex functions, which report failure as 0. Returns 0 for a clean end
+ * of stream (close_notify)
+ */
+int TlsSession::mapError(int ret) {
+  switch (SSL_get_error(ssl_, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return EAGAIN;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_SYSCALL:
+      ERR_clear_error();
+      return errno ? errno : ECONNRESET;
+    default:
+      LOG << "TlsSession " << lastError();
+      return EPROTO;
+  }
+}
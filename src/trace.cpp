@@ -0,0 +1,282 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "logging.h"
+#include "thread.h"
+
+std::atomic<bool> Tracer::enabled_(false);
+std::atomic<uint64_t> Tracer::next_flow_id_(1);
+
+/**
+ * Single-writer ring of events
+ *
+ * Fields are relaxed atomics, plain stores on the common targets, so a
+ * reader copying a slot the writer is overwriting gets a stale event rather
+ * than a data race. The head is published with release after the fields.
+ */
+class Tracer::Ring {
+ public:
+  struct Event {
+    std::atomic<uint64_t> ticks;
+    std::atomic<const char*> name;
+    std::atomic<const char*> arg_name;
+    std::atomic<uint64_t> arg;
+    std::atomic<char> phase;
+  };
+
+  /* A copy taken by dump() */
+  struct Record {
+    uint64_t ticks;
+    const char* name;
+    const char* arg_name;
+    uint64_t arg;
+    char phase;
+  };
+
+  Ring()
+      : events_(new Event[RingCapacity]),
+        head_(0),
+        from_(0),
+        tid_(CurrentThread::tid()),
+        name_(CurrentThread::name() ? CurrentThread::name() : "main"),
+        exited_(false) {}
+
+  DISALLOW_COPY(Ring);
+
+  void push(char phase, const char* name, const char* arg_name,
+            uint64_t arg) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    Event& event = events_[head & (RingCapacity - 1)];
+    event.ticks.store(ticks(), std::memory_order_relaxed);
+    event.name.store(name, std::memory_order_relaxed);
+    event.arg_name.store(arg_name, std::memory_order_relaxed);
+    event.arg.store(arg, std::memory_order_relaxed);
+    event.phase.store(phase, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /* Events since from_ that survive the copy, oldest first */
+  void copy(std::vector<Record>* records) const {
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = std::max(from_.load(std::memory_order_relaxed),
+                              head > RingCapacity ? head - RingCapacity : 0);
+    records->clear();
+    for (uint64_t i = first; i < head; ++i) {
+      const Event& event = events_[i & (RingCapacity - 1)];
+      records->push_back({event.ticks.load(std::memory_order_relaxed),
+                          event.name.load(std::memory_order_relaxed),
+                          event.arg_name.load(std::memory_order_relaxed),
+                          event.arg.load(std::memory_order_relaxed),
+                          event.phase.load(std::memory_order_relaxed)});
+    }
+    /* Slots the writer reached meanwhile, including the one it may be in */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t now_head = head_.load(std::memory_order_relaxed);
+    if (now_head >= RingCapacity && now_head - RingCapacity + 1 > first) {
+      const uint64_t lost =
+          std::min<uint64_t>(now_head - RingCapacity + 1 - first, head - first);
+      records->erase(records->begin(), records->begin() + lost);
+    }
+  }
+
+  /* Events before now are left out of dumps */
+  void restart() {
+    from_.store(head_.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+  }
+
+  pid_t tid() const { return tid_; }
+
+  const std::string& name() const { return name_; }
+
+  bool exited() const { return exited_.load(std::memory_order_relaxed); }
+
+  void setExited() { exited_.store(true, std::memory_order_relaxed); }
+
+ private:
+  std::unique_ptr<Event[]> events_;
+  std::atomic<uint64_t> head_;
+  std::atomic<uint64_t> from_;
+  const pid_t tid_;
+  const std::string name_;
+  std::atomic<bool> exited_;
+};
+
+struct Tracer::State {
+  std::mutex mutex;
+  /* Rings of exited threads too, until the next enable() */
+  std::vector<std::unique_ptr<Ring>> rings;
+  /* Ticks and CLOCK_MONOTONIC nanoseconds at enable() */
+  uint64_t anchor_ticks = 0;
+  int64_t anchor_ns = 0;
+};
+
+class Tracer::ThreadExit {
+ public:
+  explicit ThreadExit(Ring* ring) : ring_(ring) {}
+
+  ~ThreadExit() { detachThread(ring_); }
+
+ private:
+  Ring* ring_;
+};
+
+/* Never destroyed, threads may trace while the process exits */
+Tracer::State& Tracer::state() {
+  static State* trace_state = new State;
+  return *trace_state;
+}
+
+namespace {
+int64_t monotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void appendEscaped(std::string* out, const std::string& text) {
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      out->push_back(c);
+    }
+  }
+}
+}  // namespace
+
+void Tracer::enable() {
+  State& trace = state();
+  {
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.rings.erase(
+        std::remove_if(trace.rings.begin(), trace.rings.end(),
+                       [](const std::unique_ptr<Ring>& ring) {
+                         return ring->exited();
+                       }),
+        trace.rings.end());
+    for (const auto& ring : trace.rings) {
+      ring->restart();
+    }
+    trace.anchor_ticks = ticks();
+    trace.anchor_ns = monotonicNanos();
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+void Tracer::record(char phase, const char* name, const char* arg_name,
+                    uint64_t arg) {
+  Ring* ring = thread_ring_;
+  if (ring == nullptr) {
+    ring = attachThread();
+  }
+  ring->push(phase, name, arg_name, arg);
+}
+
+Tracer::Ring* Tracer::attachThread() {
+  Ring* ring = new Ring;
+  {
+    State& trace = state();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.rings.emplace_back(ring);
+  }
+  thread_ring_ = ring;
+  thread_local ThreadExit thread_exit(ring);
+  return ring;
+}
+
+/* A new ring is made if the thread traces on, e.g. in another destructor */
+void Tracer::detachThread(Ring* ring) {
+  ring->setExited();
+  thread_ring_ = nullptr;
+}
+
+/**
+ * Ticks map to time linearly between the anchor taken by enable() and one
+ * taken now, which calibrates the cycle counter over the traced interval
+ */
+std::string Tracer::dump() {
+  State& trace = state();
+  std::lock_guard<std::mutex> lock(trace.mutex);
+  const uint64_t now_ticks = ticks();
+  const int64_t now_ns = monotonicNanos();
+  const double ns_per_tick =
+      now_ticks > trace.anchor_ticks
+          ? static_cast<double>(now_ns - trace.anchor_ns) /
+                static_cast<double>(now_ticks - trace.anchor_ticks)
+          : 1.0;
+  const int pid = static_cast<int>(::getpid());
+
+  std::string out("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  std::vector<Ring::Record> records;
+  char buf[256];
+  bool first = true;
+  for (const auto& ring : trace.rings) {
+    const int tid = static_cast<int>(ring->tid());
+    out += first ? "" : ",\n";
+    first = false;
+    snprintf(buf, sizeof buf,
+             "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"name\":\"",
+             pid, tid);
+    out += buf;
+    appendEscaped(&out, ring->name());
+    out += "\"}}";
+
+    ring->copy(&records);
+    for (const Ring::Record& record : records) {
+      const double ts_us =
+          (static_cast<double>(static_cast<int64_t>(record.ticks -
+                                                    trace.anchor_ticks)) *
+               ns_per_tick +
+           static_cast<double>(trace.anchor_ns)) /
+          1000.0;
+      snprintf(buf, sizeof buf,
+               ",\n{\"name\":\"%s\",\"cat\":\"reactor\",\"ph\":\"%c\","
+               "\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+               record.name, record.phase, ts_us, pid, tid);
+      out += buf;
+      if (record.phase == 's' || record.phase == 'f') {
+        snprintf(buf, sizeof buf, ",\"id\":%lu%s",
+                 static_cast<unsigned long>(record.arg),
+                 record.phase == 'f' ? ",\"bp\":\"e\"" : "");
+        out += buf;
+      } else if (record.arg_name != nullptr) {
+        snprintf(buf, sizeof buf, ",\"args\":{\"%s\":%lu}", record.arg_name,
+                 static_cast<unsigned long>(record.arg));
+        out += buf;
+      }
+      if (record.phase == 'i') {
+        out += ",\"s\":\"t\"";
+      }
+      out += '}';
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+bool Tracer::dumpToFile(const std::string& path) {
+  const std::string json = dump();
+  FILE* fp = ::fopen(path.c_str(), "we");
+  if (fp == nullptr) {
+    LOG << "Tracer::dumpToFile cannot open " << path;
+    return false;
+  }
+  const bool ok = ::fwrite(json.data(), 1, json.size(), fp) == json.size();
+  ::fclose(fp);
+  if (!ok) {
+    LOG << "Tracer::dumpToFile failed to write " << path;
+  }
+  return ok;
+}
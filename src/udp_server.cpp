@@ -0,0 +1,54 @@
+#include "udp_server.h"
+
+#include "event_loop.h"
+#include "event_loop_thread_pool.h"
+#include "logging.h"
+
+UdpServer::UdpServer(EventLoop* loop, const InetAddress& listen_addr)
+    : loop_(loop),
+      listen_addr_(listen_addr),
+      thread_pool_(new EventLoopThreadPool(loop)),
+      batch_size_(UdpSocket::DefaultBatchSize),
+      max_datagram_size_(UdpSocket::DefaultMaxDatagramSize),
+      gro_(false),
+      gso_(false),
+      started_(false) {}
+
+/**
+ * Sockets must leave their Poller in their own loop thread, the bound
+ * shared_ptr keeps each one alive until UdpSocket::stop() has run there
+ */
+UdpServer::~UdpServer() {
+  for (auto& sock : sockets_) {
+    sock->getLoop()->runInLoop(std::bind(&UdpSocket::stop, sock));
+  }
+}
+
+void UdpServer::setThreadNum(int num_threads) {
+  assert(0 <= num_threads);
+  thread_pool_->setThreadNum(num_threads);
+}
+
+void UdpServer::start() {
+  loop_->assertInLoopThread();
+  if (started_) {
+    return;
+  }
+  started_ = true;
+  thread_pool_->start();
+
+  std::vector<EventLoop*> loops = thread_pool_->getAllLoops();
+  const bool reuse_port = loops.size() > 1;
+  for (EventLoop* io_loop : loops) {
+    auto sock = std::make_shared<UdpSocket>(io_loop, listen_addr_, reuse_port);
+    sock->setBatchSize(batch_size_);
+    sock->setMaxDatagramSize(max_datagram_size_);
+    sock->enableGro(gro_);
+    sock->enableGso(gso_);
+    sock->setDatagramCallback(datagram_cb_);
+    io_loop->runInLoop(std::bind(&UdpSocket::start, sock.get()));
+    sockets_.push_back(sock);
+  }
+  LOG << "UdpServer::start() " << sockets_.size() << " socket(s) on "
+      << listen_addr_.toHostPort();
+}
@@ -0,0 +1,345 @@
+#include "udp_socket.h"
+
+#include <errno.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>  // bzero
+
+#include "event_loop.h"
+#include "logging.h"
+#include "sockets_options.h"
+
+/* Older libc headers lack the Linux UDP offload options */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace {
+/* Largest UDP payload over IPv4, IPv6 allows a little more */
+const size_t kMaxUdpPayload = 65507;
+
+bool samePeer(const InetAddress& l, const InetAddress& r) {
+  if (l.family() != r.family()) {
+    return false;
+  }
+  if (l.family() == AF_INET6) {
+    const struct sockaddr_in6* l6 =
+        reinterpret_cast<const struct sockaddr_in6*>(l.getSockAddr());
+    const struct sockaddr_in6* r6 =
+        reinterpret_cast<const struct sockaddr_in6*>(r.getSockAddr());
+    return memcmp(&l6->sin6_addr, &r6->sin6_addr, sizeof l6->sin6_addr) ==
+               0 &&
+           l6->sin6_port == r6->sin6_port &&
+           l6->sin6_scope_id == r6->sin6_scope_id;
+  }
+  const struct sockaddr_in& l4 = l.getSockAddrInet();
+  const struct sockaddr_in& r4 = r.getSockAddrInet();
+  return l4.sin_addr.s_addr == r4.sin_addr.s_addr && l4.sin_port == r4.sin_port;
+}
+
+/* Before the socket is created from it */
+sa_family_t checkedFamily(const InetAddress& addr) {
+  if (addr.family() != AF_INET && addr.family() != AF_INET6) {
+    LOG << "UdpSocket " << addr.toHostPort() << " is not IPv4 or IPv6";
+    abort();
+  }
+  return addr.family();
+}
+}  // namespace
+
+UdpSocket::UdpSocket(EventLoop* loop, const InetAddress& listen_addr,
+                     bool reuse_port)
+    : loop_(loop),
+      family_(checkedFamily(listen_addr)),
+      socket_(sockets::createNonblockingUdpOrDie(family_)),
+      channel_(loop, socket_.getFd()),
+      batch_size_(DefaultBatchSize),
+      max_datagram_size_(DefaultMaxDatagramSize),
+      gro_(false),
+      gso_(false),
+      started_(false),
+      in_batch_(false),
+      slot_size_(0),
+      control_size_(CMSG_SPACE(sizeof(int))),
+      dropped_(0) {
+  socket_.setReuseAddr(true);
+  socket_.setReusePort(reuse_port);
+  socket_.bindAddress(listen_addr);
+  channel_.setReadCallback(
+      std::bind(&UdpSocket::handleRead, this, std::placeholders::_1));
+  channel_.setWriteCallback(std::bind(&UdpSocket::handleWrite, this));
+}
+
+UdpSocket::~UdpSocket() { assert(!started_); }
+
+void UdpSocket::start() {
+  loop_->assertInLoopThread();
+  assert(!started_);
+  assert(batch_size_ > 0);
+  started_ = true;
+
+  if (gro_) {
+    int optval = 1;
+    if (::setsockopt(socket_.getFd(), SOL_UDP, UDP_GRO, &optval,
+                     sizeof optval) < 0) {
+      LOG << "UdpSocket::start() UDP_GRO unsupported, disabled";
+      gro_ = false;
+    }
+  }
+
+  /* Every buffer used on the hot path is allocated once here */
+  slot_size_ = gro_ ? GroSlotSize : max_datagram_size_;
+  recv_pool_.resize(batch_size_ * slot_size_);
+  recv_msgs_.resize(batch_size_);
+  recv_iovs_.resize(batch_size_);
+  recv_addrs_.resize(batch_size_);
+  recv_control_.resize(batch_size_ * control_size_);
+  for (int i = 0; i < batch_size_; ++i) {
+    struct msghdr& hdr = recv_msgs_[i].msg_hdr;
+    bzero(&hdr, sizeof hdr);
+    recv_iovs_[i].iov_base = &recv_pool_[i * slot_size_];
+    hdr.msg_name = &recv_addrs_[i];
+    hdr.msg_iov = &recv_iovs_[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = gro_ ? &recv_control_[i * control_size_] : nullptr;
+  }
+
+  send_msgs_.resize(batch_size_);
+  send_iovs_.resize(batch_size_);
+  send_control_.resize(batch_size_ * control_size_);
+  send_groups_.resize(batch_size_);
+
+  channel_.enableReading();
+}
+
+void UdpSocket::stop() {
+  loop_->assertInLoopThread();
+  if (started_) {
+    started_ = false;
+    channel_.disableAllEvents();
+    loop_->removeChannel(&channel_);
+  }
+}
+
+void UdpSocket::resetRecvSlots() {
+  for (int i = 0; i < batch_size_; ++i) {
+    struct msghdr& hdr = recv_msgs_[i].msg_hdr;
+    recv_iovs_[i].iov_len = slot_size_;
+    hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    hdr.msg_controllen = gro_ ? control_size_ : 0;
+    hdr.msg_flags = 0;
+  }
+}
+
+size_t UdpSocket::groSegmentSize(int i) {
+  struct msghdr& hdr = recv_msgs_[i].msg_hdr;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int gso_size = 0;
+      memcpy(&gso_size, CMSG_DATA(cmsg), sizeof gso_size);
+      return gso_size > 0 ? static_cast<size_t>(gso_size) : 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * ReadEventCallback of channel_
+ *
+ * Level trigger, one recvmmsg(2) per event is enough. Replies queued by the
+ * callbacks are flushed together once the whole batch is dispatched
+ */
+void UdpSocket::handleRead(Timestamp recv_time) {
+  loop_->assertInLoopThread();
+  resetRecvSlots();
+  int n = ::recvmmsg(socket_.getFd(), recv_msgs_.data(), batch_size_,
+                     MSG_DONTWAIT, nullptr);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      LOG << "Error: UdpSocket::handleRead " << errno;
+    }
+    return;
+  }
+
+  in_batch_ = true;
+  for (int i = 0; i < n; ++i) {
+    const struct msghdr& hdr = recv_msgs_[i].msg_hdr;
+    if (hdr.msg_flags & MSG_TRUNC) {
+      ++dropped_;
+      LOG << "UdpSocket::handleRead() datagram larger than " << slot_size_;
+      continue;
+    }
+
+    const char* data = &recv_pool_[i * slot_size_];
+    const size_t len = recv_msgs_[i].msg_len;
+    size_t segment = gro_ ? groSegmentSize(i) : 0;
+    if (segment == 0) {
+      segment = len;
+    }
+    InetAddress peer(reinterpret_cast<const struct sockaddr*>(&recv_addrs_[i]),
+                     hdr.msg_namelen);
+    /* Split GRO super-datagrams back into the datagrams the peer sent */
+    size_t offset = 0;
+    do {
+      size_t seg_len = std::min(segment, len - offset);
+      if (datagram_cb_) {
+        datagram_cb_(this, peer, std::string_view(data + offset, seg_len),
+                     recv_time);
+      }
+      offset += seg_len;
+    } while (offset < len);
+  }
+  in_batch_ = false;
+
+  if (!pending_.empty() && !channel_.isWriting()) {
+    flushPending();
+  }
+}
+
+/**
+ * WriteCallback of channel_, the socket send buffer has room again
+ */
+void UdpSocket::handleWrite() {
+  loop_->assertInLoopThread();
+  flushPending();
+}
+
+void UdpSocket::send(const InetAddress& peer, const void* data, size_t len) {
+  if (!loop_->isInLoopThread()) {
+    loop_->runInLoop(
+        std::bind(&UdpSocket::sendInLoop, this, peer,
+                  std::string(static_cast<const char*>(data), len)));
+    return;
+  }
+
+  if (peer.family() != family_) {
+    ++dropped_;
+    LOG << "UdpSocket::send() to " << peer.toHostPort()
+        << ", not the family of the socket";
+    return;
+  }
+  if (send_data_.size() + len > MaxPendingBytes) {
+    ++dropped_;
+    return;
+  }
+  PendingDatagram pending{send_data_.size(), len, peer};
+  const char* d = static_cast<const char*>(data);
+  send_data_.insert(send_data_.end(), d, d + len);
+  pending_.push_back(pending);
+
+  /* Deferred to the end of the batch, or to handleWrite() */
+  if (!in_batch_ && !channel_.isWriting()) {
+    flushPending();
+  }
+}
+
+void UdpSocket::sendInLoop(const InetAddress& peer, const std::string& data) {
+  send(peer, data.data(), data.size());
+}
+
+void UdpSocket::flushPending() {
+  loop_->assertInLoopThread();
+  size_t sent = 0;
+
+  while (sent < pending_.size()) {
+    int nmsgs = 0;
+    size_t idx = sent;
+    while (idx < pending_.size() && nmsgs < batch_size_) {
+      PendingDatagram& head = pending_[idx];
+      size_t count = 1;
+      size_t total = head.len;
+      if (gso_) {
+        /**
+         * Payloads of consecutive datagrams are adjacent in send_data_, so a
+         * run to the same peer can be one UDP_SEGMENT send. Every segment but
+         * the last must be exactly head.len bytes
+         */
+        while (idx + count < pending_.size() &&
+               count < static_cast<size_t>(MaxGsoSegments)) {
+          const PendingDatagram& next = pending_[idx + count];
+          if (!samePeer(next.peer, head.peer) || next.len > head.len ||
+              next.len == 0 || total + next.len > kMaxUdpPayload) {
+            break;
+          }
+          total += next.len;
+          ++count;
+          if (next.len < head.len) {
+            break;
+          }
+        }
+      }
+
+      struct iovec& iov = send_iovs_[nmsgs];
+      iov.iov_base = send_data_.data() + head.offset;
+      iov.iov_len = total;
+      struct msghdr& hdr = send_msgs_[nmsgs].msg_hdr;
+      bzero(&hdr, sizeof hdr);
+      hdr.msg_name = const_cast<struct sockaddr*>(head.peer.getSockAddr());
+      hdr.msg_namelen = head.peer.getSockLen();
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+      if (count > 1) {
+        hdr.msg_control = &send_control_[nmsgs * control_size_];
+        hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = static_cast<uint16_t>(head.len);
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof gso_size);
+      }
+      send_groups_[nmsgs] = count;
+      idx += count;
+      ++nmsgs;
+    }
+
+    int n = ::sendmmsg(socket_.getFd(), send_msgs_.data(), nmsgs, 0);
+    if (n < 0) {
+      int saved_errno = errno;
+      if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK) {
+        /* Wait for POLLOUT */
+        break;
+      } else if (send_groups_[0] > 1 &&
+                 (saved_errno == EINVAL || saved_errno == EIO ||
+                  saved_errno == ENOPROTOOPT)) {
+        LOG << "UdpSocket::flushPending() UDP_SEGMENT unsupported, disabled";
+        gso_ = false;
+      } else {
+        /* Drop the failing message so one bad peer can't stall the queue */
+        LOG << "Error: UdpSocket::flushPending " << saved_errno;
+        dropped_ += send_groups_[0];
+        sent += send_groups_[0];
+      }
+      continue;
+    }
+    for (int i = 0; i < n; ++i) {
+      sent += send_groups_[i];
+    }
+  }
+
+  if (sent == pending_.size()) {
+    pending_.clear();
+    send_data_.clear();
+  } else if (sent > 0) {
+    size_t consumed = pending_[sent].offset;
+    send_data_.erase(send_data_.begin(), send_data_.begin() + consumed);
+    pending_.erase(pending_.begin(), pending_.begin() + sent);
+    for (auto& pending : pending_) {
+      pending.offset -= consumed;
+    }
+  }
+
+  if (!pending_.empty() && !channel_.isWriting()) {
+    channel_.enableWriting();
+  } else if (pending_.empty() && channel_.isWriting()) {
+    channel_.disableWriting();
+  }
+}
@@ -0,0 +1,133 @@
+#include "upstream_pool.h"
+
+#include <algorithm>
+
+#include "buffer.h"
+#include "event_loop.h"
+#include "logging.h"
+
+UpstreamPool::UpstreamPool(EventLoop* loop)
+    : loop_(loop), max_waiters_(DefaultMaxWaiters) {}
+
+UpstreamPool::~UpstreamPool() {
+  loop_->assertInLoopThread();
+  for (auto& backend : backends_) {
+    for (auto& waiter : backend->waiters) {
+      waiter(TcpConnectionPtr());
+    }
+    backend->waiters.clear();
+    backend->idle.clear();
+    for (auto& client : backend->clients) {
+      TcpConnectionPtr conn = client->connection();
+      if (conn) {
+        /* The connection outlives the pool, detach it from this */
+        conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+        conn->setMessageCallback(
+            [](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+              buf->retrieveAll();
+            });
+        conn->setWriteCallback(WriteCompleteCallback());
+      }
+    }
+    /* ~TcpClient closes the connections and replaces their close callback */
+    backend->clients.clear();
+  }
+}
+
+int UpstreamPool::addBackend(const InetAddress& server_addr,
+                             size_t connections) {
+  loop_->assertInLoopThread();
+  assert(connections > 0);
+  const int index = static_cast<int>(backends_.size());
+  backends_.emplace_back(new Backend(server_addr));
+  Backend* backend = backends_.back().get();
+  const std::string name = server_addr.toHostPort();
+  for (size_t i = 0; i < connections; ++i) {
+    std::unique_ptr<TcpClient> client(new TcpClient(loop_, server_addr, name));
+    client->setConnectionCallback([this, backend](const TcpConnectionPtr& c) {
+      onConnection(backend, c);
+    });
+    client->setMessageCallback(std::bind(
+        &UpstreamPool::onIdleMessage, this, std::placeholders::_1,
+        std::placeholders::_2, std::placeholders::_3));
+    client->enableRetry();
+    client->connect();
+    backend->clients.push_back(std::move(client));
+  }
+  return index;
+}
+
+void UpstreamPool::lease(int backend_index, const LeaseCallback& cb) {
+  loop_->assertInLoopThread();
+  Backend* backend = backends_[backend_index].get();
+  if (!backend->idle.empty()) {
+    TcpConnectionPtr conn = std::move(backend->idle.back());
+    backend->idle.pop_back();
+    cb(conn);
+  } else if (backend->waiters.size() < max_waiters_) {
+    backend->waiters.push_back(cb);
+  } else {
+    LOG << "UpstreamPool::lease " << backend->server_addr.toHostPort()
+        << " too many waiters";
+    cb(TcpConnectionPtr());
+  }
+}
+
+void UpstreamPool::release(int backend_index, const TcpConnectionPtr& conn) {
+  loop_->assertInLoopThread();
+  assert(conn->getLoop() == loop_);
+  if (!conn->connected()) {
+    /* Its TcpClient is already reconnecting */
+    return;
+  }
+  conn->setMessageCallback(std::bind(
+      &UpstreamPool::onIdleMessage, this, std::placeholders::_1,
+      std::placeholders::_2, std::placeholders::_3));
+  conn->setWriteCallback(WriteCompleteCallback());
+  putIdle(backends_[backend_index].get(), conn);
+}
+
+size_t UpstreamPool::idleCount(int backend_index) const {
+  loop_->assertInLoopThread();
+  return backends_[backend_index]->idle.size();
+}
+
+size_t UpstreamPool::waiterCount(int backend_index) const {
+  loop_->assertInLoopThread();
+  return backends_[backend_index]->waiters.size();
+}
+
+void UpstreamPool::onConnection(Backend* backend,
+                                const TcpConnectionPtr& conn) {
+  if (conn->connected()) {
+    conn->setTcpNoDelay(true);
+    putIdle(backend, conn);
+  } else {
+    auto it = std::find(backend->idle.begin(), backend->idle.end(), conn);
+    if (it != backend->idle.end()) {
+      backend->idle.erase(it);
+    }
+  }
+}
+
+/**
+ * Bytes on an idle connection belong to no request, the stream can't be
+ * trusted anymore. Closing it makes its TcpClient reconnect
+ */
+void UpstreamPool::onIdleMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                                 Timestamp) {
+  LOG << "UpstreamPool::onIdleMessage " << conn->name() << " unexpected "
+      << buf->readableBytes() << " bytes";
+  buf->retrieveAll();
+  conn->forceClose();
+}
+
+void UpstreamPool::putIdle(Backend* backend, const TcpConnectionPtr& conn) {
+  if (!backend->waiters.empty()) {
+    LeaseCallback cb = std::move(backend->waiters.front());
+    backend->waiters.pop_front();
+    cb(conn);
+  } else {
+    backend->idle.push_back(conn);
+  }
+}
@@ -0,0 +1,412 @@
+#include "websocket_codec.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "buffer.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "logging.h"
+
+namespace {
+const char WebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/* Minimal SHA-1, only used to answer the handshake */
+class Sha1 {
+ public:
+  Sha1()
+      : state_{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0},
+        total_(0),
+        used_(0) {}
+
+  void update(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    total_ += len;
+    while (len > 0) {
+      size_t n = std::min(len, sizeof block_ - used_);
+      memcpy(block_ + used_, p, n);
+      used_ += n;
+      p += n;
+      len -= n;
+      if (used_ == sizeof block_) {
+        transform();
+        used_ = 0;
+      }
+    }
+  }
+
+  void final(uint8_t digest[20]) {
+    const uint64_t bits = total_ * 8;
+    const uint8_t pad = 0x80;
+    update(&pad, 1);
+    const uint8_t zero = 0;
+    while (used_ != 56) {
+      update(&zero, 1);
+    }
+    uint8_t length[8];
+    for (int i = 0; i < 8; ++i) {
+      length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    }
+    update(length, sizeof length);
+    for (int i = 0; i < 20; ++i) {
+      digest[i] = static_cast<uint8_t>(state_[i / 4] >> (24 - 8 * (i % 4)));
+    }
+  }
+
+ private:
+  static uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+  void transform() {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = static_cast<uint32_t>(block_[4 * i]) << 24 |
+             static_cast<uint32_t>(block_[4 * i + 1]) << 16 |
+             static_cast<uint32_t>(block_[4 * i + 2]) << 8 | block_[4 * i + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+             e = state_[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+  }
+
+  uint32_t state_[5];
+  uint64_t total_;
+  uint8_t block_[64];
+  size_t used_;
+};
+
+std::string base64Encode(const uint8_t* data, size_t len) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((len + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    uint32_t v = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+    out.push_back(alphabet[v >> 18]);
+    out.push_back(alphabet[(v >> 12) & 0x3F]);
+    out.push_back(alphabet[(v >> 6) & 0x3F]);
+    out.push_back(alphabet[v & 0x3F]);
+  }
+  if (i < len) {
+    uint32_t v = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0);
+    out.push_back(alphabet[v >> 18]);
+    out.push_back(alphabet[(v >> 12) & 0x3F]);
+    out.push_back(i + 1 < len ? alphabet[(v >> 6) & 0x3F] : '=');
+    out.push_back('=');
+  }
+  return out;
+}
+
+/**
+ * Serialize the header of an unmasked frame into @header
+ * @return header length, 2 to 10 bytes
+ */
+size_t encodeHeader(WebSocketOpcode opcode, uint64_t len, bool fin,
+                    uint8_t header[10]) {
+  header[0] = static_cast<uint8_t>((fin ? 0x80 : 0) |
+                                   static_cast<uint8_t>(opcode));
+  if (len < 126) {
+    header[1] = static_cast<uint8_t>(len);
+    return 2;
+  }
+  if (len <= 0xFFFF) {
+    header[1] = 126;
+    header[2] = static_cast<uint8_t>(len >> 8);
+    header[3] = static_cast<uint8_t>(len);
+    return 4;
+  }
+  header[1] = 127;
+  for (int i = 0; i < 8; ++i) {
+    header[2 + i] = static_cast<uint8_t>(len >> (56 - 8 * i));
+  }
+  return 10;
+}
+}  // namespace
+
+void WebSocketCodec::onMessage(const TcpConnectionPtr& conn, Buffer* buf,
+                               Timestamp recv_time) {
+  while (!closing_ && buf->readableBytes() >= 2) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf->peek());
+    const size_t readable = buf->readableBytes();
+    const bool fin = (p[0] & 0x80) != 0;
+    const bool control = (p[0] & 0x08) != 0;
+    const auto opcode = static_cast<WebSocketOpcode>(p[0] & 0x0F);
+
+    /* No extension is negotiated, and clients must mask every frame */
+    if ((p[0] & 0x70) != 0 || (p[1] & 0x80) == 0) {
+      fail(conn, buf, CloseProtocolError);
+      return;
+    }
+
+    uint64_t len = p[1] & 0x7F;
+    size_t header_len = 2;
+    if (len == 126) {
+      header_len = 4;
+      if (readable < header_len) {
+        break;
+      }
+      len = static_cast<uint64_t>(p[2]) << 8 | p[3];
+    } else if (len == 127) {
+      header_len = 10;
+      if (readable < header_len) {
+        break;
+      }
+      len = 0;
+      for (int i = 2; i < 10; ++i) {
+        len = len << 8 | p[i];
+      }
+    }
+    if (control && (!fin || len > MaxControlPayload)) {
+      fail(conn, buf, CloseProtocolError);
+      return;
+    }
+    if (!control && len > max_message_size_ - fragments_.size()) {
+      fail(conn, buf, CloseMessageTooBig);
+      return;
+    }
+    header_len += 4;  // masking key
+
+    if (readable < header_len + len) {
+      /* Make room for the whole frame once, instead of growing per read */
+      buf->ensureWritableBytes(header_len + len - readable);
+      break;
+    }
+
+    uint8_t key[4];
+    memcpy(key, buf->peek() + header_len - 4, sizeof key);
+    char* payload = buf->mutablePeek() + header_len;
+    unmask(payload, len, key);
+    uint16_t error =
+        onFrame(conn, fin, opcode, std::string_view(payload, len), recv_time);
+    if (error != 0) {
+      fail(conn, buf, error);
+      return;
+    }
+    buf->retrieve(header_len + len);
+  }
+  if (closing_) {
+    buf->retrieveAll();
+  }
+}
+
+uint16_t WebSocketCodec::onFrame(const TcpConnectionPtr& conn, bool fin,
+                                 WebSocketOpcode opcode,
+                                 std::string_view payload,
+                                 Timestamp recv_time) {
+  switch (opcode) {
+    case WebSocketOpcode::Text:
+    case WebSocketOpcode::Binary:
+      if (fragment_opcode_ != WebSocketOpcode::Continuation) {
+        return CloseProtocolError;
+      }
+      if (fin) {
+        message_cb_(conn, opcode, payload, recv_time);
+      } else {
+        fragment_opcode_ = opcode;
+        fragments_.assign(payload.data(), payload.size());
+      }
+      return 0;
+    case WebSocketOpcode::Continuation:
+      if (fragment_opcode_ == WebSocketOpcode::Continuation) {
+        return CloseProtocolError;
+      }
+      fragments_.append(payload.data(), payload.size());
+      if (fin) {
+        WebSocketOpcode message_opcode = fragment_opcode_;
+        fragment_opcode_ = WebSocketOpcode::Continuation;
+        message_cb_(conn, message_opcode, fragments_, recv_time);
+        fragments_.clear();
+      }
+      return 0;
+    case WebSocketOpcode::Ping:
+      send(conn, WebSocketOpcode::Pong, payload);
+      return 0;
+    case WebSocketOpcode::Pong:
+      return 0;
+    case WebSocketOpcode::Close: {
+      if (payload.size() == 1) {
+        return CloseProtocolError;
+      }
+      uint16_t code = CloseNormal;
+      if (payload.size() >= 2) {
+        code = static_cast<uint16_t>(static_cast<uint8_t>(payload[0]) << 8 |
+                                     static_cast<uint8_t>(payload[1]));
+      }
+      /* Echo the status, the peer's closing handshake is complete */
+      close(conn, code);
+      closing_ = true;
+      return 0;
+    }
+  }
+  return CloseProtocolError;
+}
+
+void WebSocketCodec::fail(const TcpConnectionPtr& conn, Buffer* buf,
+                          uint16_t code) {
+  LOG << "WebSocketCodec::onMessage [" << conn->name() << "] close " << code;
+  close(conn, code);
+  closing_ = true;
+  buf->retrieveAll();
+}
+
+void WebSocketCodec::encode(WebSocketOpcode opcode, std::string_view payload,
+                            bool fin, Buffer* output) {
+  uint8_t header[10];
+  size_t header_len = encodeHeader(opcode, payload.size(), fin, header);
+  output->ensureWritableBytes(header_len + payload.size());
+  output->append(header, header_len);
+  output->append(payload.data(), payload.size());
+}
+
+Slice WebSocketCodec::makeFrame(WebSocketOpcode opcode,
+                                std::string_view payload, bool fin) {
+  uint8_t header[10];
+  size_t header_len = encodeHeader(opcode, payload.size(), fin, header);
+  std::string frame;
+  frame.reserve(header_len + payload.size());
+  frame.append(reinterpret_cast<const char*>(header), header_len);
+  frame.append(payload.data(), payload.size());
+  return Slice(std::move(frame));
+}
+
+void WebSocketCodec::send(const TcpConnectionPtr& conn, WebSocketOpcode opcode,
+                          std::string_view payload) {
+  Buffer output;
+  encode(opcode, payload, true, &output);
+  conn->send(&output);
+}
+
+void WebSocketCodec::broadcast(const std::vector<TcpConnectionPtr>& conns,
+                               WebSocketOpcode opcode,
+                               std::string_view payload) {
+  if (conns.empty()) {
+    return;
+  }
+  Slice frame = makeFrame(opcode, payload);
+  for (const TcpConnectionPtr& conn : conns) {
+    conn->send(frame);
+  }
+}
+
+void WebSocketCodec::close(const TcpConnectionPtr& conn, uint16_t code,
+                           std::string_view reason) {
+  char payload[MaxControlPayload];
+  payload[0] = static_cast<char>(code >> 8);
+  payload[1] = static_cast<char>(code);
+  size_t reason_len = std::min(reason.size(), sizeof payload - 2);
+  memcpy(payload + 2, reason.data(), reason_len);
+  send(conn, WebSocketOpcode::Close, std::string_view(payload, 2 + reason_len));
+  conn->shutdown();
+}
+
+/**
+ * The key repeats every 4 bytes, so a register filled with it keeps the
+ * phase across 8, 16 and 32 byte strides. Loads and stores are unaligned,
+ * the payload starts wherever the frame header ends
+ */
+void WebSocketCodec::unmask(char* data, size_t len, const uint8_t key[4]) {
+  uint32_t key32;
+  memcpy(&key32, key, sizeof key32);
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i key256 = _mm256_set1_epi32(static_cast<int>(key32));
+  for (; i + 32 <= len; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), key256));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i key128 = _mm_set1_epi32(static_cast<int>(key32));
+  for (; i + 16 <= len; i += 16) {
+    __m128i* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key128));
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+  for (; i + 16 <= len; i += 16) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(data + i);
+    vst1q_u8(p, veorq_u8(vld1q_u8(p), key128));
+  }
+#endif
+  const uint64_t key64 = static_cast<uint64_t>(key32) << 32 | key32;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof word);
+    word ^= key64;
+    memcpy(data + i, &word, sizeof word);
+  }
+  for (; i < len; ++i) {
+    data[i] = static_cast<char>(data[i] ^ key[i & 3]);
+  }
+}
+
+bool WebSocketCodec::isUpgradeRequest(const HttpRequest& request) {
+  return request.method() == HttpRequest::Method::Get &&
+         HttpRequest::hasToken(request.getHeader("Upgrade"), "websocket") &&
+         HttpRequest::hasToken(request.getHeader("Connection"), "upgrade");
+}
+
+bool WebSocketCodec::acceptUpgrade(const HttpRequest& request,
+                                   HttpResponse* response) {
+  std::string_view key = request.getHeader("Sec-WebSocket-Key");
+  /* The key is 16 random bytes in base64 */
+  if (!isUpgradeRequest(request) ||
+      request.version() != HttpRequest::Version::Http11 ||
+      request.getHeader("Sec-WebSocket-Version") != "13" ||
+      key.size() != 24) {
+    response->setStatusCode(HttpResponse::StatusCode::BadRequest);
+    response->addHeader("Sec-WebSocket-Version", "13");
+    response->setCloseConnection(true);
+    return false;
+  }
+  response->setStatusCode(HttpResponse::StatusCode::SwitchingProtocols);
+  response->setCloseConnection(false);
+  response->addRawHeaders("Upgrade: websocket\r\nConnection: Upgrade\r\n");
+  response->addHeader("Sec-WebSocket-Accept", acceptKey(key));
+  return true;
+}
+
+std::string WebSocketCodec::acceptKey(std::string_view key) {
+  Sha1 sha1;
+  sha1.update(key.data(), key.size());
+  sha1.update(WebSocketGuid, sizeof WebSocketGuid - 1);
+  uint8_t digest[20];
+  sha1.final(digest);
+  return base64Encode(digest, sizeof digest);
+}
@@ -0,0 +1,371 @@
+/**
+ * HttpParser fed the same input whole, byte by byte and split at every
+ * offset, so that each resume point is hit, including a CRLF straddling
+ * two reads
+ *
+ * - requests: request line, headers, Content-Length and chunked bodies
+ *   with extensions and trailers, keep-alive per version and Connection
+ * - pipelined: several requests in one Buffer, consumed one next() at a time
+ * - errors: each rejected input and the status it is answered with
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "buffer.h"
+#include "http_parser.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "timestamp.h"
+
+namespace {
+int failures = 0;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      ++failures;                                                       \
+    }                                                                   \
+  } while (0)
+
+using Status = HttpResponse::StatusCode;
+
+/* A completed request copied out, its views die with next() */
+struct Parsed {
+  HttpRequest::Method method;
+  std::string method_str;
+  std::string path;
+  std::string query;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  bool keep_alive;
+};
+
+struct Outcome {
+  std::vector<Parsed> requests;
+  /* Unknown unless parse() returned Error */
+  Status error = Status::Unknown;
+  /* Bytes left in the Buffer after the last complete request, unless Error */
+  size_t leftover = 0;
+};
+
+Parsed copyOut(const HttpRequest& request) {
+  Parsed parsed;
+  parsed.method = request.method();
+  parsed.method_str = std::string(request.methodString());
+  parsed.path = std::string(request.path());
+  parsed.query = std::string(request.query());
+  for (const auto& header : request.headers()) {
+    parsed.headers.emplace_back(std::string(header.first),
+                                std::string(header.second));
+  }
+  parsed.body = std::string(request.body());
+  parsed.keep_alive = request.keepAlive();
+  return parsed;
+}
+
+/**
+ * Append @input to a Buffer in pieces, the first one @first bytes long and
+ * the rest @step bytes, parsing after each piece like a connection would
+ */
+Outcome run(std::string_view input, size_t first, size_t step,
+            size_t max_header_size = HttpParser::DefaultMaxHeaderSize,
+            size_t max_body_size = HttpParser::DefaultMaxBodySize) {
+  HttpParser parser(max_header_size, max_body_size);
+  Buffer buf;
+  Outcome outcome;
+  size_t pos = 0;
+  while (pos < input.size() && outcome.error == Status::Unknown) {
+    size_t len = std::min(pos == 0 ? first : step, input.size() - pos);
+    buf.append(input.data() + pos, len);
+    pos += len;
+    HttpParser::Result result;
+    while ((result = parser.parse(&buf, Timestamp::now())) ==
+           HttpParser::Result::Complete) {
+      outcome.requests.push_back(copyOut(parser.request()));
+      parser.next(&buf);
+    }
+    if (result == HttpParser::Result::Error) {
+      outcome.error = parser.errorStatus();
+    }
+  }
+  outcome.leftover = buf.readableBytes();
+  return outcome;
+}
+
+bool sameRequests(const Outcome& a, const Outcome& b) {
+  /* Parsing stops at an error, so what is left depends on the pieces */
+  if (a.requests.size() != b.requests.size() || a.error != b.error ||
+      (a.error == Status::Unknown && a.leftover != b.leftover)) {
+    return false;
+  }
+  for (size_t i = 0; i < a.requests.size(); ++i) {
+    const Parsed& x = a.requests[i];
+    const Parsed& y = b.requests[i];
+    if (x.method != y.method || x.method_str != y.method_str ||
+        x.path != y.path || x.query != y.query || x.headers != y.headers ||
+        x.body != y.body || x.keep_alive != y.keep_alive) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Parse @input whole, then check that byte by byte and every two-piece split
+ * give the same result
+ */
+Outcome runAllSplits(std::string_view input,
+                     size_t max_header_size = HttpParser::DefaultMaxHeaderSize,
+                     size_t max_body_size = HttpParser::DefaultMaxBodySize) {
+  Outcome whole = run(input, input.size(), input.size(), max_header_size,
+                      max_body_size);
+  CHECK(sameRequests(whole, run(input, 1, 1, max_header_size, max_body_size)));
+  for (size_t split = 1; split < input.size(); ++split) {
+    if (!sameRequests(whole, run(input, split, input.size(), max_header_size,
+                                 max_body_size))) {
+      fprintf(stderr, "differs when split at %zu\n", split);
+      ++failures;
+      break;
+    }
+  }
+  return whole;
+}
+
+void testRequests() {
+  const int before = failures;
+
+  Outcome get = runAllSplits(
+      "GET /search?q=a%20b&n=1 HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "X-Empty:\r\n"
+      "Accept:  text/html ,*/*\t\r\n"
+      "\r\n");
+  CHECK(get.error == Status::Unknown);
+  CHECK(get.leftover == 0);
+  CHECK(get.requests.size() == 1);
+  if (get.requests.size() == 1) {
+    const Parsed& r = get.requests[0];
+    CHECK(r.method == HttpRequest::Method::Get);
+    CHECK(r.method_str == "GET");
+    CHECK(r.path == "/search");
+    CHECK(r.query == "q=a%20b&n=1");
+    CHECK(r.headers.size() == 3);
+    if (r.headers.size() == 3) {
+      CHECK(r.headers[0].first == "Host");
+      CHECK(r.headers[0].second == "example.com");
+      CHECK(r.headers[1].first == "X-Empty");
+      CHECK(r.headers[1].second.empty());
+      /* Surrounding whitespace is trimmed, inner whitespace kept */
+      CHECK(r.headers[2].second == "text/html ,*/*");
+    }
+    CHECK(r.body.empty());
+    CHECK(r.keep_alive);
+  }
+
+  /* Empty lines before the request line are skipped */
+  Outcome leading = runAllSplits("\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+  CHECK(leading.requests.size() == 1 && leading.leftover == 0);
+
+  Outcome post = runAllSplits(
+      "POST /submit HTTP/1.1\r\n"
+      "content-length: 11\r\n"
+      "Content-Length: 11\r\n"
+      "\r\n"
+      "hello\r\n\r\nx!");
+  CHECK(post.requests.size() == 1 && post.leftover == 0);
+  if (post.requests.size() == 1) {
+    CHECK(post.requests[0].method == HttpRequest::Method::Post);
+    CHECK(post.requests[0].query.empty());
+    /* A body that contains a blank line is not mistaken for a head end */
+    CHECK(post.requests[0].body == "hello\r\n\r\nx!");
+  }
+
+  Outcome chunked = runAllSplits(
+      "PUT /upload HTTP/1.1\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "5;name=value\r\nhello\r\n"
+      "B \r\n, chunked\r\n\r\n"
+      "0\r\n"
+      "Checksum: 1234\r\n"
+      "Expires: never\r\n"
+      "\r\n");
+  CHECK(chunked.requests.size() == 1 && chunked.leftover == 0);
+  if (chunked.requests.size() == 1) {
+    const Parsed& r = chunked.requests[0];
+    CHECK(r.body == "hello, chunked\r\n");
+    /* Trailers are consumed but not reported as headers */
+    CHECK(r.headers.size() == 1);
+  }
+
+  Outcome no_trailers = runAllSplits(
+      "POST / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n"
+      "3\r\nabc\r\n0\r\n\r\n");
+  CHECK(no_trailers.requests.size() == 1 && no_trailers.leftover == 0);
+  if (no_trailers.requests.size() == 1) {
+    CHECK(no_trailers.requests[0].body == "abc");
+  }
+
+  struct KeepAliveCase {
+    const char* input;
+    bool keep_alive;
+  };
+  const KeepAliveCase keep_alive_cases[] = {
+      {"GET / HTTP/1.1\r\n\r\n", true},
+      {"GET / HTTP/1.1\r\nConnection: Upgrade, Close\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", true},
+      {"GET / HTTP/1.0\r\nConnection: keep-alive, close\r\n\r\n", false},
+  };
+  for (const auto& c : keep_alive_cases) {
+    Outcome outcome = run(c.input, 1, 1);
+    CHECK(outcome.requests.size() == 1);
+    if (outcome.requests.size() == 1 &&
+        outcome.requests[0].keep_alive != c.keep_alive) {
+      fprintf(stderr, "keep-alive should be %d for %s", c.keep_alive,
+              c.input);
+      ++failures;
+    }
+  }
+
+  printf("requests: %s\n", failures == before ? "ok" : "FAILED");
+}
+
+void testPipelined() {
+  const int before = failures;
+
+  Outcome outcome = runAllSplits(
+      "GET /a HTTP/1.1\r\n\r\n"
+      "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nxyz"
+      "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "2\r\nhi\r\n0\r\nT: v\r\n\r\n"
+      "\r\n"
+      "DELETE /d?x HTTP/1.0\r\n\r\n"
+      "GET /partial HTTP/1.1\r\nHo");
+  CHECK(outcome.error == Status::Unknown);
+  CHECK(outcome.requests.size() == 4);
+  if (outcome.requests.size() == 4) {
+    CHECK(outcome.requests[0].path == "/a");
+    CHECK(outcome.requests[0].body.empty());
+    CHECK(outcome.requests[1].path == "/b");
+    CHECK(outcome.requests[1].body == "xyz");
+    CHECK(outcome.requests[2].path == "/c");
+    CHECK(outcome.requests[2].body == "hi");
+    CHECK(outcome.requests[3].method == HttpRequest::Method::Delete);
+    CHECK(outcome.requests[3].query == "x");
+    CHECK(!outcome.requests[3].keep_alive);
+  }
+  /* The incomplete last request stays buffered */
+  CHECK(outcome.leftover == strlen("GET /partial HTTP/1.1\r\nHo"));
+
+  printf("pipelined: %s\n", failures == before ? "ok" : "FAILED");
+}
+
+void testErrors() {
+  const int before = failures;
+
+  struct ErrorCase {
+    const char* name;
+    std::string input;
+    Status status;
+    size_t max_header_size;
+    size_t max_body_size;
+  };
+  const size_t kHeader = HttpParser::DefaultMaxHeaderSize;
+  const size_t kBody = HttpParser::DefaultMaxBodySize;
+  const ErrorCase cases[] = {
+      {"both framings",
+       "POST / HTTP/1.1\r\nContent-Length: 3\r\n"
+       "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"both framings, chunked first",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+       "Content-Length: 3\r\n\r\nabc",
+       Status::BadRequest, kHeader, kBody},
+      {"conflicting lengths",
+       "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"signed length", "POST / HTTP/1.1\r\nContent-Length: +3\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"overflowing length",
+       "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"unsupported coding",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n",
+       Status::NotImplemented, kHeader, kBody},
+      {"unknown method", "BREW /pot HTTP/1.1\r\n\r\n", Status::NotImplemented,
+       kHeader, kBody},
+      {"unsupported version", "GET / HTTP/2.0\r\n\r\n",
+       Status::VersionNotSupported, kHeader, kBody},
+      {"bad version", "GET / HTTQ/1.1\r\n\r\n", Status::BadRequest, kHeader,
+       kBody},
+      {"missing target", "GET  HTTP/1.1\r\n\r\n", Status::BadRequest, kHeader,
+       kBody},
+      {"no colon", "GET / HTTP/1.1\r\nHost\r\n\r\n", Status::BadRequest,
+       kHeader, kBody},
+      {"space before colon", "GET / HTTP/1.1\r\nHost : a\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"obsolete folding", "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"head too large",
+       "GET / HTTP/1.1\r\nX: " + std::string(64, 'x') + "\r\n\r\n",
+       Status::HeaderFieldsTooLarge, 64, kBody},
+      {"head too large, unterminated",
+       "GET / HTTP/1.1\r\nX: " + std::string(64, 'x'),
+       Status::HeaderFieldsTooLarge, 64, kBody},
+      {"body too large", "POST / HTTP/1.1\r\nContent-Length: 9\r\n\r\n",
+       Status::PayloadTooLarge, kHeader, 8},
+      {"chunks too large",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+       "5\r\nabcde\r\n4\r\n",
+       Status::PayloadTooLarge, kHeader, 8},
+      {"bad chunk size",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nx\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"empty chunk size",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n;a\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"chunk without CRLF",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcd\r\n",
+       Status::BadRequest, kHeader, kBody},
+      {"chunk line too long",
+       "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1;" +
+           std::string(HttpParser::MaxChunkLineSize, 'e'),
+       Status::BadRequest, kHeader, kBody},
+  };
+  for (const auto& c : cases) {
+    Outcome outcome = runAllSplits(c.input, c.max_header_size,
+                                   c.max_body_size);
+    if (outcome.error != c.status || !outcome.requests.empty()) {
+      fprintf(stderr, "%s: status %d, %zu requests\n", c.name,
+              static_cast<int>(outcome.error), outcome.requests.size());
+      ++failures;
+    }
+  }
+
+  /* A request before the bad one still completes, the error sticks */
+  Outcome after = runAllSplits(
+      "GET /ok HTTP/1.1\r\n\r\n"
+      "GET / HTTP/9.9\r\n\r\n"
+      "GET /never HTTP/1.1\r\n\r\n");
+  CHECK(after.requests.size() == 1);
+  CHECK(after.error == Status::VersionNotSupported);
+
+  printf("errors: %s\n", failures == before ? "ok" : "FAILED");
+}
+}  // namespace
+
+int main() {
+  testRequests();
+  testPipelined();
+  testErrors();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/**
+ * TLS over loopback with a self-signed certificate generated at startup
+ *
+ * - echo: handshake, a greeting from the server, a payload echoed back and
+ *   close_notify from the client, once with kernel TLS requested and once
+ *   with the userspace fallback (setKernelTls(false))
+ * - handshake_failure: a verifying client rejects the self-signed
+ *   certificate, neither side reports the connection up
+ *
+ * Kernel TLS is used only if the kernel has the "tls" module, otherwise the
+ * first run falls back and says so.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "buffer.h"
+#include "event_loop.h"
+#include "inet_addr.h"
+#include "metrics.h"
+#include "tcp_client.h"
+#include "tcp_server.h"
+#include "tls_context.h"
+
+namespace {
+int failures = 0;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      ++failures;                                                       \
+    }                                                                   \
+  } while (0)
+
+/* Guards every case against a hang */
+const double TimeoutSeconds = 10.0;
+
+struct Credentials {
+  std::string dir;
+  std::string cert_file;
+  std::string key_file;
+};
+
+/* A P-256 key and a certificate for CN=localhost signed by itself */
+bool writeSelfSigned(Credentials* credentials) {
+  char dir[] = "/tmp/tls_test.XXXXXX";
+  if (::mkdtemp(dir) == nullptr) {
+    return false;
+  }
+  credentials->dir = dir;
+  credentials->cert_file = credentials->dir + "/cert.pem";
+  credentials->key_file = credentials->dir + "/key.pem";
+
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* cert = X509_new();
+  bool ok = key != nullptr && cert != nullptr;
+  if (ok) {
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(
+        name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    ok = X509_sign(cert, key, EVP_sha256()) > 0;
+  }
+  if (ok) {
+    FILE* fp = ::fopen(credentials->key_file.c_str(), "w");
+    ok = fp != nullptr &&
+         PEM_write_PrivateKey(fp, key, nullptr, nullptr, 0, nullptr,
+                              nullptr) == 1;
+    if (fp != nullptr) {
+      ::fclose(fp);
+    }
+  }
+  if (ok) {
+    FILE* fp = ::fopen(credentials->cert_file.c_str(), "w");
+    ok = fp != nullptr && PEM_write_X509(fp, cert) == 1;
+    if (fp != nullptr) {
+      ::fclose(fp);
+    }
+  }
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  return ok;
+}
+
+void removeCredentials(const Credentials& credentials) {
+  ::unlink(credentials.cert_file.c_str());
+  ::unlink(credentials.key_file.c_str());
+  ::rmdir(credentials.dir.c_str());
+}
+
+/* A loopback port free right now */
+uint16_t freePort() {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof addr;
+  ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len);
+  ::getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  ::close(fd);
+  return ntohs(addr.sin_port);
+}
+
+/* Value of an unlabelled metric in the scrape, -1 if missing */
+long metric(const std::string& name) {
+  const std::string metrics = MetricsRegistry::instance().scrape();
+  const size_t pos = metrics.find("\n" + name + " ");
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return ::strtol(metrics.c_str() + pos + name.size() + 2, nullptr, 10);
+}
+
+void testEcho(const Credentials& credentials, bool kernel_tls) {
+  const char* mode = kernel_tls ? "kernel" : "userspace";
+  EventLoop loop;
+  std::shared_ptr<TlsContext> server_context =
+      TlsContext::newServer(credentials.cert_file, credentials.key_file);
+  std::shared_ptr<TlsContext> client_context = TlsContext::newClient(false);
+  CHECK(server_context && client_context);
+  if (!server_context || !client_context) {
+    return;
+  }
+  server_context->setKernelTls(kernel_tls);
+  client_context->setKernelTls(kernel_tls);
+
+  const std::string greeting("hello");
+  /* Many records, and more than a socket buffer takes at once */
+  std::string payload(1 << 20, '\0');
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = static_cast<char>(i * 31 + i / 4096);
+  }
+
+  const InetAddress addr("127.0.0.1", freePort());
+  TcpServer server(&loop, addr);
+  server.setTlsContext(server_context);
+  bool server_up = false;
+  bool server_down = false;
+  bool close_notify = false;
+  bool kernel_send = false;
+  server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+    if (conn->connected()) {
+      server_up = true;
+      kernel_send = conn->tlsSession()->kernelSend();
+      conn->send(greeting);
+    } else {
+      server_down = true;
+      close_notify = conn->tlsSession()->receivedShutdown();
+    }
+  });
+  server.setMessageCallback(
+      [](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+        conn->send(buf);
+      });
+
+  TcpClient client(&loop, addr, "tls_test");
+  client.setTlsContext(client_context, "localhost");
+  bool client_up = false;
+  bool client_down = false;
+  std::string received;
+  client.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+    if (conn->connected()) {
+      client_up = true;
+    } else {
+      client_down = true;
+      loop.quit();
+    }
+  });
+  client.setMessageCallback(
+      [&](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+        const bool greeted = received.size() >= greeting.size();
+        received += buf->retrieveAsString();
+        if (!greeted && received.size() >= greeting.size()) {
+          conn->send(payload);
+        }
+        if (received.size() == greeting.size() + payload.size()) {
+          /* close_notify, then FIN */
+          conn->shutdown();
+        }
+      });
+
+  bool timed_out = false;
+  loop.runAfter(TimeoutSeconds, [&] {
+    timed_out = true;
+    loop.quit();
+  });
+  server.start();
+  client.connect();
+  loop.loop();
+
+  CHECK(!timed_out);
+  CHECK(server_up && client_up);
+  CHECK(received == greeting + payload);
+  CHECK(server_down && client_down);
+  CHECK(close_notify);
+  if (!kernel_tls) {
+    CHECK(!kernel_send);
+  }
+  printf("echo (%s requested): kernel tls send %s, %zu bytes echoed, %s\n",
+         mode, kernel_send ? "on" : "off", received.size(),
+         failures == 0 ? "ok" : "FAILED");
+}
+
+void testHandshakeFailure(const Credentials& credentials) {
+  EventLoop loop;
+  std::shared_ptr<TlsContext> server_context =
+      TlsContext::newServer(credentials.cert_file, credentials.key_file);
+  /* Verifies against the system CAs, which didn't sign the certificate */
+  std::shared_ptr<TlsContext> client_context = TlsContext::newClient(true);
+  CHECK(server_context && client_context);
+  if (!server_context || !client_context) {
+    return;
+  }
+
+  const InetAddress addr("127.0.0.1", freePort());
+  TcpServer server(&loop, addr);
+  server.setTlsContext(server_context);
+  int server_callbacks = 0;
+  server.setConnectionCallback(
+      [&](const TcpConnectionPtr&) { ++server_callbacks; });
+
+  TcpClient client(&loop, addr, "tls_test");
+  client.setTlsContext(client_context, "localhost");
+  int client_callbacks = 0;
+  client.setConnectionCallback(
+      [&](const TcpConnectionPtr&) { ++client_callbacks; });
+
+  /**
+   * A failed handshake is never reported up, wait for the server to accept
+   * and both ends to be destroyed
+   */
+  const long accepts = metric("tcp_accepts_total");
+  bool attempted = false;
+  bool timed_out = false;
+  loop.runEvery(0.01, [&] {
+    attempted = metric("tcp_accepts_total") > accepts;
+    if (attempted && !client.connection() &&
+        metric("tcp_connections") == 0) {
+      loop.quit();
+    }
+  });
+  loop.runAfter(TimeoutSeconds, [&] {
+    timed_out = true;
+    loop.quit();
+  });
+  server.start();
+  client.connect();
+  loop.loop();
+
+  CHECK(!timed_out);
+  CHECK(attempted);
+  CHECK(server_callbacks == 0);
+  CHECK(client_callbacks == 0);
+  printf("handshake_failure: %s\n", failures == 0 ? "ok" : "FAILED");
+}
+}  // namespace
+
+int main() {
+  Credentials credentials;
+  if (!writeSelfSigned(&credentials)) {
+    fprintf(stderr, "can't generate a self-signed certificate\n");
+    return 1;
+  }
+  testEcho(credentials, true);
+  testEcho(credentials, false);
+  testHandshakeFailure(credentials);
+  removeCredentials(credentials);
+  return failures == 0 ? 0 : 1;
+}